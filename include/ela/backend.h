@@ -71,6 +71,171 @@ struct ela_el_backend
 
     /** Standalone constructor */
     struct ela_el *(*create)(void);
+
+    /*
+      Optional operations, ela returns ENOTSUP when they are NULL.
+     */
+
+    /** Buffer pool creation. See @ref ela_buffer_group_create */
+    ela_error_t (*buffer_group_create)(
+        struct ela_el *context,
+        uint16_t group,
+        unsigned int count,
+        size_t size);
+
+    /** Receive completion source. See @ref ela_recv_multishot */
+    ela_error_t (*recv_multishot)(
+        struct ela_el *context,
+        struct ela_event_source *src,
+        int fd,
+        uint16_t group,
+        ela_completion_func *func);
+
+    /** Accept completion source. See @ref ela_accept_multishot */
+    ela_error_t (*accept_multishot)(
+        struct ela_el *context,
+        struct ela_event_source *src,
+        int fd,
+        ela_completion_func *func);
+
+    /** Timer wheel granularity. See @ref ela_set_timer_tick */
+    ela_error_t (*set_timer_tick)(
+        struct ela_el *context,
+        const struct timeval *tick);
+
+    /** Timeout coalescing. See @ref ela_set_timeout_slack */
+    ela_error_t (*set_timeout_slack)(
+        struct ela_el *context,
+        struct ela_event_source *src,
+        const struct timeval *slack);
+
+    /** Loop counters. See @ref ela_get_stats */
+    ela_error_t (*get_stats)(
+        struct ela_el *context,
+        struct ela_stats *stats);
+
+    /** Timeout class allocation. See @ref ela_timeout_class_create */
+    ela_error_t (*timeout_class_create)(
+        struct ela_el *context,
+        const struct timeval *duration,
+        struct ela_timeout_class **cls);
+
+    /** Class timeout. See @ref ela_set_timeout_class */
+    ela_error_t (*set_timeout_class)(
+        struct ela_el *context,
+        struct ela_event_source *src,
+        struct ela_timeout_class *cls,
+        uint32_t flags);
+
+    /** Lazy timeout restart. See @ref ela_touch_timeout */
+    ela_error_t (*touch_timeout)(
+        struct ela_el *context,
+        struct ela_event_source *src);
+
+    /** Absolute timeout. See @ref ela_set_deadline */
+    ela_error_t (*set_deadline)(
+        struct ela_el *context,
+        struct ela_event_source *src,
+        const struct timespec *deadline,
+        uint32_t flags);
+
+    /** Cached loop time. See @ref ela_now */
+    struct timespec (*now)(struct ela_el *context);
+
+    /** Periodic timeout overrun. See @ref ela_timeout_overrun */
+    uint64_t (*timeout_overrun)(
+        struct ela_el *context,
+        struct ela_event_source *src);
+
+    /** Optional: source storage size. If set, source_init and
+        source_cleanup must be set too, and libela handles source
+        memory: source_alloc and source_free are not used. See @ref
+        ela_source_size */
+    size_t (*source_size)(struct ela_el *context);
+
+    /** Set a source up in storage of source_size bytes. See @ref
+        ela_source_init */
+    ela_error_t (*source_init)(
+        struct ela_el *context,
+        struct ela_event_source *src,
+        ela_handler_func *func,
+        void *priv);
+
+    /** Remove a source from the loop and release its resources,
+        leaving storage alone. See @ref ela_source_cleanup */
+    void (*source_cleanup)(
+        struct ela_el *context,
+        struct ela_event_source *src);
+
+    /** Optional: thread-safe call queueing. If set, exit must be
+        thread-safe as well. See @ref ela_post */
+    ela_error_t (*post)(
+        struct ela_el *context,
+        ela_post_func *func,
+        void *data);
+
+    /** Optional: run from several threads. See @ref ela_run_shared */
+    ela_error_t (*run_shared)(
+        struct ela_el *context,
+        unsigned int nthreads);
+
+    /** Optional: move a source between loops. detach removes it from
+        its loop on that loop thread, keeping what attach needs to add
+        it back to another loop, from the other loop thread. See @ref
+        ela_source_migrate */
+    ela_error_t (*source_detach)(
+        struct ela_el *context,
+        struct ela_event_source *src);
+    ela_error_t (*source_attach)(
+        struct ela_el *context,
+        struct ela_event_source *src);
+
+    /** Optional: make a source ready. See @ref ela_activate */
+    ela_error_t (*activate)(
+        struct ela_el *context,
+        struct ela_event_source *src,
+        uint32_t mask);
+
+    /** Optional: watch a signal. See @ref ela_set_signal */
+    ela_error_t (*set_signal)(
+        struct ela_el *context,
+        struct ela_event_source *src,
+        int signo);
+
+    /** Optional: watch a child process. See @ref ela_set_child */
+    ela_error_t (*set_child)(
+        struct ela_el *context,
+        struct ela_event_source *src,
+        pid_t pid);
+    ela_error_t (*child_status)(
+        struct ela_el *context,
+        struct ela_event_source *src,
+        int *status);
+
+    /** Optional: run one loop iteration, waiting until the absolute
+        monotonic deadline at most, NULL for no limit. Returns the
+        number of handlers called or a negative errno value, and sets
+        done once the loop got exited or has no source left. See @ref
+        ela_run_once */
+    int (*run_once)(
+        struct ela_el *context,
+        const struct timespec *deadline,
+        int *done);
+
+    /** Optional: spin before blocking. See @ref ela_set_busy_poll */
+    ela_error_t (*set_busy_poll)(
+        struct ela_el *context,
+        const struct timeval *spin,
+        uint32_t flags);
+
+    /** Optional: called after source_cleanup by ela_source_free.
+        Returns 1 if the backend releases storage later itself, with
+        the release function given, because a thread still runs the
+        source handler. */
+    int (*source_release_later)(
+        struct ela_el *context,
+        struct ela_event_source *src,
+        void (*release)(struct ela_el *context, void *mem));
 };
 
 /**
@@ -95,6 +260,32 @@ struct ela_el
        Pointer to the event loop backend.
      */
     const struct ela_el_backend *backend;
+
+    /**
+       Source allocator state, owned by libela. Backends must
+       initialize it to NULL.
+     */
+    struct ela_allocator *allocator;
+
+    /**
+       Lock serializing calls on the loop while it runs from several
+       threads, NULL otherwise. Owned by the backend run_shared
+       implementation, must be initialized to NULL.
+     */
+    struct ela_shared *shared;
+
+    /**
+       Hooks registered with @ref ela_hook_add, owned by libela.
+       Backends must initialize it to NULL, and call @ref
+       ela_hooks_run around their wait for events.
+     */
+    struct ela_hooks *hooks;
+
+    /**
+       Sources behind @ref ela_defer and @ref ela_call_later, owned by
+       libela. Backends must initialize it to NULL.
+     */
+    struct ela_defer_pool *defer;
 };
 
 /**
@@ -106,4 +297,15 @@ struct ela_el
 ELA_EXPORT
 void ela_register(const struct ela_el_backend *backend);
 
+/**
+   @this calls the loop hooks registered for an event, see @ref
+   ela_hook_add. Backends call it from the loop thread, just before
+   and after they wait for events.
+
+   @param ctx The event loop context
+   @param when @ref #ELA_HOOK_BEFORE_POLL or @ref #ELA_HOOK_AFTER_POLL
+ */
+ELA_EXPORT
+void ela_hooks_run(struct ela_el *ctx, uint32_t when);
+
 #endif
@@ -20,7 +20,10 @@
  */
 
 #include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
 #include <sys/time.h>
+#include <time.h>
 
 /* GCC visibility */
 #if defined(__GNUC__) && __GNUC__ >= 4 /** mkdoc:skip */
@@ -36,6 +39,14 @@
  */
 struct ela_event_source;
 
+/**
+   @this is an opaque timeout class, shared by sources that all use
+   the same timeout duration.
+
+   @mgroup {Event source setup}
+ */
+struct ela_timeout_class;
+
 /**
    @this is a callback function type on FD readiness or timeout.
 
@@ -47,6 +58,22 @@ struct ela_event_source;
 typedef void ela_handler_func(struct ela_event_source *source, int fd,
                               uint32_t mask, void *data);
 
+/**
+   @this is a callback function type for completion sources, see
+   @ref ela_recv_multishot and @ref ela_accept_multishot.
+
+   @param source Event source
+   @param fd Relevant file descriptor
+   @param res Received byte count (0 on end of stream) for receive
+          sources, accepted file descriptor for accept sources, or a
+          negative @tt errno value.
+   @param buf Received data for receive sources, only valid until
+          the callback returns. NULL otherwise.
+   @param data Callback private data
+ */
+typedef void ela_completion_func(struct ela_event_source *source, int fd,
+                                 ssize_t res, const void *buf, void *data);
+
 /**
    @mgroup {Source source type control}
    Read available action
@@ -67,6 +94,41 @@ typedef void ela_handler_func(struct ela_event_source *source, int fd,
    Dont auto reinsert
  */
 #define ELA_EVENT_ONCE 8
+/**
+   @mgroup {Source source type control}
+   Timeout may be rounded up to the loop timer tick, see @ref
+   ela_set_timer_tick. Such timeouts are cheap to arm and cancel.
+ */
+#define ELA_EVENT_COARSE 16
+/**
+   @mgroup {Source source type control}
+   Repeating timeout fires at fixed multiples of its period from the
+   time the source got added, regardless of dispatch latency. Missed
+   periods are reported by @ref ela_timeout_overrun.
+ */
+#define ELA_EVENT_PERIODIC 32
+/**
+   @mgroup {Source source type control}
+   With @ref #ELA_EVENT_PERIODIC, fire once for each missed period
+   rather than reporting them as an overrun count.
+ */
+#define ELA_EVENT_CATCHUP 64
+/**
+   @mgroup {Source source type control}
+   Report fd readiness when it changes only, rather than as long as it
+   lasts. Handlers must then read or write until @tt EAGAIN.
+ */
+#define ELA_EVENT_EDGE 128
+/**
+   @mgroup {Source source type control}
+   A signal got delivered, see @ref ela_set_signal
+ */
+#define ELA_EVENT_SIGNAL 256
+/**
+   @mgroup {Source source type control}
+   A child process exited, see @ref ela_set_child
+ */
+#define ELA_EVENT_CHILD 512
 
 struct ela_el;
 
@@ -111,6 +173,94 @@ void ela_source_free(
     struct ela_el *context,
     struct ela_event_source *src);
 
+/**
+   @this is a source allocation hook, see @ref ela_set_allocator.
+ */
+typedef void *ela_alloc_func(void *opaque, size_t size);
+
+/**
+   @this is a source release hook, see @ref ela_set_allocator.
+ */
+typedef void ela_free_func(void *opaque, void *ptr);
+
+/**
+   @this returns the storage size an event source needs in this
+   loop, for use with @ref ela_source_init.
+
+   @mgroup {Event source allocation}
+
+   @param ctx The event loop context
+   @returns Size in bytes, or 0 if the backend does not support
+   caller-provided storage
+ */
+ELA_EXPORT
+size_t ela_source_size(struct ela_el *ctx);
+
+/**
+   @this initializes an event source in caller-provided storage, that
+   is at least @ref ela_source_size bytes large and suitably aligned
+   for any type. The storage itself is the returned source handle.
+
+   @mgroup {Event source allocation}
+
+   @param ctx The event loop context
+   @param storage Source storage
+   @param func Callback to call on event ready state
+   @param priv Callback's private data
+   @returns 0 or ENOTSUP if the backend does not support it
+
+   Such a source must be released with @ref ela_source_cleanup, never
+   with @ref ela_source_free, before its storage goes away.
+ */
+ELA_EXPORT
+ela_error_t ela_source_init(
+    struct ela_el *ctx,
+    void *storage,
+    ela_handler_func *func,
+    void *priv);
+
+/**
+   @this releases an event source set up with @ref ela_source_init,
+   removing it from the loop. Storage is left to the caller.
+
+   @mgroup {Event source allocation}
+
+   @param ctx The event loop context
+   @param src Event source handle
+
+   On a shared loop, this waits for a handler of the source running on
+   another thread to return, see @ref ela_run_shared. Loop hooks
+   cannot wait, storage must then outlive that handler.
+ */
+ELA_EXPORT
+void ela_source_cleanup(
+    struct ela_el *ctx,
+    struct ela_event_source *src);
+
+/**
+   @this sets how @ref ela_source_alloc gets memory. By default,
+   sources are taken from per-loop slabs that are only returned to the
+   system on @ref ela_close, which then releases any source still
+   allocated.
+
+   @mgroup {Event source allocation}
+
+   @param ctx The event loop context
+   @param alloc Allocation hook, or NULL to return to the default
+   @param free Release hook, NULL if and only if alloc is
+   @param opaque Passed to hooks
+   @returns 0, EBUSY if sources are currently allocated, or ENOTSUP if
+   the backend manages its own source memory
+
+   Sources allocated through hooks are not released by @ref ela_close.
+ */
+ELA_EXPORT
+ela_error_t ela_set_allocator(
+    struct ela_el *ctx,
+    ela_alloc_func *alloc,
+    ela_free_func *free,
+    void *opaque);
+
 /**
    @this sets a file descriptor for watching in the event loop.
 
@@ -120,12 +270,16 @@ void ela_source_free(
    @param src Event source handle, for unregistration
    @param fd File descriptor to watch for
    @param flags Bitmask of events to watch for The only relevant flags
-          are @ref #ELA_EVENT_ONCE, @ref #ELA_EVENT_READABLE and
-          @ref #ELA_EVENT_WRITABLE.
-   @returns Whether things went all right
+          are @ref #ELA_EVENT_ONCE, @ref #ELA_EVENT_READABLE,
+          @ref #ELA_EVENT_WRITABLE and @ref #ELA_EVENT_EDGE.
+   @returns Whether things went all right, ENOTSUP if the backend
+   cannot do edge triggering
 
    The action stays watched on the FD until unregistration. No
    implicit unregistration occurs.
+
+   An fd watched by several sources of a loop is only edge-triggered
+   if they all ask for it.
  */
 ELA_EXPORT
 ela_error_t ela_set_fd(
@@ -134,6 +288,83 @@ ela_error_t ela_set_fd(
     int fd,
     uint32_t flags);
 
+/**
+   @this watches a signal instead of a file descriptor. The handler
+   gets called with @ref #ELA_EVENT_SIGNAL and a -1 fd. Deliveries
+   still pending together coalesce into one call, as pending signals
+   do.
+
+   @mgroup {Event source setup}
+
+   @param ctx The event loop context
+   @param src Event source handle
+   @param signo Signal to watch, 0 to stop watching
+   @returns Whether things went all right, EINVAL for a signal that
+   cannot be caught, ENOTSUP if the backend cannot watch signals
+
+   Any fd watched by the source is dropped, and @ref ela_set_fd drops
+   the signal. Timeouts are unaffected. Several sources may watch the
+   same signal, they all get called.
+
+   With the Linux native backends, all signals of a loop share a single
+   @tt signalfd, and are blocked in the loop thread while watched. They
+   must be blocked in other threads as well, or get delivered there.
+   With libevent, only one base of the process may watch signals.
+ */
+ELA_EXPORT
+ela_error_t ela_set_signal(
+    struct ela_el *ctx,
+    struct ela_event_source *src,
+    int signo);
+
+/**
+   @this watches a child process instead of a file descriptor. The
+   handler gets called once with @ref #ELA_EVENT_CHILD and a -1 fd
+   after the child exited and got reaped, and the source is removed
+   from the loop. Its wait status is then available from @ref
+   ela_child_status.
+
+   @mgroup {Event source setup}
+
+   @param ctx The event loop context
+   @param src Event source handle
+   @param pid Child process to watch, 0 to stop watching
+   @returns Whether things went all right, ESRCH if there is no such
+   process, ENOTSUP if the backend cannot watch children
+
+   Children are watched through a pidfd where the system has them,
+   so that each exit only wakes its own source up. Otherwise, every
+   @tt SIGCHLD gets all watched children looked at, as with @ref
+   ela_set_signal. Any fd or signal watched by the source is dropped.
+
+   The child must not be reaped by anyone else, @tt waitpid with a
+   pid of -1 included.
+ */
+ELA_EXPORT
+ela_error_t ela_set_child(
+    struct ela_el *ctx,
+    struct ela_event_source *src,
+    pid_t pid);
+
+/**
+   @this retrieves the wait status of a child that exited, see @ref
+   ela_set_child.
+
+   @mgroup {Event source setup}
+
+   @param ctx The event loop context
+   @param src Event source watching a child
+   @param status Where to store the wait status, for use with @tt
+          WIFEXITED and friends
+   @returns 0, EAGAIN if the child did not exit yet, ECHILD if it got
+   reaped elsewhere, EINVAL if the source watches no child
+ */
+ELA_EXPORT
+ela_error_t ela_child_status(
+    struct ela_el *ctx,
+    struct ela_event_source *src,
+    int *status);
+
 /**
    @this sets a timeout on which event is called if there is no event
    on the associated fd. If no fd is associated, only the timeout may
@@ -145,7 +376,9 @@ ela_error_t ela_set_fd(
    @param src Event source handle, for unregistration
    @param tv Timeout expiration value, relative
    @param flags Bitmask of events to watch for.
-          The only relevant flag is @ref #ELA_EVENT_ONCE.
+          The only relevant flags are @ref #ELA_EVENT_ONCE,
+          @ref #ELA_EVENT_COARSE, @ref #ELA_EVENT_PERIODIC and
+          @ref #ELA_EVENT_CATCHUP.
    @returns Whether things went all right
 
    The action is fired only once, and gets unregistered afterwards.
@@ -157,6 +390,258 @@ ela_error_t ela_set_timeout(
     const struct timeval *tv,
     uint32_t flags);
 
+/**
+   @this sets an absolute timeout for a source, as a @tt
+   CLOCK_MONOTONIC time (see @ref ela_now). This replaces any timeout
+   set with @ref ela_set_timeout or @ref ela_set_timeout_class, and
+   the other way around.
+
+   @mgroup {Event source setup}
+
+   @param ctx The event loop context
+   @param src Event source handle
+   @param deadline Monotonic expiration time, or NULL to unset
+   @param flags Bitmask of events to watch for.
+          The only relevant flags are @ref #ELA_EVENT_ONCE and
+          @ref #ELA_EVENT_COARSE.
+   @returns Whether things went all right
+
+   A deadline fires once. Without @ref #ELA_EVENT_ONCE, the source
+   then stays in the loop with no timeout until a new deadline is set
+   and the source is added again.
+ */
+ELA_EXPORT
+ela_error_t ela_set_deadline(
+    struct ela_el *ctx,
+    struct ela_event_source *src,
+    const struct timespec *deadline,
+    uint32_t flags);
+
+/**
+   @this returns how many periods of an @ref #ELA_EVENT_PERIODIC
+   timeout were skipped before the one being dispatched, because the
+   loop was late. Meant to be called from the source callback.
+
+   @mgroup {Event source setup}
+
+   @param ctx The event loop context
+   @param src Event source handle
+   @returns Missed period count, always 0 with @ref #ELA_EVENT_CATCHUP
+ */
+ELA_EXPORT
+uint64_t ela_timeout_overrun(
+    struct ela_el *ctx,
+    struct ela_event_source *src);
+
+/**
+   @this restarts the timeout of a source already in the loop, as if
+   it got removed and added again, but at the cost of a store: the
+   new deadline only gets taken into account when the old one
+   expires.
+
+   @mgroup {Event source setup}
+
+   @param ctx The event loop context
+   @param src Event source handle, with a timeout set
+   @returns 0, ENOENT if the source is not in the loop, or EINVAL
+   for a source with an absolute deadline or a periodic timeout
+
+   If the source timeout is not currently armed, or if the backend has
+   no lazy timeouts, this is the same as @ref ela_add.
+ */
+ELA_EXPORT
+ela_error_t ela_touch_timeout(
+    struct ela_el *ctx,
+    struct ela_event_source *src);
+
+/**
+   @this creates a timeout class. Sources using a class all get the
+   same timeout duration, which lets the loop keep them in expiry
+   order for free: arming, cancelling and expiring them is O(1).
+
+   @mgroup {Event source setup}
+
+   @param ctx The event loop context
+   @param duration Timeout duration for all sources of the class
+   @param cls Returned class handle, valid until @ref ela_close
+   @returns Whether things went all right
+ */
+ELA_EXPORT
+ela_error_t ela_timeout_class_create(
+    struct ela_el *ctx,
+    const struct timeval *duration,
+    struct ela_timeout_class **cls);
+
+/**
+   @this sets a source timeout from a timeout class. This replaces
+   any timeout set with @ref ela_set_timeout, and the other way
+   around.
+
+   @mgroup {Event source setup}
+
+   @param ctx The event loop context
+   @param src Event source handle
+   @param cls Timeout class, or NULL to unset the timeout
+   @param flags Bitmask of events to watch for.
+          The only relevant flag is @ref #ELA_EVENT_ONCE.
+   @returns Whether things went all right
+
+   Timeout slack and @ref #ELA_EVENT_COARSE do not apply to class
+   timeouts.
+ */
+ELA_EXPORT
+ela_error_t ela_set_timeout_class(
+    struct ela_el *ctx,
+    struct ela_event_source *src,
+    struct ela_timeout_class *cls,
+    uint32_t flags);
+
+/**
+   @this sets how late a timeout may fire, so that timeouts due at
+   close instants get expired in a single loop wakeup.
+
+   @mgroup {Event source setup}
+
+   @param ctx The event loop context
+   @param src Source to set slack for, or NULL to set the default for
+          all sources that have none of their own
+   @param slack Maximum delay, NULL to return to the default
+   @returns 0 or ENOTSUP if the backend always fires exactly
+
+   Slack takes effect next time the timeout is armed.
+ */
+ELA_EXPORT
+ela_error_t ela_set_timeout_slack(
+    struct ela_el *ctx,
+    struct ela_event_source *src,
+    const struct timeval *slack);
+
+/**
+   @this sets the granularity of the loop timer wheel, used for
+   timeouts set with @ref #ELA_EVENT_COARSE. Default is 1ms.
+
+   @mgroup {Event source setup}
+
+   @param ctx The event loop context
+   @param tick Wheel tick duration
+   @returns 0, EBUSY if coarse timeouts are currently armed, or ENOTSUP
+   if the backend has no timer wheel (coarse timeouts are then exact).
+ */
+ELA_EXPORT
+ela_error_t ela_set_timer_tick(
+    struct ela_el *ctx,
+    const struct timeval *tick);
+
+/**
+   @mgroup {Event source setup}
+   Also ask the kernel to busy poll on sockets watched by the loop,
+   see @ref ela_set_busy_poll
+ */
+#define ELA_BUSY_POLL_SOCKETS 1
+
+/**
+   @this makes the loop poll for events without blocking for a while
+   before it goes to sleep, trading CPU time for wakeup latency.
+
+   @mgroup {Event source setup}
+
+   @param ctx The event loop context
+   @param spin Longest time to spin before blocking, NULL or zero to
+          always block right away
+   @param flags @ref #ELA_BUSY_POLL_SOCKETS or 0
+   @returns 0, or ENOTSUP if the backend cannot busy poll
+
+   Spin time adapts: it gets back to its maximum when spinning finds
+   events, is halved when it runs out with nothing found, and grows
+   again when events wake the loop up from sleep. Spinning never goes
+   past the next timeout. See @ref ela_get_stats for how much time
+   spinning took, and how often it paid off.
+
+   With @ref #ELA_BUSY_POLL_SOCKETS, @tt SO_BUSY_POLL (and @tt
+   SO_PREFER_BUSY_POLL where available) get set on sockets as they are
+   watched, failures are ignored.
+ */
+ELA_EXPORT
+ela_error_t ela_set_busy_poll(
+    struct ela_el *ctx,
+    const struct timeval *spin,
+    uint32_t flags);
+
+/**
+   @this creates a loop-owned pool of receive buffers that
+   completion sources may refer to by @tt group identifier.
+
+   @mgroup {Completion sources}
+
+   @param ctx The event loop context
+   @param group Buffer group identifier
+   @param count Buffer count, a power of 2
+   @param size Size of each buffer
+   @returns 0, EEXIST if group is already defined, or an error
+
+   Buffers are released on @ref ela_close.
+ */
+ELA_EXPORT
+ela_error_t ela_buffer_group_create(
+    struct ela_el *ctx,
+    uint16_t group,
+    unsigned int count,
+    size_t size);
+
+/**
+   @this sets a source up for receiving data from a socket. The
+   completion callback gets called with received data for each
+   incoming chunk, without any extra readiness notification.
+
+   @mgroup {Completion sources}
+
+   @param ctx The event loop context
+   @param src Event source handle
+   @param fd Socket to receive from
+   @param group Buffer group to receive into, see @ref
+          ela_buffer_group_create
+   @param func Completion callback
+   @returns Whether things went all right
+
+   The source is watched once added with @ref ela_add. It is
+   automatically removed from the loop after reporting end of stream
+   or an error.
+
+   Backends with kernel-side buffer selection receive directly into
+   the group buffers. Readiness backends emulate it by reading in
+   a group buffer when the socket is readable.
+ */
+ELA_EXPORT
+ela_error_t ela_recv_multishot(
+    struct ela_el *ctx,
+    struct ela_event_source *src,
+    int fd,
+    uint16_t group,
+    ela_completion_func *func);
+
+/**
+   @this sets a source up for accepting connections on a listening
+   socket. The completion callback gets called with each accepted
+   file descriptor, which is non-blocking and close-on-exec.
+
+   @mgroup {Completion sources}
+
+   @param ctx The event loop context
+   @param src Event source handle
+   @param fd Listening socket, switched to non-blocking mode
+   @param func Completion callback
+   @returns Whether things went all right
+
+   The source is watched once added with @ref ela_add. It is
+   automatically removed from the loop after reporting an error.
+ */
+ELA_EXPORT
+ela_error_t ela_accept_multishot(
+    struct ela_el *ctx,
+    struct ela_event_source *src,
+    int fd,
+    ela_completion_func *func);
+
 /**
    @this registers a watch and/or timeout in the event loop.
 
@@ -165,6 +650,10 @@ ela_error_t ela_set_timeout(
    @param ctx The event loop considered
    @param source Source to unregister
    @returns 0 or ENOENT
+
+   Backends may batch interest changes on an fd they already watch,
+   and only apply them right before the loop sleeps again, merged:
+   interest turned on then off within an iteration costs nothing.
  */
 ELA_EXPORT
 ela_error_t ela_add(struct ela_el *ctx,
@@ -183,6 +672,66 @@ ELA_EXPORT
 ela_error_t ela_remove(struct ela_el *ctx,
                        struct ela_event_source *source);
 
+/**
+   @this registers many sources at once, as with @ref ela_add. Meant
+   for bulk setup, it takes the loop lock once, see @ref
+   ela_run_shared.
+
+   @mgroup {Event source handling}
+
+   @param ctx The event loop considered
+   @param srcs Sources to register
+   @param count Source count
+   @returns 0, or the error of the first source that could not be
+   added. Other sources are added all the same.
+ */
+ELA_EXPORT
+ela_error_t ela_add_many(struct ela_el *ctx,
+                         struct ela_event_source *const *srcs,
+                         size_t count);
+
+/**
+   @this unregisters many sources at once, as with @ref ela_remove.
+
+   @mgroup {Event source handling}
+
+   @param ctx The event loop considered
+   @param srcs Sources to unregister
+   @param count Source count
+   @returns 0, or the error of the first source that could not be
+   removed
+ */
+ELA_EXPORT
+ela_error_t ela_remove_many(struct ela_el *ctx,
+                            struct ela_event_source *const *srcs,
+                            size_t count);
+
+/**
+   @this makes a source ready as if the given events happened, without
+   asking the system. Its handler gets called with that mask before
+   the loop sleeps again, after the sources already ready.
+
+   @mgroup {Event source handling}
+
+   @param ctx The event loop considered
+   @param source Source in the loop
+   @param mask @ref #ELA_EVENT_READABLE, @ref #ELA_EVENT_WRITABLE
+          and/or @ref #ELA_EVENT_TIMEOUT
+   @returns 0, ENOENT if the source is not in the loop, EINVAL for an
+   empty mask or a completion source, or ENOTSUP
+
+   Loop bookkeeping is the same as for real events: a source with
+   @ref #ELA_EVENT_ONCE gets removed, and a running timeout restarts.
+   Activating a source again before it runs merges masks. A handler
+   activating its own source is called again on the next iteration,
+   once the loop has looked for other events, so that it can process
+   input in bounded chunks.
+ */
+ELA_EXPORT
+ela_error_t ela_activate(struct ela_el *ctx,
+                         struct ela_event_source *source,
+                         uint32_t mask);
+
 /**
    @this runs the event loop.
 
@@ -200,6 +749,72 @@ ela_error_t ela_remove(struct ela_el *ctx,
 ELA_EXPORT
 void ela_run(struct ela_el *ctx);
 
+/**
+   @this runs a single iteration of the event loop: it waits for events
+   for max_wait at most, then calls the handlers of sources that got
+   ready. This lets an application drive the loop from its own main
+   loop, a simulation tick or a polling thread.
+
+   @mgroup {Event loop handling}
+
+   @param ctx The event loop to run
+   @param max_wait Longest wait, zero for none at all, NULL for no
+          limit
+   @returns the number of source handlers called, -ENOTSUP if the
+   backend cannot do single iterations, or -EBUSY while the loop runs
+   shared
+
+   This returns right away when the loop has no sources. A call to
+   @ref ela_exit only ends the iteration it comes in.
+ */
+ELA_EXPORT
+int ela_run_once(struct ela_el *ctx, const struct timeval *max_wait);
+
+/**
+   @this runs the event loop as @ref ela_run does, but until a
+   deadline at most.
+
+   @mgroup {Event loop handling}
+
+   @param ctx The event loop to run
+   @param deadline Absolute time on the @ref ela_now clock, NULL for
+          none
+   @returns the number of source handlers called, or as @ref
+   ela_run_once
+ */
+ELA_EXPORT
+int ela_run_until(struct ela_el *ctx, const struct timespec *deadline);
+
+/**
+   @this runs the event loop from several threads at once: the calling
+   thread and @tt {nthreads - 1} others, which are started and waited
+   for here. It returns under the same conditions as @ref ela_run.
+
+   @mgroup {Event loop handling}
+
+   @param ctx The event loop context
+   @param nthreads Thread count
+   @returns 0, or ENOTSUP if the backend cannot run shared
+
+   A single thread waits for events at a time, and hands ready sources
+   to others. A source is dispatched by one thread at a time: while
+   its handler runs, its fd is not watched and its timeout is held
+   back, as with @tt EPOLLONESHOT. It is watched again when the handler
+   returns.
+
+   While the loop runs shared, any call on it may be made from handlers
+   and from functions posted with @ref ela_post, whatever their thread.
+   Calls are serialized by a loop lock, handlers run without it.
+   Completion source callbacks run with the lock held.
+
+   Freeing a source with @ref ela_source_free or @ref
+   ela_source_cleanup from another thread than the one running its
+   handler waits for the handler to return. A handler may free its own
+   source.
+ */
+ELA_EXPORT
+ela_error_t ela_run_shared(struct ela_el *ctx, unsigned int nthreads);
+
 /**
    @this exits the event loop.
 
@@ -212,11 +827,178 @@ void ela_run(struct ela_el *ctx);
    mainloop exit even if you called @tt {gtk_main()} rather than @tt
    {ela_run()}.
 
+   On backends supporting @ref ela_post, this may be called from any
+   thread, and wakes the loop up if needed.
+
    @param ctx The event loop to exit
  */
 ELA_EXPORT
 void ela_exit(struct ela_el *ctx);
 
+/**
+   @this is a function called on the loop thread, see @ref ela_post.
+
+   @param ctx The event loop context
+   @param data Private data passed to @ref ela_post
+ */
+typedef void ela_post_func(struct ela_el *ctx, void *data);
+
+/**
+   @this queues a call to a function on the event loop thread. This
+   is the only call, with @ref ela_exit, that is safe from any thread.
+
+   @mgroup {Event loop handling}
+
+   @param ctx The event loop context
+   @param func Function to call
+   @param data Private data for func
+   @returns 0, ENOMEM, or ENOTSUP if the backend does not support it
+
+   Posted functions are called in order, in a batch, next time the
+   loop iterates in @ref ela_run. The loop only sleeps while it has
+   sources, posted functions do not keep it running. Calls still
+   pending on @ref ela_close are dropped.
+ */
+ELA_EXPORT
+ela_error_t ela_post(struct ela_el *ctx, ela_post_func *func, void *data);
+
+/**
+   @this calls a function on the next loop iteration, without having
+   to set a source up for it.
+
+   @mgroup {Event loop handling}
+
+   @param ctx The event loop context
+   @param func Function to call
+   @param data Private data for func
+   @returns 0, or ENOMEM
+
+   Calls are made with loop-owned sources, recycled as soon as their
+   function is called, so that deferring allocates nothing once the
+   loop has seen as many pending calls. Where the backend supports
+   @ref ela_activate, no timer gets involved. Pending calls keep the
+   loop running, and are dropped on @ref ela_close. Unlike @ref
+   ela_post, this may only be called from the loop thread.
+ */
+ELA_EXPORT
+ela_error_t ela_defer(struct ela_el *ctx, ela_post_func *func, void *data);
+
+/**
+   @this calls a function once after a delay, as @ref ela_defer does.
+
+   @mgroup {Event loop handling}
+
+   @param ctx The event loop context
+   @param tv Delay, relative
+   @param func Function to call
+   @param data Private data for func
+   @returns 0, EINVAL without a delay, or ENOMEM
+
+   Calls cannot be cancelled, func should check whether it still has
+   something to do.
+ */
+ELA_EXPORT
+ela_error_t ela_call_later(struct ela_el *ctx, const struct timeval *tv,
+                           ela_post_func *func, void *data);
+
+/**
+   @mgroup {Event loop handling}
+   Call hook before the loop waits for events
+ */
+#define ELA_HOOK_BEFORE_POLL 1
+/**
+   @mgroup {Event loop handling}
+   Call hook after the loop waited for events
+ */
+#define ELA_HOOK_AFTER_POLL 2
+
+/**
+   @this is a loop hook, see @ref ela_hook_add.
+
+   @param ctx The event loop context
+   @param when @ref #ELA_HOOK_BEFORE_POLL or @ref #ELA_HOOK_AFTER_POLL
+   @param data Private data passed to @ref ela_hook_add
+ */
+typedef void ela_hook_func(struct ela_el *ctx, uint32_t when, void *data);
+
+/**
+   @this registers a function called on every loop iteration, around
+   the wait for events. A hook called before the wait may flush output
+   gathered by handlers during the iteration, with one system call per
+   socket rather than one per message.
+
+   @mgroup {Event loop handling}
+
+   @param ctx The event loop context
+   @param when Bitmask of @ref #ELA_HOOK_BEFORE_POLL and @ref
+          #ELA_HOOK_AFTER_POLL
+   @param func Function to call
+   @param data Private data for func
+   @returns 0, EINVAL for an empty mask, or ENOMEM
+
+   Hooks run on the loop thread, in registration order, and may use
+   the loop as handlers do. Sources they make ready are dispatched
+   without waiting. The wait is not skipped when there is nothing to
+   wait for, hooks then run with a wait that does not block.
+
+   On libevent bases without prepare and check watchers (before
+   2.2), hooks called after the wait run after the handlers of the
+   iteration rather than before them.
+ */
+ELA_EXPORT
+ela_error_t ela_hook_add(struct ela_el *ctx, uint32_t when,
+                         ela_hook_func *func, void *data);
+
+/**
+   @this unregisters a hook, see @ref ela_hook_add.
+
+   @mgroup {Event loop handling}
+
+   @param ctx The event loop context
+   @param when Events to stop calling the hook for
+   @param func Function registered
+   @param data Private data registered
+   @returns 0, or ENOENT if no such hook is registered
+
+   A hook may remove itself or others while it runs.
+ */
+ELA_EXPORT
+ela_error_t ela_hook_remove(struct ela_el *ctx, uint32_t when,
+                            ela_hook_func *func, void *data);
+
+/**
+   @this moves an event source from a loop to another loop of the same
+   backend, for instance to take load off a busy thread. It is removed
+   from the first loop right away, and added to the other one from its
+   own thread, through @ref ela_post.
+
+   @mgroup {Event loop handling}
+
+   @param src Event source, added or not
+   @param from Loop the source belongs to, calling thread must be
+          running it or own it
+   @param to Destination loop
+   @returns 0, EINVAL if the source or loops cannot be used, EBUSY if
+   from runs with @ref ela_run_shared, or ENOTSUP if the backend does
+   not support it
+
+   The source keeps its handler, private data, fd and event mask. A
+   running timeout keeps its expiry time, deadlines and periodic ticks
+   stay on schedule. Sources with a timeout class or a completion
+   handler are bound to their loop and cannot move, neither can
+   sources of loops with allocator hooks, see @ref ela_set_allocator.
+
+   From now on, the source belongs to to: it must only be touched from
+   its thread, and released with it. Storage from @ref
+   ela_source_alloc follows the source. Nothing happens to the source
+   in between, fd readiness is reported once it is added again. If
+   to gets closed before it runs, the source is lost.
+ */
+ELA_EXPORT
+ela_error_t ela_source_migrate(struct ela_event_source *src,
+                               struct ela_el *from,
+                               struct ela_el *to);
+
 /**
    @this frees the event loop.
 
@@ -236,7 +1018,9 @@ void ela_close(struct ela_el *ctx);
 
    @mgroup {Event loop handling}
 
-   This makes no preference in the backend.
+   This makes no preference in the backend. If the preferred backend
+   is unknown or fails to initialize, the first other backend that
+   initializes successfully is used.
 
    @param preferred Preferred backend name
    @returns a valid ela context, or NULL.
@@ -244,4 +1028,54 @@ void ela_close(struct ela_el *ctx);
 ELA_EXPORT
 struct ela_el *ela_create(const char *preferred);
 
+/**
+   @this returns the @tt CLOCK_MONOTONIC time the event loop last
+   woke up at. Handlers running in the same loop iteration all get
+   the same value without reading the clock again.
+
+   @mgroup {Event loop handling}
+
+   @param ctx The event loop context
+   @returns Loop time, or the current time when called from outside
+   @ref ela_run
+ */
+ELA_EXPORT
+struct timespec ela_now(struct ela_el *ctx);
+
+/**
+   @this is a snapshot of event loop counters. All counters are
+   cumulative since loop creation; sample them twice to get rates.
+
+   @mgroup {Event loop handling}
+ */
+struct ela_stats
+{
+    /** Times the loop got back from blocking in the kernel */
+    uint64_t wakeups;
+    /** Timeouts expired */
+    uint64_t timeouts;
+    /** Non-blocking polls made while busy polling, see @ref
+        ela_set_busy_poll */
+    uint64_t busy_polls;
+    /** Busy poll spins that found events before running out */
+    uint64_t busy_hits;
+    /** Time spent spinning, in ns */
+    uint64_t busy_ns;
+};
+
+/**
+   @this retrieves event loop counters.
+
+   @mgroup {Event loop handling}
+
+   @param ctx The event loop context
+   @param stats Counters to fill
+   @returns 0 or ENOTSUP if the backend keeps no counters
+
+   Counters are only maintained while the loop runs through @ref
+   ela_run.
+ */
+ELA_EXPORT
+ela_error_t ela_get_stats(struct ela_el *ctx, struct ela_stats *stats);
+
 #endif
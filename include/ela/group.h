@@ -0,0 +1,154 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef ELA_GROUP_H
+#define ELA_GROUP_H
+
+/**
+   @file
+   @module {User API}
+   @short Loop groups, one event loop per core
+
+   A group runs one event loop per thread, each thread pinned to a
+   core. Loops share nothing: a source belongs to one loop and is only
+   ever touched from its thread. Work gets to a loop with @ref
+   ela_post, and connections with @ref ela_group_listen or @ref
+   ela_group_pick.
+ */
+
+#include <sys/socket.h>
+#include <ela/ela.h>
+
+/**
+   An opaque loop group
+ */
+struct ela_group;
+
+/**
+   @this is called on a group loop thread for each accepted
+   connection, see @ref ela_group_listen.
+
+   @param ctx Loop that accepted the connection
+   @param fd Accepted socket, non-blocking and close-on-exec, or a
+          negative @tt errno value
+   @param priv Private data passed to @ref ela_group_listen
+
+   After a transient error, such as running out of fds (@tt EMFILE,
+   @tt ENFILE) or memory, the loop accepts again a little later. Other
+   errors stop this loop accepting.
+ */
+typedef void ela_group_accept_func(struct ela_el *ctx, int fd, void *priv);
+
+/**
+   @this creates a group of event loops, and starts a thread running
+   each of them. Thread i is pinned to the i-th core the process may
+   run on, if supported.
+
+   @mgroup {Loop groups}
+
+   @param nthreads Loop count, 0 for one per available core
+   @param backend_name Backend for all loops, as for @ref ela_create
+   @returns a group, or NULL on failure
+
+   Loops are running when this returns, sources may only be set up
+   from their own thread, see @ref ela_post. Backends without @ref
+   ela_post support cannot be used.
+ */
+ELA_EXPORT
+struct ela_group *ela_group_create(unsigned int nthreads,
+                                   const char *backend_name);
+
+/**
+   @this stops all loop threads, waits for them, and closes the loops.
+
+   @mgroup {Loop groups}
+
+   @param group Group to destroy, must not be called from its threads
+ */
+ELA_EXPORT
+void ela_group_destroy(struct ela_group *group);
+
+/**
+   @this returns the loop count of a group.
+
+   @mgroup {Loop groups}
+ */
+ELA_EXPORT
+unsigned int ela_group_size(const struct ela_group *group);
+
+/**
+   @this returns a loop of the group.
+
+   @mgroup {Loop groups}
+
+   @param group Loop group
+   @param index Loop index, less than @ref ela_group_size
+ */
+ELA_EXPORT
+struct ela_el *ela_group_loop(const struct ela_group *group,
+                              unsigned int index);
+
+/**
+   @this listens on a stream socket address from all loops. Each loop
+   gets its own @tt SO_REUSEPORT socket, so that the kernel spreads
+   incoming connections across them. Where @tt SO_REUSEPORT is not
+   available, loops share a single listening socket.
+
+   @mgroup {Loop groups}
+
+   @param group Loop group
+   @param addr Address to listen on. With port 0, updated with the
+          port picked by the system.
+   @param addrlen Address length
+   @param func Called with each accepted connection
+   @param priv Private data for func
+   @returns Whether things went all right
+
+   Each accepted connection adds one to the loop load, see @ref
+   ela_group_pick. Listening goes on until the group is destroyed.
+ */
+ELA_EXPORT
+ela_error_t ela_group_listen(struct ela_group *group,
+                             struct sockaddr *addr,
+                             socklen_t addrlen,
+                             ela_group_accept_func *func,
+                             void *priv);
+
+/**
+   @this returns the least loaded loop of the group, and adds one to
+   its load. Meant for placing outbound connections.
+
+   @mgroup {Loop groups}
+
+   @param group Loop group
+   @returns a group loop
+
+   Load is only what @ref ela_group_pick and @ref ela_group_listen
+   placed on a loop, minus what got returned with @ref
+   ela_group_release. It is tracked with per-loop atomic counters,
+   without any lock.
+ */
+ELA_EXPORT
+struct ela_el *ela_group_pick(struct ela_group *group);
+
+/**
+   @this takes one off the load of a group loop, when a connection
+   placed there goes away.
+
+   @mgroup {Loop groups}
+
+   @param group Loop group
+   @param ctx Loop of the group
+ */
+ELA_EXPORT
+void ela_group_release(struct ela_group *group, struct ela_el *ctx);
+
+#endif
@@ -0,0 +1,100 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef ELA_SPLICE_H
+#define ELA_SPLICE_H
+
+/**
+   @file
+   @module {User API}
+   @short Kernel-side relays between file descriptors
+
+   A relay moves data from one fd to another without it ever reaching
+   userspace: with @tt sendfile when reading from a regular file, and
+   with @tt splice through a private pipe otherwise. It waits on
+   either side through event sources of a loop, as needed.
+
+   Relays are Linux only, @ref ela_splice_pipe returns ENOTSUP
+   elsewhere.
+ */
+
+#include <stdint.h>
+#include <ela/ela.h>
+
+/**
+   An opaque relay
+ */
+struct ela_splice;
+
+/**
+   @this is called once a relay is over. The relay is gone by then.
+
+   @param ctx Loop the relay ran in
+   @param moved Bytes written to the output fd
+   @param err 0 on end of input or once the byte limit is reached,
+          the error that stopped the relay otherwise
+   @param priv Private data from the relay options
+ */
+typedef void ela_splice_func(struct ela_el *ctx, uint64_t moved,
+                             ela_error_t err, void *priv);
+
+/**
+   Relay options, see @ref ela_splice_pipe
+ */
+struct ela_splice_opts
+{
+    /** Called once the relay is over */
+    ela_splice_func *func;
+    void *priv;
+    /** Bytes to move at most in one call, 0 for the default of 64k.
+        The private pipe gets grown to it, if allowed. */
+    size_t chunk;
+    /** Bytes to move before stopping, 0 to go on until end of
+        input */
+    uint64_t max;
+};
+
+/**
+   @this starts relaying data from an fd to another.
+
+   @mgroup {Kernel-side relays}
+
+   @param ctx The event loop context
+   @param in_fd Fd to read from. Sockets and pipes must be
+          non-blocking, regular files are read from their current
+          offset.
+   @param out_fd Fd to write to, non-blocking unless a regular file
+   @param opts Relay options
+   @param ret Returned relay, for @ref ela_splice_cancel, may be NULL
+   @returns Whether things went all right, ENOTSUP if not available
+
+   The relay starts on the next loop iteration, its completion
+   callback is never called from here. Both fds are left open.
+ */
+ELA_EXPORT
+ela_error_t ela_splice_pipe(struct ela_el *ctx, int in_fd, int out_fd,
+                            const struct ela_splice_opts *opts,
+                            struct ela_splice **ret);
+
+/**
+   @this stops a relay before it is over. Its completion callback does
+   not get called.
+
+   @mgroup {Kernel-side relays}
+
+   @param splice Relay to stop, not from its completion callback
+
+   Data already taken from the input fd but not written yet is lost.
+ */
+ELA_EXPORT
+void ela_splice_cancel(struct ela_splice *splice);
+
+#endif
@@ -0,0 +1,258 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef ELA_STREAM_H
+#define ELA_STREAM_H
+
+/**
+   @file
+   @module {User API}
+   @short Buffered streams over a file descriptor
+
+   A stream buffers input and output of a non-blocking fd, on top of
+   event sources of a loop. Each readiness event costs one @tt readv
+   into as many buffer segments as needed, and queued output goes out
+   in one @tt writev.
+
+   Buffers are chains of refcounted segments: data can be queued
+   from caller-owned memory without a copy, see @ref
+   ela_stream_write_ref, and moved from a stream input to another
+   stream output without a copy either, see @ref ela_stream_forward.
+
+   A stream is only ever used from its loop thread.
+ */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <ela/ela.h>
+
+/**
+   An opaque buffered stream
+ */
+struct ela_stream;
+
+/**
+   @mgroup {Buffered streams}
+   Input got buffered
+ */
+#define ELA_STREAM_READ 1
+/**
+   @mgroup {Buffered streams}
+   Queued output dropped to the low watermark, see @ref
+   ela_stream_set_watermarks
+ */
+#define ELA_STREAM_DRAINED 2
+/**
+   @mgroup {Buffered streams}
+   End of input, the stream stops reading
+ */
+#define ELA_STREAM_EOF 4
+/**
+   @mgroup {Buffered streams}
+   Read or write failed, the stream stops reading or drops its output
+ */
+#define ELA_STREAM_ERROR 8
+
+/**
+   @this is called on stream events.
+
+   @param stream Stream
+   @param events @ref #ELA_STREAM_READ, @ref #ELA_STREAM_DRAINED, @ref
+          #ELA_STREAM_EOF or @ref #ELA_STREAM_ERROR
+   @param err Error with @ref #ELA_STREAM_ERROR, 0 otherwise
+   @param priv Private data passed to @ref ela_stream_create
+
+   The stream may be destroyed from there.
+ */
+typedef void ela_stream_func(struct ela_stream *stream, uint32_t events,
+                             ela_error_t err, void *priv);
+
+/**
+   @this releases caller-owned memory given to @ref
+   ela_stream_write_ref, once the stream is done with it.
+ */
+typedef void ela_stream_release_func(const void *data, void *priv);
+
+/**
+   @this creates a stream over a file descriptor, and starts reading
+   from it.
+
+   @mgroup {Buffered streams}
+
+   @param ctx The event loop context
+   @param fd Non-blocking file descriptor, left open on destruction
+   @param func Called on stream events
+   @param priv Private data for func
+   @param ret Returned stream
+   @returns Whether things went all right
+ */
+ELA_EXPORT
+ela_error_t ela_stream_create(struct ela_el *ctx, int fd,
+                              ela_stream_func *func, void *priv,
+                              struct ela_stream **ret);
+
+/**
+   @this destroys a stream, dropping buffered input and queued
+   output.
+
+   @mgroup {Buffered streams}
+
+   @param stream Stream to destroy
+ */
+ELA_EXPORT
+void ela_stream_destroy(struct ela_stream *stream);
+
+/**
+   @this sets flow control thresholds of a stream. The stream stops
+   reading once @tt high bytes of input are buffered, and resumes once
+   buffered input dropped to @tt low. @ref #ELA_STREAM_DRAINED is
+   reported once queued output dropped to @tt low.
+
+   @mgroup {Buffered streams}
+
+   @param stream Stream
+   @param low Low watermark, in bytes
+   @param high High watermark, in bytes, 0 for none
+   @returns Whether things went all right, EINVAL if high is set and
+   not above low
+
+   Streams have no high watermark by default, and a low watermark of
+   0.
+ */
+ELA_EXPORT
+ela_error_t ela_stream_set_watermarks(struct ela_stream *stream,
+                                      size_t low, size_t high);
+
+/**
+   @this returns the buffered input length.
+
+   @mgroup {Buffered streams}
+ */
+ELA_EXPORT
+size_t ela_stream_readable(const struct ela_stream *stream);
+
+/**
+   @this gives the buffered input in place.
+
+   @mgroup {Buffered streams}
+
+   @param stream Stream
+   @param iov Filled with buffered input segments, in order
+   @param iovcnt Size of iov
+   @returns Segments filled
+
+   Segments stay valid until consumed, see @ref ela_stream_consume.
+ */
+ELA_EXPORT
+int ela_stream_peek(const struct ela_stream *stream,
+                    struct iovec *iov, int iovcnt);
+
+/**
+   @this drops buffered input.
+
+   @mgroup {Buffered streams}
+
+   @param stream Stream
+   @param len Bytes to drop, at most @ref ela_stream_readable
+ */
+ELA_EXPORT
+void ela_stream_consume(struct ela_stream *stream, size_t len);
+
+/**
+   @this copies buffered input out, and drops it.
+
+   @mgroup {Buffered streams}
+
+   @param stream Stream
+   @param buf Where to copy
+   @param len Size of buf
+   @returns Bytes copied
+ */
+ELA_EXPORT
+size_t ela_stream_read(struct ela_stream *stream, void *buf, size_t len);
+
+/**
+   @this queues a copy of data for output. Output is sent when the fd
+   gets writable, all queued data in one call, see @ref
+   ela_stream_flush to send it right away.
+
+   @mgroup {Buffered streams}
+
+   @param stream Stream
+   @param data Data to send
+   @param len Data length
+   @returns Whether things went all right
+ */
+ELA_EXPORT
+ela_error_t ela_stream_write(struct ela_stream *stream,
+                             const void *data, size_t len);
+
+/**
+   @this queues caller-owned memory for output, without copying it.
+
+   @mgroup {Buffered streams}
+
+   @param stream Stream
+   @param data Data to send, must stay untouched until released
+   @param len Data length
+   @param release Called once data is sent or dropped, may be NULL
+   @param priv Private data for release
+   @returns Whether things went all right, release is called on
+   failure too
+ */
+ELA_EXPORT
+ela_error_t ela_stream_write_ref(struct ela_stream *stream,
+                                 const void *data, size_t len,
+                                 ela_stream_release_func *release,
+                                 void *priv);
+
+/**
+   @this moves buffered input of a stream to the output queue of
+   another one, sharing buffer segments rather than copying data.
+
+   @mgroup {Buffered streams}
+
+   @param from Stream to take input from
+   @param to Stream to queue output on
+   @param len Bytes to move at most
+   @returns Bytes moved
+
+   Only what fits under the high watermark of @tt to is moved. The
+   rest stays buffered in @tt from, which stops reading once its own
+   high watermark is reached: calling this again on @ref
+   #ELA_STREAM_DRAINED of @tt to relays data with flow control.
+ */
+ELA_EXPORT
+size_t ela_stream_forward(struct ela_stream *from, struct ela_stream *to,
+                          size_t len);
+
+/**
+   @this returns the queued output length.
+
+   @mgroup {Buffered streams}
+ */
+ELA_EXPORT
+size_t ela_stream_queued(const struct ela_stream *stream);
+
+/**
+   @this sends queued output right away, as far as the fd accepts it.
+   What is left gets sent once the fd is writable.
+
+   @mgroup {Buffered streams}
+
+   @param stream Stream
+   @returns Whether things went all right, the write error otherwise,
+   after which queued output is dropped
+ */
+ELA_EXPORT
+ela_error_t ela_stream_flush(struct ela_stream *stream);
+
+#endif
@@ -13,7 +13,14 @@
 #include <ela/ela.h>
 #include <ela/backend.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+
+#include "ela_alloc.h"
+#include "ela_defer.h"
+#include "ela_shared.h"
+#include "ela_time.h"
 
 #if 0
 # define DBG(a...) printf(a)
@@ -27,20 +34,288 @@ ela_error_t ela_set_fd(
     int fd,
     uint32_t flags)
 {
-    ela_error_t err = ctx->backend->set_fd(ctx, src, fd, flags);
+    ela_error_t err;
+
+    ela_shared_lock(ctx);
+    err = ctx->backend->set_fd(ctx, src, fd, flags);
+    ela_shared_unlock(ctx);
+
     if ( err ) {
         DBG("%s(%p, %p) : %d\n", __FUNCTION__, ctx, src, err);
     }
     return err;
 }
 
+ela_error_t ela_set_signal(
+    struct ela_el *ctx,
+    struct ela_event_source *src,
+    int signo)
+{
+    ela_error_t err;
+
+    if ( !ctx->backend->set_signal )
+        return ENOTSUP;
+
+    ela_shared_lock(ctx);
+    err = ctx->backend->set_signal(ctx, src, signo);
+    ela_shared_unlock(ctx);
+
+    if ( err ) {
+        DBG("%s(%p, %p, %d) : %d\n", __FUNCTION__, ctx, src, signo, err);
+    }
+    return err;
+}
+
+ela_error_t ela_set_child(
+    struct ela_el *ctx,
+    struct ela_event_source *src,
+    pid_t pid)
+{
+    ela_error_t err;
+
+    if ( !ctx->backend->set_child )
+        return ENOTSUP;
+
+    ela_shared_lock(ctx);
+    err = ctx->backend->set_child(ctx, src, pid);
+    ela_shared_unlock(ctx);
+
+    if ( err ) {
+        DBG("%s(%p, %p, %d) : %d\n", __FUNCTION__, ctx, src, (int)pid, err);
+    }
+    return err;
+}
+
+ela_error_t ela_child_status(
+    struct ela_el *ctx,
+    struct ela_event_source *src,
+    int *status)
+{
+    ela_error_t err;
+
+    if ( !ctx->backend->child_status )
+        return ENOTSUP;
+
+    ela_shared_lock(ctx);
+    err = ctx->backend->child_status(ctx, src, status);
+    ela_shared_unlock(ctx);
+
+    return err;
+}
+
 ela_error_t ela_set_timeout(
     struct ela_el *ctx,
     struct ela_event_source *src,
     const struct timeval *tv,
     uint32_t flags)
 {
-    ela_error_t err = ctx->backend->set_timeout(ctx, src, tv, flags);
+    if ( tv && (flags & ELA_EVENT_PERIODIC) && !tv->tv_sec && !tv->tv_usec )
+        return EINVAL;
+
+    ela_error_t err;
+
+    ela_shared_lock(ctx);
+    err = ctx->backend->set_timeout(ctx, src, tv, flags);
+    ela_shared_unlock(ctx);
+
+    if ( err ) {
+        DBG("%s(%p, %p) : %d\n", __FUNCTION__, ctx, src, err);
+    }
+    return err;
+}
+
+ela_error_t ela_set_deadline(
+    struct ela_el *ctx,
+    struct ela_event_source *src,
+    const struct timespec *deadline,
+    uint32_t flags)
+{
+    if ( !ctx->backend->set_deadline )
+        return ENOTSUP;
+
+    ela_shared_lock(ctx);
+    ela_error_t err = ctx->backend->set_deadline(ctx, src, deadline, flags);
+    ela_shared_unlock(ctx);
+
+    return err;
+}
+
+struct timespec ela_now(struct ela_el *ctx)
+{
+    struct timespec ts;
+
+    if ( ctx->backend->now ) {
+        ela_shared_lock(ctx);
+        ts = ctx->backend->now(ctx);
+        ela_shared_unlock(ctx);
+        return ts;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts;
+}
+
+uint64_t ela_timeout_overrun(
+    struct ela_el *ctx,
+    struct ela_event_source *src)
+{
+    if ( !ctx->backend->timeout_overrun )
+        return 0;
+
+    ela_shared_lock(ctx);
+    uint64_t ret = ctx->backend->timeout_overrun(ctx, src);
+    ela_shared_unlock(ctx);
+
+    return ret;
+}
+
+ela_error_t ela_touch_timeout(
+    struct ela_el *ctx,
+    struct ela_event_source *src)
+{
+    if ( !ctx->backend->touch_timeout )
+        return ela_add(ctx, src);
+
+    ela_shared_lock(ctx);
+    ela_error_t err = ctx->backend->touch_timeout(ctx, src);
+    ela_shared_unlock(ctx);
+
+    return err;
+}
+
+ela_error_t ela_timeout_class_create(
+    struct ela_el *ctx,
+    const struct timeval *duration,
+    struct ela_timeout_class **cls)
+{
+    if ( !ctx->backend->timeout_class_create )
+        return ENOTSUP;
+
+    ela_shared_lock(ctx);
+    ela_error_t err = ctx->backend->timeout_class_create(ctx, duration, cls);
+    ela_shared_unlock(ctx);
+
+    return err;
+}
+
+ela_error_t ela_set_timeout_class(
+    struct ela_el *ctx,
+    struct ela_event_source *src,
+    struct ela_timeout_class *cls,
+    uint32_t flags)
+{
+    if ( !ctx->backend->set_timeout_class )
+        return ENOTSUP;
+
+    ela_shared_lock(ctx);
+    ela_error_t err = ctx->backend->set_timeout_class(ctx, src, cls, flags);
+    ela_shared_unlock(ctx);
+
+    return err;
+}
+
+ela_error_t ela_set_timeout_slack(
+    struct ela_el *ctx,
+    struct ela_event_source *src,
+    const struct timeval *slack)
+{
+    if ( !ctx->backend->set_timeout_slack )
+        return ENOTSUP;
+
+    ela_shared_lock(ctx);
+    ela_error_t err = ctx->backend->set_timeout_slack(ctx, src, slack);
+    ela_shared_unlock(ctx);
+
+    return err;
+}
+
+ela_error_t ela_get_stats(struct ela_el *ctx, struct ela_stats *stats)
+{
+    if ( !ctx->backend->get_stats )
+        return ENOTSUP;
+
+    ela_shared_lock(ctx);
+    ela_error_t err = ctx->backend->get_stats(ctx, stats);
+    ela_shared_unlock(ctx);
+
+    return err;
+}
+
+ela_error_t ela_set_timer_tick(
+    struct ela_el *ctx,
+    const struct timeval *tick)
+{
+    if ( !ctx->backend->set_timer_tick )
+        return ENOTSUP;
+
+    ela_shared_lock(ctx);
+    ela_error_t err = ctx->backend->set_timer_tick(ctx, tick);
+    ela_shared_unlock(ctx);
+
+    return err;
+}
+
+ela_error_t ela_buffer_group_create(
+    struct ela_el *ctx,
+    uint16_t group,
+    unsigned int count,
+    size_t size)
+{
+    if ( !ctx->backend->buffer_group_create )
+        return ENOTSUP;
+
+    if ( count == 0 || (count & (count - 1)) || size == 0 )
+        return EINVAL;
+
+    ela_error_t err;
+
+    ela_shared_lock(ctx);
+    err = ctx->backend->buffer_group_create(ctx, group, count, size);
+    ela_shared_unlock(ctx);
+
+    if ( err ) {
+        DBG("%s(%p, %d) : %d\n", __FUNCTION__, ctx, group, err);
+    }
+    return err;
+}
+
+ela_error_t ela_recv_multishot(
+    struct ela_el *ctx,
+    struct ela_event_source *src,
+    int fd,
+    uint16_t group,
+    ela_completion_func *func)
+{
+    if ( !ctx->backend->recv_multishot )
+        return ENOTSUP;
+
+    ela_error_t err;
+
+    ela_shared_lock(ctx);
+    err = ctx->backend->recv_multishot(ctx, src, fd, group, func);
+    ela_shared_unlock(ctx);
+
+    if ( err ) {
+        DBG("%s(%p, %p) : %d\n", __FUNCTION__, ctx, src, err);
+    }
+    return err;
+}
+
+ela_error_t ela_accept_multishot(
+    struct ela_el *ctx,
+    struct ela_event_source *src,
+    int fd,
+    ela_completion_func *func)
+{
+    if ( !ctx->backend->accept_multishot )
+        return ENOTSUP;
+
+    ela_error_t err;
+
+    ela_shared_lock(ctx);
+    err = ctx->backend->accept_multishot(ctx, src, fd, func);
+    ela_shared_unlock(ctx);
+
     if ( err ) {
         DBG("%s(%p, %p) : %d\n", __FUNCTION__, ctx, src, err);
     }
@@ -50,7 +325,12 @@ ela_error_t ela_set_timeout(
 ela_error_t ela_add(struct ela_el *ctx,
                     struct ela_event_source *src)
 {
-    ela_error_t err = ctx->backend->add(ctx, src);
+    ela_error_t err;
+
+    ela_shared_lock(ctx);
+    err = ctx->backend->add(ctx, src);
+    ela_shared_unlock(ctx);
+
     if ( err ) {
         DBG("%s(%p, %p) : %d\n", __FUNCTION__, ctx, src, err);
     }
@@ -60,7 +340,77 @@ ela_error_t ela_add(struct ela_el *ctx,
 ela_error_t ela_remove(struct ela_el *ctx,
                        struct ela_event_source *src)
 {
-    ela_error_t err = ctx->backend->remove(ctx, src);
+    ela_error_t err;
+
+    ela_shared_lock(ctx);
+    err = ctx->backend->remove(ctx, src);
+    ela_shared_unlock(ctx);
+
+    if ( err ) {
+        DBG("%s(%p, %p) : %d\n", __FUNCTION__, ctx, src, err);
+    }
+    return err;
+}
+
+ela_error_t ela_add_many(struct ela_el *ctx,
+                         struct ela_event_source *const *srcs,
+                         size_t count)
+{
+    ela_error_t err, ret = 0;
+    size_t i;
+
+    ela_shared_lock(ctx);
+    for ( i = 0; i < count; ++i ) {
+        err = ctx->backend->add(ctx, srcs[i]);
+        if ( err && !ret )
+            ret = err;
+    }
+    ela_shared_unlock(ctx);
+
+    if ( ret ) {
+        DBG("%s(%p, %zu) : %d\n", __FUNCTION__, ctx, count, ret);
+    }
+    return ret;
+}
+
+ela_error_t ela_remove_many(struct ela_el *ctx,
+                            struct ela_event_source *const *srcs,
+                            size_t count)
+{
+    ela_error_t err, ret = 0;
+    size_t i;
+
+    ela_shared_lock(ctx);
+    for ( i = 0; i < count; ++i ) {
+        err = ctx->backend->remove(ctx, srcs[i]);
+        if ( err && !ret )
+            ret = err;
+    }
+    ela_shared_unlock(ctx);
+
+    if ( ret ) {
+        DBG("%s(%p, %zu) : %d\n", __FUNCTION__, ctx, count, ret);
+    }
+    return ret;
+}
+
+ela_error_t ela_activate(struct ela_el *ctx,
+                         struct ela_event_source *src,
+                         uint32_t mask)
+{
+    ela_error_t err;
+
+    if ( !ctx->backend->activate )
+        return ENOTSUP;
+
+    mask &= ELA_EVENT_READABLE | ELA_EVENT_WRITABLE | ELA_EVENT_TIMEOUT;
+    if ( !mask )
+        return EINVAL;
+
+    ela_shared_lock(ctx);
+    err = ctx->backend->activate(ctx, src, mask);
+    ela_shared_unlock(ctx);
+
     if ( err ) {
         DBG("%s(%p, %p) : %d\n", __FUNCTION__, ctx, src, err);
     }
@@ -72,13 +422,304 @@ void ela_run(struct ela_el *ctx)
     return ctx->backend->run(ctx);
 }
 
+ela_error_t ela_set_busy_poll(
+    struct ela_el *ctx,
+    const struct timeval *spin,
+    uint32_t flags)
+{
+    ela_error_t err;
+
+    if ( !ctx->backend->set_busy_poll )
+        return ENOTSUP;
+
+    ela_shared_lock(ctx);
+    err = ctx->backend->set_busy_poll(ctx, spin, flags);
+    ela_shared_unlock(ctx);
+
+    if ( err ) {
+        DBG("%s(%p) : %d\n", __FUNCTION__, ctx, err);
+    }
+    return err;
+}
+
+int ela_run_once(struct ela_el *ctx, const struct timeval *max_wait)
+{
+    struct timespec deadline;
+    int done;
+
+    if ( !ctx->backend->run_once )
+        return -ENOTSUP;
+
+    if ( max_wait )
+        deadline = ela_time_to_ts(ela_time_now()
+                                  + ela_time_from_tv(max_wait));
+
+    return ctx->backend->run_once(ctx, max_wait ? &deadline : NULL, &done);
+}
+
+int ela_run_until(struct ela_el *ctx, const struct timespec *deadline)
+{
+    int total = 0, done = 0;
+
+    if ( !ctx->backend->run_once )
+        return -ENOTSUP;
+
+    do {
+        int count = ctx->backend->run_once(ctx, deadline, &done);
+
+        if ( count < 0 )
+            return count;
+        total += count;
+    } while ( !done
+              && (!deadline
+                  || ela_time_now() < ela_time_from_ts(deadline)) );
+
+    return total;
+}
+
+ela_error_t ela_run_shared(struct ela_el *ctx, unsigned int nthreads)
+{
+    if ( !ctx->backend->run_shared )
+        return ENOTSUP;
+
+    return ctx->backend->run_shared(ctx, nthreads);
+}
+
 void ela_exit(struct ela_el *ctx)
 {
     return ctx->backend->exit(ctx);
 }
 
+ela_error_t ela_post(struct ela_el *ctx, ela_post_func *func, void *data)
+{
+    if ( !ctx->backend->post )
+        return ENOTSUP;
+
+    return ctx->backend->post(ctx, func, data);
+}
+
+struct ela_hook
+{
+    struct ela_hook *next;
+    /** Events the hook is called for, 0 once removed */
+    uint32_t when;
+    ela_hook_func *func;
+    void *data;
+};
+
+struct ela_hooks
+{
+    struct ela_hook *head;
+    /** Removed hooks are only freed once nothing iterates the list */
+    int running;
+    int removed;
+};
+
+static void _ela_hooks_prune(struct ela_hooks *hooks)
+{
+    struct ela_hook **pos = &hooks->head;
+
+    while ( *pos ) {
+        struct ela_hook *hook = *pos;
+
+        if ( hook->when ) {
+            pos = &hook->next;
+            continue;
+        }
+
+        *pos = hook->next;
+        free(hook);
+    }
+
+    hooks->removed = 0;
+}
+
+static void _ela_hooks_free(struct ela_el *ctx)
+{
+    struct ela_hook *hook;
+
+    if ( ctx->hooks == NULL )
+        return;
+
+    while ( (hook = ctx->hooks->head) ) {
+        ctx->hooks->head = hook->next;
+        free(hook);
+    }
+
+    free(ctx->hooks);
+    ctx->hooks = NULL;
+}
+
+ela_error_t ela_hook_add(struct ela_el *ctx, uint32_t when,
+                         ela_hook_func *func, void *data)
+{
+    struct ela_hook *hook, **pos;
+
+    when &= ELA_HOOK_BEFORE_POLL | ELA_HOOK_AFTER_POLL;
+    if ( !when )
+        return EINVAL;
+
+    hook = malloc(sizeof(*hook));
+    if ( hook == NULL )
+        return ENOMEM;
+
+    hook->next = NULL;
+    hook->when = when;
+    hook->func = func;
+    hook->data = data;
+
+    ela_shared_lock(ctx);
+
+    if ( ctx->hooks == NULL ) {
+        ctx->hooks = calloc(1, sizeof(*ctx->hooks));
+        if ( ctx->hooks == NULL ) {
+            ela_shared_unlock(ctx);
+            free(hook);
+            return ENOMEM;
+        }
+    }
+
+    for ( pos = &ctx->hooks->head; *pos; pos = &(*pos)->next )
+        ;
+    *pos = hook;
+
+    ela_shared_unlock(ctx);
+
+    return 0;
+}
+
+ela_error_t ela_hook_remove(struct ela_el *ctx, uint32_t when,
+                            ela_hook_func *func, void *data)
+{
+    struct ela_hook *hook;
+    ela_error_t err = ENOENT;
+
+    ela_shared_lock(ctx);
+
+    for ( hook = ctx->hooks ? ctx->hooks->head : NULL; hook;
+          hook = hook->next ) {
+        if ( !hook->when || hook->func != func || hook->data != data )
+            continue;
+
+        hook->when &= ~when;
+        if ( !hook->when )
+            ctx->hooks->removed = 1;
+        err = 0;
+        break;
+    }
+
+    if ( ctx->hooks && ctx->hooks->removed && !ctx->hooks->running )
+        _ela_hooks_prune(ctx->hooks);
+
+    ela_shared_unlock(ctx);
+
+    return err;
+}
+
+void ela_hooks_run(struct ela_el *ctx, uint32_t when)
+{
+    struct ela_hooks *hooks = ctx->hooks;
+    struct ela_hook *hook;
+
+    if ( hooks == NULL )
+        return;
+
+    /* Hooks added meanwhile get called too, they are appended */
+    hooks->running++;
+    for ( hook = hooks->head; hook; hook = hook->next )
+        if ( hook->when & when )
+            hook->func(ctx, when, hook->data);
+    hooks->running--;
+
+    if ( hooks->removed && !hooks->running )
+        _ela_hooks_prune(hooks);
+}
+
+struct ela_migration
+{
+    struct ela_event_source *src;
+    /** Storage is from the slabs of a loop */
+    int slab;
+};
+
+/* Runs on the destination loop thread */
+static
+void _ela_migrate_arrive(struct ela_el *ctx, void *data)
+{
+    struct ela_migration *m = data;
+    ela_error_t err = 0;
+
+    ela_shared_lock(ctx);
+    if ( m->slab )
+        err = ela_alloc_adopt(ctx, m->src);
+    if ( !err )
+        err = ctx->backend->source_attach(ctx, m->src);
+    ela_shared_unlock(ctx);
+
+    if ( err ) {
+        DBG("%s(%p, %p) : %d\n", __FUNCTION__, ctx, m->src, err);
+    }
+    free(m);
+}
+
+ela_error_t ela_source_migrate(
+    struct ela_event_source *src,
+    struct ela_el *from,
+    struct ela_el *to)
+{
+    struct ela_migration *m;
+    ela_error_t err;
+
+    if ( from == to )
+        return 0;
+
+    if ( from->backend != to->backend )
+        return EINVAL;
+
+    if ( !from->backend->source_detach || !from->backend->post )
+        return ENOTSUP;
+
+    if ( from->shared )
+        return EBUSY;
+
+    if ( from->backend->source_size
+         && (ela_alloc_hooked(from) || ela_alloc_hooked(to)) )
+        return EINVAL;
+
+    m = malloc(sizeof(*m));
+    if ( m == NULL )
+        return ENOMEM;
+
+    m->src = src;
+    m->slab = from->backend->source_size && ela_alloc_owns(from, src);
+
+    err = from->backend->source_detach(from, src);
+    if ( err ) {
+        free(m);
+        return err;
+    }
+
+    if ( m->slab )
+        ela_alloc_lend(from, src);
+
+    err = to->backend->post(to, _ela_migrate_arrive, m);
+    if ( err ) {
+        /* Stays where it was */
+        _ela_migrate_arrive(from, m);
+        return err;
+    }
+
+    return 0;
+}
+
 void ela_close(struct ela_el *ctx)
 {
+    _ela_hooks_free(ctx);
+    ela_defer_close(ctx);
+
+    if ( ctx->backend->source_size )
+        ela_alloc_close(ctx);
+
     return ctx->backend->close(ctx);
 }
 
@@ -88,18 +729,99 @@ ela_error_t ela_source_alloc(
     void *priv,
     struct ela_event_source **ret)
 {
-    ela_error_t err = ctx->backend->source_alloc(ctx, func, priv, ret);
+    ela_error_t err;
+    void *mem;
+
+    if ( !ctx->backend->source_size ) {
+        err = ctx->backend->source_alloc(ctx, func, priv, ret);
+        if ( err ) {
+            DBG("%s(%p) : %d\n", __FUNCTION__, ctx, err);
+        }
+        return err;
+    }
+
+    ela_shared_lock(ctx);
+    err = ela_alloc_source(ctx, &mem);
+    if ( !err ) {
+        err = ctx->backend->source_init(ctx, mem, func, priv);
+        if ( err )
+            ela_alloc_release(ctx, mem);
+    }
+    ela_shared_unlock(ctx);
+
     if ( err ) {
         DBG("%s(%p) : %d\n", __FUNCTION__, ctx, err);
+        return err;
     }
-    return err;
+
+    *ret = mem;
+    return 0;
 }
 
 void ela_source_free(
     struct ela_el *ctx,
     struct ela_event_source *src)
 {
-    return ctx->backend->source_free(ctx, src);
+    if ( !ctx->backend->source_size )
+        return ctx->backend->source_free(ctx, src);
+
+    ela_shared_lock(ctx);
+    ctx->backend->source_cleanup(ctx, src);
+    if ( !ctx->backend->source_release_later
+         || !ctx->backend->source_release_later(ctx, src,
+                                                ela_alloc_release) )
+        ela_alloc_release(ctx, src);
+    ela_shared_unlock(ctx);
+}
+
+size_t ela_source_size(struct ela_el *ctx)
+{
+    if ( !ctx->backend->source_size )
+        return 0;
+
+    return ctx->backend->source_size(ctx);
+}
+
+ela_error_t ela_source_init(
+    struct ela_el *ctx,
+    void *storage,
+    ela_handler_func *func,
+    void *priv)
+{
+    if ( !ctx->backend->source_init )
+        return ENOTSUP;
+
+    return ctx->backend->source_init(ctx, storage, func, priv);
+}
+
+void ela_source_cleanup(
+    struct ela_el *ctx,
+    struct ela_event_source *src)
+{
+    if ( !ctx->backend->source_cleanup )
+        return;
+
+    ela_shared_lock(ctx);
+    ctx->backend->source_cleanup(ctx, src);
+    ela_shared_unlock(ctx);
+}
+
+ela_error_t ela_set_allocator(
+    struct ela_el *ctx,
+    ela_alloc_func *alloc,
+    ela_free_func *free,
+    void *opaque)
+{
+    ela_error_t err;
+
+    if ( !ctx->backend->source_size )
+        return ENOTSUP;
+
+    ela_shared_lock(ctx);
+    err = ela_alloc_set(ctx, alloc, free, opaque);
+    ela_shared_unlock(ctx);
+
+    return err;
 }
 
 #define REGISTRY_SIZE 8
@@ -122,6 +844,7 @@ void ela_register(const struct ela_el_backend *backend)
 
 struct ela_el *ela_create(const char *name)
 {
+    struct ela_el *el;
     size_t i;
 
     if ( name )
@@ -130,13 +853,20 @@ struct ela_el *ela_create(const char *name)
                 continue;
             if ( strcmp(registry[i]->name, name) )
                 continue;
-            return registry[i]->create();
+            el = registry[i]->create();
+            if ( el )
+                return el;
+            /* Backend refused to start (e.g. kernel support missing),
+               fall back on any other one. */
+            break;
         }
 
     for ( i=0; i<REGISTRY_SIZE; ++i ) {
         if ( registry[i] == NULL )
             continue;
-        return registry[i]->create();
+        el = registry[i]->create();
+        if ( el )
+            return el;
     }
 
     return NULL;
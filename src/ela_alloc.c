@@ -0,0 +1,391 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <ela/ela.h>
+#include <ela/backend.h>
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "ela_alloc.h"
+
+#define SLAB_SLOTS 64
+#define ALIGN(x) (((x) + 15) & ~(size_t)15)
+
+struct ela_allocator;
+
+/* Header in front of each slab allocated source */
+struct ela_slot
+{
+    /** Free list link, or borrowed list links while used by another
+        loop than the owner */
+    struct ela_slot *next;
+    struct ela_slot *prev;
+    struct ela_allocator *owner;
+    int state;
+};
+
+#define SLOT_FREE 0
+#define SLOT_USED 1
+/* Used by another loop, see ela_alloc_lend(), and in its borrowed
+   list once adopted */
+#define SLOT_AWAY 2
+#define SLOT_BORROWED 3
+
+#define SLOT_HEADER ALIGN(sizeof(struct ela_slot))
+
+struct ela_slab
+{
+    struct ela_slab *next;
+};
+
+#define SLAB_HEADER ALIGN(sizeof(struct ela_slab))
+
+struct ela_allocator
+{
+    /** Caller hooks, slabs are used when NULL */
+    ela_alloc_func *alloc;
+    ela_free_func *free;
+    void *opaque;
+
+    size_t slot_size;
+    struct ela_slab *slabs;
+    struct ela_slot *free_list;
+
+    /** Slots of other loops used by sources migrated here */
+    struct ela_slot *borrowed;
+
+    /** Sources currently allocated, whatever the allocator */
+    size_t live;
+
+    /** Other loops give slots back through here, slabs outlive the
+        loop until away drops to 0 */
+    pthread_mutex_t lock;
+    struct ela_slot *returned;
+    size_t away;
+    int closed;
+};
+
+static struct ela_allocator *_allocator(struct ela_el *ctx)
+{
+    struct ela_allocator *a = ctx->allocator;
+
+    if ( a )
+        return a;
+
+    a = calloc(1, sizeof(*a));
+    if ( a == NULL )
+        return NULL;
+
+    a->slot_size = SLOT_HEADER + ALIGN(ctx->backend->source_size(ctx));
+    pthread_mutex_init(&a->lock, NULL);
+    /* Published for ela_alloc_hooked() */
+    __atomic_store_n(&ctx->allocator, a, __ATOMIC_RELEASE);
+    return a;
+}
+
+static void _allocator_free(struct ela_allocator *a)
+{
+    while ( a->slabs ) {
+        struct ela_slab *slab = a->slabs;
+
+        a->slabs = slab->next;
+        free(slab);
+    }
+
+    pthread_mutex_destroy(&a->lock);
+    free(a);
+}
+
+static struct ela_slot *_mem_slot(void *mem)
+{
+    return (struct ela_slot *)((char *)mem - SLOT_HEADER);
+}
+
+static void *_slot_mem(struct ela_slot *slot)
+{
+    return (char *)slot + SLOT_HEADER;
+}
+
+static ela_error_t _slab_grow(struct ela_allocator *a)
+{
+    struct ela_slab *slab = malloc(SLAB_HEADER + SLAB_SLOTS * a->slot_size);
+    char *mem = (char *)slab + SLAB_HEADER;
+    size_t i;
+
+    if ( slab == NULL )
+        return ENOMEM;
+
+    slab->next = a->slabs;
+    a->slabs = slab;
+
+    /* Push in reverse so that slots get handed out in address order */
+    for ( i = SLAB_SLOTS; i-- > 0; ) {
+        struct ela_slot *slot = (struct ela_slot *)(mem + i * a->slot_size);
+
+        slot->owner = a;
+        slot->state = SLOT_FREE;
+        slot->next = a->free_list;
+        a->free_list = slot;
+    }
+
+    return 0;
+}
+
+/* Give a slot back to its owner, from any thread */
+static void _slot_return(struct ela_slot *slot)
+{
+    struct ela_allocator *owner = slot->owner;
+    int last;
+
+    pthread_mutex_lock(&owner->lock);
+    slot->next = owner->returned;
+    owner->returned = slot;
+    owner->away--;
+    last = owner->closed && owner->away == 0;
+    pthread_mutex_unlock(&owner->lock);
+
+    if ( last )
+        _allocator_free(owner);
+}
+
+static void _borrowed_link(struct ela_allocator *a, struct ela_slot *slot)
+{
+    slot->state = SLOT_BORROWED;
+    slot->prev = NULL;
+    slot->next = a->borrowed;
+    if ( a->borrowed )
+        a->borrowed->prev = slot;
+    a->borrowed = slot;
+}
+
+static void _borrowed_unlink(struct ela_allocator *a, struct ela_slot *slot)
+{
+    if ( slot->prev )
+        slot->prev->next = slot->next;
+    else
+        a->borrowed = slot->next;
+
+    if ( slot->next )
+        slot->next->prev = slot->prev;
+
+    slot->state = SLOT_AWAY;
+}
+
+ela_error_t ela_alloc_source(struct ela_el *ctx, void **ret)
+{
+    struct ela_allocator *a = _allocator(ctx);
+    struct ela_slot *slot;
+
+    if ( a == NULL )
+        return ENOMEM;
+
+    if ( a->alloc ) {
+        *ret = a->alloc(a->opaque, ctx->backend->source_size(ctx));
+        if ( *ret == NULL )
+            return ENOMEM;
+        a->live++;
+        return 0;
+    }
+
+    if ( a->free_list == NULL && a->returned ) {
+        pthread_mutex_lock(&a->lock);
+        a->free_list = a->returned;
+        a->returned = NULL;
+        pthread_mutex_unlock(&a->lock);
+    }
+
+    if ( a->free_list == NULL && _slab_grow(a) )
+        return ENOMEM;
+
+    slot = a->free_list;
+    a->free_list = slot->next;
+    slot->state = SLOT_USED;
+    a->live++;
+
+    *ret = _slot_mem(slot);
+    return 0;
+}
+
+void ela_alloc_release(struct ela_el *ctx, void *mem)
+{
+    struct ela_allocator *a = ctx->allocator;
+    struct ela_slot *slot;
+
+    if ( a && a->free ) {
+        a->live--;
+        a->free(a->opaque, mem);
+        return;
+    }
+
+    slot = _mem_slot(mem);
+
+    if ( slot->owner != a ) {
+        /* Not in the borrowed list if adopting it failed */
+        if ( slot->state == SLOT_BORROWED ) {
+            _borrowed_unlink(a, slot);
+            a->live--;
+        }
+        _slot_return(slot);
+        return;
+    }
+
+    a->live--;
+    slot->state = SLOT_FREE;
+    slot->next = a->free_list;
+    a->free_list = slot;
+}
+
+int ela_alloc_hooked(struct ela_el *ctx)
+{
+    struct ela_allocator *a = __atomic_load_n(&ctx->allocator,
+                                              __ATOMIC_ACQUIRE);
+
+    return a && __atomic_load_n(&a->alloc, __ATOMIC_RELAXED);
+}
+
+int ela_alloc_owns(struct ela_el *ctx, void *mem)
+{
+    struct ela_allocator *a = ctx->allocator;
+    struct ela_slab *slab;
+    struct ela_slot *slot;
+
+    if ( a == NULL || a->alloc )
+        return 0;
+
+    for ( slot = a->borrowed; slot; slot = slot->next )
+        if ( _slot_mem(slot) == mem )
+            return 1;
+
+    for ( slab = a->slabs; slab; slab = slab->next ) {
+        char *first = (char *)slab + SLAB_HEADER;
+        size_t offset = (char *)mem - first;
+
+        if ( (char *)mem < first || offset >= SLAB_SLOTS * a->slot_size )
+            continue;
+
+        return offset % a->slot_size == SLOT_HEADER
+            && _mem_slot(mem)->state == SLOT_USED;
+    }
+
+    return 0;
+}
+
+void ela_alloc_lend(struct ela_el *ctx, void *mem)
+{
+    struct ela_allocator *a = ctx->allocator;
+    struct ela_slot *slot = _mem_slot(mem);
+
+    a->live--;
+
+    if ( slot->owner != a ) {
+        _borrowed_unlink(a, slot);
+        return;
+    }
+
+    slot->state = SLOT_AWAY;
+    pthread_mutex_lock(&a->lock);
+    a->away++;
+    pthread_mutex_unlock(&a->lock);
+}
+
+ela_error_t ela_alloc_adopt(struct ela_el *ctx, void *mem)
+{
+    struct ela_allocator *a = _allocator(ctx);
+    struct ela_slot *slot = _mem_slot(mem);
+
+    /* Slot stays away, released straight to its owner */
+    if ( a == NULL )
+        return ENOMEM;
+
+    a->live++;
+
+    if ( slot->owner != a ) {
+        _borrowed_link(a, slot);
+        return 0;
+    }
+
+    pthread_mutex_lock(&a->lock);
+    a->away--;
+    pthread_mutex_unlock(&a->lock);
+    slot->state = SLOT_USED;
+    return 0;
+}
+
+ela_error_t ela_alloc_set(struct ela_el *ctx,
+                          ela_alloc_func *alloc,
+                          ela_free_func *free,
+                          void *opaque)
+{
+    struct ela_allocator *a;
+
+    if ( !alloc != !free )
+        return EINVAL;
+
+    a = _allocator(ctx);
+    if ( a == NULL )
+        return ENOMEM;
+
+    if ( a->live )
+        return EBUSY;
+
+    __atomic_store_n(&a->alloc, alloc, __ATOMIC_RELAXED);
+    a->free = free;
+    a->opaque = opaque;
+    return 0;
+}
+
+void ela_alloc_close(struct ela_el *ctx)
+{
+    struct ela_allocator *a = ctx->allocator;
+    struct ela_slab *slab;
+    int last;
+
+    if ( a == NULL )
+        return;
+
+    for ( slab = a->slabs; slab; slab = slab->next ) {
+        char *mem = (char *)slab + SLAB_HEADER;
+        size_t i;
+
+        for ( i = 0; i < SLAB_SLOTS; ++i ) {
+            struct ela_slot *slot = (struct ela_slot *)(mem + i * a->slot_size);
+
+            if ( slot->state == SLOT_USED )
+                ctx->backend->source_cleanup(
+                    ctx, (struct ela_event_source *)_slot_mem(slot));
+        }
+    }
+
+    while ( a->borrowed ) {
+        struct ela_slot *slot = a->borrowed;
+
+        _borrowed_unlink(a, slot);
+        ctx->backend->source_cleanup(
+            ctx, (struct ela_event_source *)_slot_mem(slot));
+        _slot_return(slot);
+    }
+
+    ctx->allocator = NULL;
+
+    /* Slots away keep the slabs alive, the last one back frees them */
+    pthread_mutex_lock(&a->lock);
+    a->closed = 1;
+    last = a->away == 0;
+    pthread_mutex_unlock(&a->lock);
+
+    if ( last )
+        _allocator_free(a);
+}
@@ -0,0 +1,48 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef ELA_ALLOC_H
+#define ELA_ALLOC_H
+
+/*
+  Per-loop event source storage, for backends implementing
+  source_init/source_cleanup. Sources come from a slab free-list by
+  default, or from caller hooks set with ela_set_allocator().
+ */
+
+#include <ela/ela.h>
+
+ela_error_t ela_alloc_source(struct ela_el *ctx, void **ret);
+void ela_alloc_release(struct ela_el *ctx, void *mem);
+
+ela_error_t ela_alloc_set(struct ela_el *ctx,
+                          ela_alloc_func *alloc,
+                          ela_free_func *free,
+                          void *opaque);
+
+/** Whether caller hooks are set, may be called from any thread */
+int ela_alloc_hooked(struct ela_el *ctx);
+
+/** Whether mem is slab storage of a source on this loop */
+int ela_alloc_owns(struct ela_el *ctx, void *mem);
+
+/** Hand slab storage over to another loop: lend on the thread of the
+    loop the source leaves, adopt on the thread of the one it joins.
+    Storage stays in the slab it came from, and goes back there when
+    released, even from another thread. */
+void ela_alloc_lend(struct ela_el *ctx, void *mem);
+ela_error_t ela_alloc_adopt(struct ela_el *ctx, void *mem);
+
+/** Clean up sources still allocated from slabs, and release all
+    allocator memory. Called before the backend closes the loop. */
+void ela_alloc_close(struct ela_el *ctx);
+
+#endif
@@ -30,6 +30,8 @@ struct cf_mainloop
     struct ela_el base;
     CFRunLoopRef runloop;
     int auto_allocated;
+    /** Calls ela_hook_add() hooks around the wait */
+    CFRunLoopObserverRef observer;
 };
 
 struct ela_event_source
@@ -191,6 +193,10 @@ ela_error_t _ela_cf_set_fd(
 
     (void)ctx;
 
+    /* CFFileDescriptor callbacks are level-triggered only */
+    if ( ela_flags & ELA_EVENT_EDGE )
+        return ENOTSUP;
+
     CFFileDescriptorContext context = {
         .info = src,
     };
@@ -273,9 +279,28 @@ static
 void _ela_cf_close(struct ela_el *ctx_)
 {
     struct cf_mainloop *ctx = (struct cf_mainloop *)ctx_;
+
+    if ( ctx->observer ) {
+        CFRunLoopRemoveObserver(ctx->runloop, ctx->observer,
+                                kCFRunLoopCommonModes);
+        CFRelease(ctx->observer);
+    }
     free(ctx);
 }
 
+static
+void _ela_cf_observer_cb(CFRunLoopObserverRef observer,
+                         CFRunLoopActivity activity,
+                         void *info)
+{
+    struct cf_mainloop *ctx = info;
+
+    if ( activity & kCFRunLoopBeforeWaiting )
+        ela_hooks_run(&ctx->base, ELA_HOOK_BEFORE_POLL);
+    if ( activity & kCFRunLoopAfterWaiting )
+        ela_hooks_run(&ctx->base, ELA_HOOK_AFTER_POLL);
+}
+
 static
 void _ela_cf_run(struct ela_el *ctx_)
 {
@@ -383,13 +408,26 @@ ELA_EXPORT
 struct ela_el *ela_cf(CFRunLoopRef runloop)
 {
     struct cf_mainloop *ctx = malloc(sizeof(*ctx));
+    CFRunLoopObserverContext observer_ctx = { 0, NULL, NULL, NULL, NULL };
+
     if ( ctx == NULL )
         return NULL;
 
     ctx->runloop = runloop;
     ctx->base.backend = &backend;
+    ctx->base.allocator = NULL;
+    ctx->base.shared = NULL;
+    ctx->base.hooks = NULL;
+    ctx->base.defer = NULL;
     ctx->auto_allocated = 0;
 
+    observer_ctx.info = ctx;
+    ctx->observer = CFRunLoopObserverCreate(
+        NULL, kCFRunLoopBeforeWaiting | kCFRunLoopAfterWaiting, true, 0,
+        _ela_cf_observer_cb, &observer_ctx);
+    if ( ctx->observer )
+        CFRunLoopAddObserver(runloop, ctx->observer, kCFRunLoopCommonModes);
+
     return &ctx->base;
 }
 
@@ -0,0 +1,59 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef ELA_CHILD_H
+#define ELA_CHILD_H
+
+/*
+  Child process helpers for backends implementing ela_set_child().
+  A child is watched through a pidfd, readable once it exits, where
+  the kernel has them, through SIGCHLD otherwise.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#ifdef __linux__
+# include <sys/syscall.h>
+#endif
+
+/** A pidfd for pid, or a negative errno value, -ENOSYS if SIGCHLD is
+    the only way to learn about its exit */
+static inline int ela_child_open(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    int fd = syscall(SYS_pidfd_open, pid, 0);
+
+    return fd < 0 ? -errno : fd;
+#else
+    (void)pid;
+    return -ENOSYS;
+#endif
+}
+
+/** Reaps pid if it exited. 1 with its wait status if so, 0 if it is
+    still running, or a negative errno value, -ECHILD if someone else
+    reaped it. */
+static inline int ela_child_reap(pid_t pid, int *status)
+{
+    pid_t ret;
+
+    do
+        ret = waitpid(pid, status, WNOHANG);
+    while ( ret < 0 && errno == EINTR );
+
+    if ( ret < 0 )
+        return -errno;
+    return ret == pid;
+}
+
+#endif
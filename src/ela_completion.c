@@ -0,0 +1,127 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <ela/ela.h>
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "ela_completion.h"
+
+ela_error_t ela_buffer_group_alloc(struct ela_buffer_group **list,
+                                   uint16_t id,
+                                   unsigned int count,
+                                   size_t size,
+                                   struct ela_buffer_group **ret)
+{
+    struct ela_buffer_group *group;
+
+    if ( ela_buffer_group_find(*list, id) )
+        return EEXIST;
+
+    group = malloc(sizeof(*group));
+    if ( group == NULL )
+        return ENOMEM;
+
+    group->mem = malloc(count * size);
+    if ( group->mem == NULL ) {
+        free(group);
+        return ENOMEM;
+    }
+
+    group->id = id;
+    group->count = count;
+    group->size = size;
+    group->backend_data = NULL;
+    group->next = *list;
+    *list = group;
+
+    *ret = group;
+    return 0;
+}
+
+struct ela_buffer_group *ela_buffer_group_find(struct ela_buffer_group *list,
+                                               uint16_t id)
+{
+    for ( ; list; list = list->next )
+        if ( list->id == id )
+            return list;
+
+    return NULL;
+}
+
+void ela_buffer_group_free_all(struct ela_buffer_group **list)
+{
+    while ( *list ) {
+        struct ela_buffer_group *group = *list;
+
+        *list = group->next;
+        free(group->mem);
+        free(group);
+    }
+}
+
+static int _accept(int fd)
+{
+#if defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+    return accept4(fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC);
+#else
+    int afd = accept(fd, NULL, NULL);
+
+    if ( afd >= 0 ) {
+        fcntl(afd, F_SETFL, fcntl(afd, F_GETFL, 0) | O_NONBLOCK);
+        fcntl(afd, F_SETFD, FD_CLOEXEC);
+    }
+
+    return afd;
+#endif
+}
+
+ela_error_t ela_completion_prepare(int op, int fd)
+{
+    int flags;
+
+    if ( op != ELA_COMPLETION_ACCEPT )
+        return 0;
+
+    flags = fcntl(fd, F_GETFL, 0);
+    if ( flags < 0 )
+        return errno;
+
+    if ( !(flags & O_NONBLOCK) && fcntl(fd, F_SETFL, flags | O_NONBLOCK) )
+        return errno;
+
+    return 0;
+}
+
+ssize_t ela_completion_emulate(int op, int fd,
+                               const struct ela_buffer_group *group)
+{
+    ssize_t ret;
+
+    do {
+        if ( op == ELA_COMPLETION_ACCEPT )
+            ret = _accept(fd);
+        else
+            ret = recv(fd, group->mem, group->size, MSG_DONTWAIT);
+    } while ( ret < 0 && errno == EINTR );
+
+    return ret < 0 ? -errno : ret;
+}
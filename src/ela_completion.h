@@ -0,0 +1,63 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef ELA_COMPLETION_H
+#define ELA_COMPLETION_H
+
+/*
+  Helpers for completion sources (ela_recv_multishot,
+  ela_accept_multishot): loop-owned buffer groups and the
+  readiness-based emulation of a single operation.
+ */
+
+#include <ela/ela.h>
+
+#define ELA_COMPLETION_RECV 1
+#define ELA_COMPLETION_ACCEPT 2
+
+struct ela_buffer_group
+{
+    struct ela_buffer_group *next;
+    uint16_t id;
+    unsigned int count;
+    size_t size;
+    /** count * size bytes, contiguous */
+    char *mem;
+    /** Backend kernel-side state, if any */
+    void *backend_data;
+};
+
+ela_error_t ela_buffer_group_alloc(struct ela_buffer_group **list,
+                                   uint16_t id,
+                                   unsigned int count,
+                                   size_t size,
+                                   struct ela_buffer_group **ret);
+
+struct ela_buffer_group *ela_buffer_group_find(struct ela_buffer_group *list,
+                                               uint16_t id);
+
+/** Caller must have released backend_data beforehand */
+void ela_buffer_group_free_all(struct ela_buffer_group **list);
+
+/**
+   Prepares fd for emulated operations: accept emulation needs a
+   non-blocking listening socket.
+ */
+ela_error_t ela_completion_prepare(int op, int fd);
+
+/**
+   Performs one non-blocking receive (into the first buffer of group)
+   or accept on fd. Returns the operation result, or -errno.
+ */
+ssize_t ela_completion_emulate(int op, int fd,
+                               const struct ela_buffer_group *group);
+
+#endif
@@ -0,0 +1,214 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <ela/ela.h>
+#include <ela/backend.h>
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "ela_defer.h"
+#include "ela_shared.h"
+
+#define DEFER_NOW 0
+#define DEFER_LATER 1
+
+struct ela_deferred
+{
+    /** Idle list link */
+    struct ela_deferred *next;
+    /** All entries of the pool */
+    struct ela_deferred *all_next;
+    struct ela_el *ctx;
+    struct ela_event_source *src;
+    int kind;
+    ela_post_func *func;
+    void *data;
+};
+
+struct ela_defer_pool
+{
+    /** Idle entries, by kind. Deferred calls keep their source set
+        up, timed ones set it at each call. */
+    struct ela_deferred *idle[2];
+    struct ela_deferred *all;
+    /** Backend cannot activate sources, deferred calls are zero
+        timeouts */
+    int no_activate;
+};
+
+static const struct timeval _zero = {0, 0};
+
+static
+void _ela_deferred_cb(struct ela_event_source *src, int fd,
+                      uint32_t mask, void *priv)
+{
+    struct ela_deferred *d = priv;
+    struct ela_el *ctx = d->ctx;
+    ela_post_func *func = d->func;
+    void *data = d->data;
+
+    /* Back to the pool first, the call may defer again */
+    ela_shared_lock(ctx);
+    d->next = ctx->defer->idle[d->kind];
+    ctx->defer->idle[d->kind] = d;
+    ela_shared_unlock(ctx);
+
+    func(ctx, data);
+}
+
+/* Called with the loop lock held */
+static ela_error_t _ela_deferred_get(struct ela_el *ctx, int kind,
+                                     struct ela_deferred **ret)
+{
+    struct ela_defer_pool *pool = ctx->defer;
+    struct ela_deferred *d;
+    ela_error_t err;
+
+    if ( pool == NULL ) {
+        pool = calloc(1, sizeof(*pool));
+        if ( pool == NULL )
+            return ENOMEM;
+        pool->no_activate = ctx->backend->activate == NULL;
+        ctx->defer = pool;
+    }
+
+    d = pool->idle[kind];
+    if ( d ) {
+        pool->idle[kind] = d->next;
+        *ret = d;
+        return 0;
+    }
+
+    d = malloc(sizeof(*d));
+    if ( d == NULL )
+        return ENOMEM;
+
+    d->ctx = ctx;
+    d->kind = kind;
+    err = ela_source_alloc(ctx, _ela_deferred_cb, d, &d->src);
+    if ( !err && kind == DEFER_NOW && !pool->no_activate )
+        err = ela_set_fd(ctx, d->src, -1, ELA_EVENT_ONCE);
+    if ( err ) {
+        free(d);
+        return err;
+    }
+
+    d->all_next = pool->all;
+    pool->all = d;
+    *ret = d;
+    return 0;
+}
+
+static void _ela_deferred_put(struct ela_el *ctx, struct ela_deferred *d)
+{
+    d->next = ctx->defer->idle[d->kind];
+    ctx->defer->idle[d->kind] = d;
+}
+
+/* Ready without any timer, if the backend can */
+static ela_error_t _ela_deferred_activate(struct ela_el *ctx,
+                                          struct ela_deferred *d)
+{
+    ela_error_t err = ela_add(ctx, d->src);
+
+    if ( !err )
+        err = ela_activate(ctx, d->src, ELA_EVENT_TIMEOUT);
+    if ( err != ENOTSUP && err != ENOENT )
+        return err;
+
+    /* Not for this backend, fall back to an expired timeout from now
+       on */
+    ela_remove(ctx, d->src);
+    ctx->defer->no_activate = 1;
+    return ENOTSUP;
+}
+
+ela_error_t ela_defer(struct ela_el *ctx, ela_post_func *func, void *data)
+{
+    struct ela_deferred *d;
+    ela_error_t err;
+
+    ela_shared_lock(ctx);
+
+    err = _ela_deferred_get(ctx, DEFER_NOW, &d);
+    if ( err )
+        goto out;
+
+    d->func = func;
+    d->data = data;
+
+    err = ctx->defer->no_activate ? ENOTSUP : _ela_deferred_activate(ctx, d);
+    if ( err == ENOTSUP ) {
+        err = ela_set_timeout(ctx, d->src, &_zero, ELA_EVENT_ONCE);
+        if ( !err )
+            err = ela_add(ctx, d->src);
+    }
+
+    if ( err )
+        _ela_deferred_put(ctx, d);
+
+out:
+    ela_shared_unlock(ctx);
+    return err;
+}
+
+ela_error_t ela_call_later(struct ela_el *ctx, const struct timeval *tv,
+                           ela_post_func *func, void *data)
+{
+    struct ela_deferred *d;
+    ela_error_t err;
+
+    if ( tv == NULL )
+        return EINVAL;
+
+    ela_shared_lock(ctx);
+
+    err = _ela_deferred_get(ctx, DEFER_LATER, &d);
+    if ( err )
+        goto out;
+
+    d->func = func;
+    d->data = data;
+
+    err = ela_set_timeout(ctx, d->src, tv, ELA_EVENT_ONCE);
+    if ( !err )
+        err = ela_add(ctx, d->src);
+
+    if ( err )
+        _ela_deferred_put(ctx, d);
+
+out:
+    ela_shared_unlock(ctx);
+    return err;
+}
+
+void ela_defer_close(struct ela_el *ctx)
+{
+    struct ela_defer_pool *pool = ctx->defer;
+
+    if ( pool == NULL )
+        return;
+
+    while ( pool->all ) {
+        struct ela_deferred *d = pool->all;
+
+        pool->all = d->all_next;
+        ela_source_free(ctx, d->src);
+        free(d);
+    }
+
+    free(pool);
+    ctx->defer = NULL;
+}
@@ -0,0 +1,27 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef ELA_DEFER_H
+#define ELA_DEFER_H
+
+/*
+  Pool of loop-owned sources behind ela_defer() and ela_call_later().
+  Sources get recycled as soon as their call is made, so that deferred
+  calls allocate nothing once the pool has grown large enough.
+ */
+
+#include <ela/ela.h>
+
+/** Free pooled sources, dropping pending calls. Called before
+    sources storage goes away. */
+void ela_defer_close(struct ela_el *ctx);
+
+#endif
@@ -0,0 +1,152 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <ela/ela.h>
+#include <ela/backend.h>
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <sys/epoll.h>
+
+#include "ela_native.h"
+
+#define EPOLL_EVENT_COUNT 64
+
+struct epoll_mainloop
+{
+    struct native_loop base;
+    int epfd;
+    struct epoll_event events[EPOLL_EVENT_COUNT];
+};
+
+static
+ela_error_t _ela_epoll_fd_update(struct native_loop *loop, int fd,
+                                 uint32_t events)
+{
+    struct epoll_mainloop *ctx = (struct epoll_mainloop *)loop;
+    uint32_t old = loop->fds[fd].events;
+    struct epoll_event ev;
+    int op, ret;
+
+    memset(&ev, 0, sizeof(ev));
+    if ( events & ELA_EVENT_READABLE ) ev.events |= EPOLLIN;
+    if ( events & ELA_EVENT_WRITABLE ) ev.events |= EPOLLOUT;
+    if ( events & ELA_EVENT_EDGE ) ev.events |= EPOLLET;
+    ev.data.fd = fd;
+
+    if ( events == 0 )
+        op = EPOLL_CTL_DEL;
+    else if ( old == 0 )
+        op = EPOLL_CTL_ADD;
+    else
+        op = EPOLL_CTL_MOD;
+
+    ret = epoll_ctl(ctx->epfd, op, fd, &ev);
+    if ( ret && op == EPOLL_CTL_ADD && errno == EEXIST )
+        ret = epoll_ctl(ctx->epfd, EPOLL_CTL_MOD, fd, &ev);
+    else if ( ret && op == EPOLL_CTL_MOD && errno == ENOENT )
+        ret = epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, fd, &ev);
+    else if ( ret && op == EPOLL_CTL_DEL && (errno == ENOENT || errno == EBADF) )
+        ret = 0;
+
+    return ret ? errno : 0;
+}
+
+static
+void _ela_epoll_wait(struct native_loop *loop, uint64_t deadline)
+{
+    struct epoll_mainloop *ctx = (struct epoll_mainloop *)loop;
+    int timeout = -1;
+    int i, n;
+
+    if ( deadline != NATIVE_WAIT_FOREVER ) {
+        uint64_t now = ela_native_now();
+        uint64_t left = deadline > now ? deadline - now : 0;
+        uint64_t ms = left / 1000000 + (left % 1000000 != 0);
+
+        /* Far deadlines take several waits, rather than overflowing
+           into an infinite one */
+        timeout = ms < INT_MAX ? (int)ms : INT_MAX;
+    }
+
+    ela_native_wait_begin(loop);
+    n = epoll_wait(ctx->epfd, ctx->events, EPOLL_EVENT_COUNT, timeout);
+    ela_native_wait_end(loop);
+
+    for ( i = 0; i < n; ++i ) {
+        const struct epoll_event *ev = &ctx->events[i];
+        uint32_t mask = 0;
+
+        if ( ev->events & (EPOLLIN|EPOLLERR|EPOLLHUP) )
+            mask |= ELA_EVENT_READABLE;
+        if ( ev->events & (EPOLLOUT|EPOLLERR|EPOLLHUP) )
+            mask |= ELA_EVENT_WRITABLE;
+
+        ela_native_fd_ready(loop, ev->data.fd, mask);
+    }
+}
+
+static
+void _ela_epoll_close(struct native_loop *loop)
+{
+    struct epoll_mainloop *ctx = (struct epoll_mainloop *)loop;
+
+    close(ctx->epfd);
+}
+
+static const struct native_poller epoll_poller =
+{
+    .fd_update = _ela_epoll_fd_update,
+    .wait = _ela_epoll_wait,
+    .close = _ela_epoll_close,
+    .shared = 1,
+};
+
+static struct ela_el *_ela_epoll_create(void);
+
+static const struct ela_el_backend epoll_backend =
+{
+    NATIVE_BACKEND_OPS,
+    .name = "epoll",
+    .create = _ela_epoll_create,
+};
+
+static
+struct ela_el *_ela_epoll_create(void)
+{
+    struct epoll_mainloop *ctx = malloc(sizeof(*ctx));
+    if ( ctx == NULL )
+        return NULL;
+
+    ela_native_init(&ctx->base, &epoll_backend, &epoll_poller);
+
+    ctx->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if ( ctx->epfd < 0 ) {
+        ela_post_queue_release(&ctx->base.post);
+        free(ctx);
+        return NULL;
+    }
+
+    return &ctx->base.base;
+}
+
+__attribute__((constructor))
+static void _ela_epoll_register(void)
+{
+    ela_register(&epoll_backend);
+}
@@ -0,0 +1,474 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifdef __linux__
+# define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <ela/ela.h>
+#include <ela/backend.h>
+#include <ela/group.h>
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#define GROUP_MAX_LOOPS 1024
+/** Delay before accepting again after a transient accept error */
+#define GROUP_ACCEPT_RETRY_MS 100
+
+struct group_loop;
+
+struct group_listener
+{
+    struct group_listener *next;
+    struct group_loop *loop;
+    struct ela_event_source *source;
+    int fd;
+    /** Shared sockets are only closed by their first listener */
+    int owns_fd;
+    ela_group_accept_func *func;
+    void *priv;
+};
+
+struct group_loop
+{
+    struct ela_el *ctx;
+    pthread_t thread;
+    int started;
+    /** Core to pin to, -1 for none */
+    int cpu;
+    struct ela_event_source *stop;
+    struct group_listener *listeners;
+    /** Placed connections, only touched with atomics */
+    unsigned long load;
+} __attribute__((aligned(64)));
+
+struct ela_group
+{
+    unsigned int size;
+    /** Made readable to stop all loops */
+    int stop_fd[2];
+    struct group_loop *loops;
+};
+
+static
+void _group_stop_cb(struct ela_event_source *source, int fd,
+                    uint32_t mask, void *data)
+{
+    struct group_loop *loop = data;
+
+    ela_exit(loop->ctx);
+}
+
+static
+void *_group_thread(void *data)
+{
+    struct group_loop *loop = data;
+
+#ifdef __linux__
+    if ( loop->cpu >= 0 ) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(loop->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#endif
+
+    ela_run(loop->ctx);
+    return NULL;
+}
+
+/* Cores the process may run on, in order, 0 if unknown */
+static unsigned int _group_cpus(int *cpus, unsigned int max)
+{
+    unsigned int count = 0;
+#ifdef __linux__
+    cpu_set_t set;
+    int cpu;
+
+    if ( sched_getaffinity(0, sizeof(set), &set) )
+        return 0;
+
+    for ( cpu = 0; cpu < CPU_SETSIZE && count < max; ++cpu )
+        if ( CPU_ISSET(cpu, &set) )
+            cpus[count++] = cpu;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    (void)cpus;
+    if ( n > 0 )
+        count = (unsigned long)n < max ? (unsigned int)n : max;
+#endif
+    return count;
+}
+
+static void _group_free(struct ela_group *group)
+{
+    unsigned int i;
+
+    for ( i = 0; i < group->size; ++i ) {
+        struct group_loop *loop = &group->loops[i];
+
+        while ( loop->listeners ) {
+            struct group_listener *l = loop->listeners;
+
+            loop->listeners = l->next;
+            if ( l->source )
+                ela_source_free(loop->ctx, l->source);
+            if ( l->owns_fd )
+                close(l->fd);
+            free(l);
+        }
+
+        if ( loop->stop )
+            ela_source_free(loop->ctx, loop->stop);
+        if ( loop->ctx )
+            ela_close(loop->ctx);
+    }
+
+    close(group->stop_fd[0]);
+    close(group->stop_fd[1]);
+    free(group->loops);
+    free(group);
+}
+
+static ela_error_t _group_loop_init(struct ela_group *group,
+                                    struct group_loop *loop,
+                                    const char *backend_name)
+{
+    ela_error_t err;
+
+    loop->ctx = ela_create(backend_name);
+    if ( loop->ctx == NULL )
+        return ENOENT;
+
+    /* Nothing could reach a running loop without it */
+    if ( loop->ctx->backend->post == NULL )
+        return ENOTSUP;
+
+    err = ela_source_alloc(loop->ctx, _group_stop_cb, loop, &loop->stop);
+    if ( !err )
+        err = ela_set_fd(loop->ctx, loop->stop, group->stop_fd[0],
+                         ELA_EVENT_READABLE);
+    if ( !err )
+        err = ela_add(loop->ctx, loop->stop);
+
+    return err;
+}
+
+ELA_EXPORT
+struct ela_group *ela_group_create(unsigned int nthreads,
+                                   const char *backend_name)
+{
+    int cpus[GROUP_MAX_LOOPS];
+    struct ela_group *group;
+    unsigned int ncpus, i;
+
+    ncpus = _group_cpus(cpus, GROUP_MAX_LOOPS);
+    if ( nthreads == 0 )
+        nthreads = ncpus ? ncpus : 1;
+    if ( nthreads > GROUP_MAX_LOOPS )
+        return NULL;
+
+    group = calloc(1, sizeof(*group));
+    if ( group == NULL )
+        return NULL;
+
+    if ( pipe(group->stop_fd) ) {
+        free(group);
+        return NULL;
+    }
+    fcntl(group->stop_fd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(group->stop_fd[1], F_SETFD, FD_CLOEXEC);
+
+    group->loops = calloc(nthreads, sizeof(*group->loops));
+    if ( group->loops == NULL )
+        goto fail;
+    group->size = nthreads;
+
+    for ( i = 0; i < nthreads; ++i ) {
+        struct group_loop *loop = &group->loops[i];
+
+        loop->cpu = ncpus ? cpus[i % ncpus] : -1;
+
+        if ( _group_loop_init(group, loop, backend_name) )
+            goto fail;
+    }
+
+    for ( i = 0; i < nthreads; ++i ) {
+        struct group_loop *loop = &group->loops[i];
+
+        if ( pthread_create(&loop->thread, NULL, _group_thread, loop) ) {
+            ela_group_destroy(group);
+            return NULL;
+        }
+        loop->started = 1;
+    }
+
+    return group;
+
+fail:
+    _group_free(group);
+    return NULL;
+}
+
+ELA_EXPORT
+void ela_group_destroy(struct ela_group *group)
+{
+    unsigned int i;
+    ssize_t ret;
+
+    /* Stays readable, every loop sees it */
+    ret = write(group->stop_fd[1], "", 1);
+    (void)ret;
+
+    for ( i = 0; i < group->size; ++i )
+        if ( group->loops[i].started )
+            pthread_join(group->loops[i].thread, NULL);
+
+    _group_free(group);
+}
+
+ELA_EXPORT
+unsigned int ela_group_size(const struct ela_group *group)
+{
+    return group->size;
+}
+
+ELA_EXPORT
+struct ela_el *ela_group_loop(const struct ela_group *group,
+                              unsigned int index)
+{
+    if ( index >= group->size )
+        return NULL;
+
+    return group->loops[index].ctx;
+}
+
+/* Errors that go away once fds or memory get released */
+static int _group_accept_transient(ela_error_t err)
+{
+    switch ( err ) {
+    case EMFILE:
+    case ENFILE:
+    case ENOBUFS:
+    case ENOMEM:
+    case EBUSY:
+    case ECONNABORTED:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* Runs on the loop thread, once a transient error had time to clear */
+static
+void _group_listen_retry(struct ela_el *ctx, void *data)
+{
+    struct group_listener *l = data;
+    ela_error_t err;
+
+    err = ela_add(ctx, l->source);
+    if ( err )
+        l->func(ctx, -err, l->priv);
+}
+
+static
+void _group_accept_cb(struct ela_event_source *source, int fd,
+                      ssize_t res, const void *buf, void *data)
+{
+    struct group_listener *l = data;
+    struct timeval retry = { 0, GROUP_ACCEPT_RETRY_MS * 1000 };
+
+    if ( res >= 0 )
+        __atomic_fetch_add(&l->loop->load, 1, __ATOMIC_RELAXED);
+
+    l->func(l->loop->ctx, (int)res, l->priv);
+
+    /* The source is out of the loop after an error, bring it back
+       rather than leave this loop out of the listener for good */
+    if ( res < 0 && _group_accept_transient(-res)
+         && ela_call_later(l->loop->ctx, &retry,
+                           _group_listen_retry, l) )
+        l->func(l->loop->ctx, -ENOMEM, l->priv);
+}
+
+/* Runs on the loop thread */
+static
+void _group_listen_start(struct ela_el *ctx, void *data)
+{
+    struct group_listener *l = data;
+    ela_error_t err;
+
+    err = ela_source_alloc(ctx, NULL, l, &l->source);
+    if ( !err )
+        err = ela_accept_multishot(ctx, l->source, l->fd, _group_accept_cb);
+    if ( !err )
+        err = ela_add(ctx, l->source);
+
+    if ( err )
+        l->func(ctx, -err, l->priv);
+}
+
+static int _group_socket(const struct sockaddr *addr, socklen_t addrlen,
+                         int *reuseport)
+{
+    int one = 1;
+    int fd = socket(addr->sa_family, SOCK_STREAM, 0);
+
+    if ( fd < 0 )
+        return -errno;
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+#ifdef SO_REUSEPORT
+    if ( *reuseport
+         && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) )
+        *reuseport = 0;
+#else
+    *reuseport = 0;
+#endif
+
+    if ( bind(fd, addr, addrlen) || listen(fd, SOMAXCONN) ) {
+        int err = errno;
+
+        close(fd);
+        return -err;
+    }
+
+    return fd;
+}
+
+ELA_EXPORT
+ela_error_t ela_group_listen(struct ela_group *group,
+                             struct sockaddr *addr,
+                             socklen_t addrlen,
+                             ela_group_accept_func *func,
+                             void *priv)
+{
+    struct group_listener **listeners;
+    int reuseport = 1;
+    ela_error_t err = 0;
+    unsigned int i;
+    int fd;
+
+    listeners = calloc(group->size, sizeof(*listeners));
+    if ( listeners == NULL )
+        return ENOMEM;
+
+    fd = _group_socket(addr, addrlen, &reuseport);
+    if ( fd < 0 ) {
+        free(listeners);
+        return -fd;
+    }
+
+    /* Other loops must bind to the port actually picked */
+    getsockname(fd, addr, &addrlen);
+
+    for ( i = 0; i < group->size; ++i ) {
+        struct group_listener *l = calloc(1, sizeof(*l));
+
+        if ( l == NULL ) {
+            err = ENOMEM;
+            break;
+        }
+        listeners[i] = l;
+
+        if ( i == 0 || !reuseport ) {
+            l->fd = fd;
+            l->owns_fd = i == 0;
+        } else {
+            l->fd = _group_socket(addr, addrlen, &reuseport);
+            l->owns_fd = 1;
+            if ( l->fd < 0 ) {
+                err = -l->fd;
+                break;
+            }
+        }
+
+        l->loop = &group->loops[i];
+        l->func = func;
+        l->priv = priv;
+    }
+
+    if ( err ) {
+        for ( i = 0; i < group->size && listeners[i]; ++i ) {
+            if ( listeners[i]->owns_fd && listeners[i]->fd >= 0 )
+                close(listeners[i]->fd);
+            free(listeners[i]);
+        }
+        if ( listeners[0] == NULL )
+            close(fd);
+        free(listeners);
+        return err;
+    }
+
+    /* Listeners belong to the group from now on, even if starting
+       them on their loop fails */
+    for ( i = 0; i < group->size; ++i ) {
+        struct group_listener *l = listeners[i];
+        ela_error_t e;
+
+        l->next = l->loop->listeners;
+        l->loop->listeners = l;
+
+        e = ela_post(l->loop->ctx, _group_listen_start, l);
+        if ( e && !err )
+            err = e;
+    }
+
+    free(listeners);
+    return err;
+}
+
+ELA_EXPORT
+struct ela_el *ela_group_pick(struct ela_group *group)
+{
+    struct group_loop *best = &group->loops[0];
+    unsigned long best_load = __atomic_load_n(&best->load, __ATOMIC_RELAXED);
+    unsigned int i;
+
+    for ( i = 1; i < group->size && best_load; ++i ) {
+        struct group_loop *loop = &group->loops[i];
+        unsigned long load = __atomic_load_n(&loop->load, __ATOMIC_RELAXED);
+
+        if ( load < best_load ) {
+            best = loop;
+            best_load = load;
+        }
+    }
+
+    __atomic_fetch_add(&best->load, 1, __ATOMIC_RELAXED);
+    return best->ctx;
+}
+
+ELA_EXPORT
+void ela_group_release(struct ela_group *group, struct ela_el *ctx)
+{
+    unsigned int i;
+
+    for ( i = 0; i < group->size; ++i )
+        if ( group->loops[i].ctx == ctx ) {
+            __atomic_fetch_sub(&group->loops[i].load, 1, __ATOMIC_RELAXED);
+            return;
+        }
+}
@@ -13,6 +13,9 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <stddef.h>
+#include <signal.h>
+#include <sys/time.h>
 #include <ela/ela.h>
 #include <ela/backend.h>
 #include <ela/libevent.h>
@@ -22,31 +25,232 @@
 #endif
 
 #include <event.h>
+#ifdef HAVE_EVENT2_WATCH_H
+# include <event2/watch.h>
+#endif
+
+#include "ela_completion.h"
+#include "ela_post.h"
+#include "ela_wheel.h"
+#include "ela_time.h"
+#include "ela_child.h"
+
+#define LIBEVENT_DEFAULT_TICK 1000000ULL
+
+/* No slack of its own, use the loop default */
+#define SLACK_DEFAULT UINT64_MAX
 
 struct libevent_mainloop
 {
     struct ela_el base;
     struct event_base *event;
     int auto_allocated;
+    struct ela_buffer_group *groups;
+    /** Coarse timeouts, a single libevent timer tracks the wheel */
+    struct ela_wheel wheel;
+    struct event wheel_event;
+    /** Default timeout slack, ns */
+    uint64_t slack;
+    struct ela_timeout_class *classes;
+    int exit;
+    /** Nesting level of ela_run() */
+    int running;
+    /** Loop time, read on first use in each iteration */
+    uint64_t now;
+    int now_valid;
+    struct ela_stats stats;
+    /** ela_post() queue, watched by post_event while running */
+    struct ela_post_queue post;
+    struct event post_event;
+    int post_watched;
+    /** Handlers called, and ela_run_once() wait limit */
+    unsigned int dispatched;
+    struct event limit_event;
+#ifdef HAVE_EVENT2_WATCH_H
+    /** Call ela_hook_add() hooks around the wait */
+    struct evwatch *prepare;
+    struct evwatch *check;
+#endif
 };
 
+/* Loop run by this thread, to tell ela_exit() callers apart */
+static __thread struct libevent_mainloop *_running_loop;
+
 struct ela_event_source
 {
     ela_handler_func *handler;
+    struct libevent_mainloop *ctx;
     struct event event;
     struct timeval timeout;
+    struct ela_wheel_node wheel_node;
+    uint64_t slack;
+    struct ela_timeout_class *cls;
+    /** Last ela_touch_timeout() time, 0 if none since arming */
+    uint64_t touched;
+    /** Absolute deadline from ela_set_deadline(), 0 if none */
+    uint64_t deadline_abs;
+    /** Next tick of a periodic timeout, and ticks missed before the
+        last one */
+    uint64_t period_next;
+    uint64_t overrun;
+    /** Timeout expiry kept while moving to another loop, 0 if none,
+        and whether the source was added */
+    uint64_t migrate_expiry;
+    int migrated;
+    /** Made ready by ela_activate(), not by libevent */
+    int activated;
+    /** Child watched through child_fd, a pidfd, or SIGCHLD if -1 */
+    pid_t pid;
+    int child_fd;
+    int child_status;
+    ela_error_t child_err;
+    int child_exited;
     void *priv;
     uint32_t flags;
+    ela_completion_func *completion;
+    int completion_op;
+    struct ela_buffer_group *group;
+};
+
+/*
+  Timeout classes map to libevent common timeouts, which keep events
+  sharing a duration in a FIFO rather than in the heap.
+ */
+struct ela_timeout_class
+{
+    struct ela_timeout_class *next;
+    uint64_t duration;
+    const struct timeval *common;
 };
 
+static void _ns_to_tv(uint64_t ns, struct timeval *tv)
+{
+    tv->tv_sec = ns / 1000000000ULL;
+    tv->tv_usec = (ns % 1000000000ULL + 999) / 1000;
+    if ( tv->tv_usec == 1000000 ) {
+        tv->tv_sec++;
+        tv->tv_usec = 0;
+    }
+}
+
+static uint64_t _duration(const struct ela_event_source *src)
+{
+    return src->cls ? src->cls->duration : ela_time_from_tv(&src->timeout);
+}
+
+/* Absolute deadline of the source timeout counting from start, slack
+   applied */
+static uint64_t _deadline(const struct ela_event_source *src, uint64_t start)
+{
+    uint64_t deadline = start + _duration(src);
+
+    if ( src->deadline_abs )
+        deadline = src->deadline_abs;
+    else if ( src->flags & ELA_EVENT_PERIODIC )
+        deadline = src->period_next;
+
+    return ela_time_coalesce(
+        deadline, src->slack == SLACK_DEFAULT ? src->ctx->slack : src->slack);
+}
+
+static void _remaining(const struct ela_event_source *src, uint64_t now,
+                       struct timeval *tv)
+{
+    uint64_t deadline = _deadline(src, now);
+
+    _ns_to_tv(deadline > now ? deadline - now : 0, tv);
+}
+
+static uint64_t _loop_now(struct libevent_mainloop *ctx)
+{
+    if ( !ctx->running )
+        return ela_time_now();
+
+    if ( !ctx->now_valid ) {
+        ctx->now = ela_time_now();
+        ctx->now_valid = 1;
+    }
+
+    return ctx->now;
+}
+
+static void _wheel_schedule(struct libevent_mainloop *ctx)
+{
+    uint64_t next, now;
+    struct timeval tv;
+
+    if ( ctx->wheel.count == 0 ) {
+        event_del(&ctx->wheel_event);
+        return;
+    }
+
+    next = ela_wheel_next(&ctx->wheel);
+    now = ela_time_now();
+
+    _ns_to_tv(next > now ? next - now : 0, &tv);
+    evtimer_add(&ctx->wheel_event, &tv);
+}
+
+static int _is_coarse(const struct ela_event_source *src)
+{
+    const uint32_t coarse = (ELA_EVENT_TIMEOUT|ELA_EVENT_COARSE);
+
+    return (src->flags & coarse) == coarse;
+}
+
+static
+void _ela_event_cb(int fd, short ev_flags, void *priv);
+static
+ela_error_t _ela_event_remove(struct ela_el *ctx_,
+                              struct ela_event_source *src);
+
 static ela_error_t _real_add(struct ela_event_source *src)
 {
-    const struct timeval *tv = &src->timeout;
+    struct libevent_mainloop *ctx = src->ctx;
+    struct timeval rel;
+    const struct timeval *tv = NULL;
+
+    src->touched = 0;
+
+    if ( (src->flags & (ELA_EVENT_TIMEOUT|ELA_EVENT_PERIODIC))
+         == (ELA_EVENT_TIMEOUT|ELA_EVENT_PERIODIC) ) {
+        /* Anchor periodic timeouts here */
+        src->period_next = ela_time_now() + _duration(src);
+        src->overrun = 0;
+    }
 
-    if ( ! (src->flags & ELA_EVENT_TIMEOUT) )
-        tv = NULL;
+    if ( _is_coarse(src) ) {
+        ela_wheel_add(&ctx->wheel, &src->wheel_node,
+                      _deadline(src, ela_time_now()));
+        _wheel_schedule(ctx);
+    } else {
+        if ( ela_wheel_node_armed(&src->wheel_node) ) {
+            ela_wheel_remove(&ctx->wheel, &src->wheel_node);
+            _wheel_schedule(ctx);
+        }
+
+        if ( src->cls ) {
+            tv = src->cls->common;
+        } else if ( src->flags & ELA_EVENT_TIMEOUT ) {
+            _remaining(src, ela_time_now(), &rel);
+            tv = &rel;
+        }
+    }
 
     event_del(&src->event);
+
+    if ( tv == NULL ) {
+        if ( !(src->flags & (ELA_EVENT_READABLE|ELA_EVENT_WRITABLE
+                             |ELA_EVENT_SIGNAL)) )
+            return 0;
+
+        /* Forget any previous timeout, libevent would restart it on
+           persistent events */
+        event_set(&src->event, event_get_fd(&src->event),
+                  event_get_events(&src->event), _ela_event_cb, src);
+        event_base_set(ctx->event, &src->event);
+    }
+
     int ev_err = event_add(&src->event, tv);
     if ( ev_err )
         return ECANCELED;
@@ -54,20 +258,267 @@ static ela_error_t _real_add(struct ela_event_source *src)
     return 0;
 }
 
+/*
+  Completion sources are emulated with one operation per readiness
+  event, libevent calls us again as long as the fd stays readable.
+ */
+static
+void _ela_event_complete(struct ela_event_source *src, int fd,
+                         uint32_t ela_flags)
+{
+    ssize_t res = -ETIMEDOUT;
+
+    if ( ela_flags & ELA_EVENT_READABLE ) {
+        res = ela_completion_emulate(src->completion_op, fd, src->group);
+
+        if ( res == -EAGAIN || res == -EWOULDBLOCK
+             || (res == -ECONNABORTED
+                 && src->completion_op == ELA_COMPLETION_ACCEPT) )
+            return;
+
+        if ( res < 0 || (res == 0 && src->completion_op == ELA_COMPLETION_RECV) )
+            event_del(&src->event);
+    }
+
+    src->completion(src, fd, res, src->group ? src->group->mem : NULL,
+                    src->priv);
+}
+
+/*
+  Expired timeout of a touched source: if the new deadline is not due
+  yet, arm it again for that one instead of firing.
+ */
+static int _timeout_requeue(struct ela_event_source *src, uint64_t now)
+{
+    uint64_t touched = src->touched;
+    uint64_t deadline;
+    struct timeval rel;
+
+    src->touched = 0;
+
+    if ( touched == 0 )
+        return 0;
+
+    deadline = _deadline(src, touched);
+    if ( deadline <= now )
+        return 0;
+
+    if ( _is_coarse(src) ) {
+        ela_wheel_add(&src->ctx->wheel, &src->wheel_node, deadline);
+    } else {
+        _ns_to_tv(deadline - now, &rel);
+        event_add(&src->event, &rel);
+    }
+
+    return 1;
+}
+
+/*
+  Next tick of a periodic timeout that just fired, either the very
+  next one (catch-up) or the first one in the future.
+ */
+static void _periodic_advance(struct ela_event_source *src, uint64_t now)
+{
+    uint64_t period = _duration(src);
+    uint64_t missed = 0;
+
+    if ( now > src->period_next && !(src->flags & ELA_EVENT_CATCHUP) )
+        missed = (now - src->period_next) / period;
+
+    src->overrun = missed;
+    src->period_next += (missed + 1) * period;
+}
+
+/*
+  Timeout bookkeeping for a source about to be dispatched, expired
+  tells whether the timeout fired.
+ */
+static void _timeout_dispatched(struct ela_event_source *src, int expired)
+{
+    struct libevent_mainloop *ctx = src->ctx;
+    struct timeval rel;
+
+    if ( src->flags & ELA_EVENT_ONCE ) {
+        /* Timeout-only events are persistent, see _ela_source_alloc() */
+        event_del(&src->event);
+        if ( ela_wheel_node_armed(&src->wheel_node) ) {
+            ela_wheel_remove(&ctx->wheel, &src->wheel_node);
+            _wheel_schedule(ctx);
+        }
+        return;
+    }
+
+    if ( !(src->flags & ELA_EVENT_TIMEOUT) )
+        return;
+
+    if ( src->deadline_abs ) {
+        /* Deadlines fire once and are never restarted */
+        if ( expired && _is_coarse(src) ) {
+            src->flags &= ~ELA_EVENT_TIMEOUT;
+        } else if ( expired ) {
+            src->flags &= ~ELA_EVENT_TIMEOUT;
+            _real_add(src);
+        } else if ( !_is_coarse(src) ) {
+            /* Undo libevent persistent timeout restart */
+            _remaining(src, _loop_now(ctx), &rel);
+            event_add(&src->event, &rel);
+        }
+        return;
+    }
+
+    if ( src->flags & ELA_EVENT_PERIODIC ) {
+        uint64_t now = _loop_now(ctx);
+
+        if ( expired )
+            _periodic_advance(src, now);
+
+        if ( _is_coarse(src) ) {
+            if ( expired ) {
+                ela_wheel_add(&ctx->wheel, &src->wheel_node,
+                              _deadline(src, now));
+                _wheel_schedule(ctx);
+            }
+        } else {
+            _remaining(src, now, &rel);
+            event_add(&src->event, &rel);
+        }
+        return;
+    }
+
+    if ( !expired ) {
+        /* Restart the timeout lazily, the fd stays registered */
+        src->touched = _loop_now(ctx);
+    } else if ( _is_coarse(src) ) {
+        ela_wheel_add(&ctx->wheel, &src->wheel_node,
+                      _deadline(src, ela_time_now()));
+        _wheel_schedule(ctx);
+    } else {
+        _real_add(src);
+    }
+}
+
+/* Stop watching for a child exit, leaving any timeout */
+static
+void _child_unwatch(struct ela_event_source *src)
+{
+    event_del(&src->event);
+    if ( src->child_fd >= 0 ) {
+        close(src->child_fd);
+        src->child_fd = -1;
+    }
+    src->flags &= ~(ELA_EVENT_READABLE|ELA_EVENT_SIGNAL);
+    event_set(&src->event, -1, 0, _ela_event_cb, src);
+    event_base_set(src->ctx->event, &src->event);
+}
+
+/* Whether the child is gone, reaping it if needed */
+static
+int _child_reap(struct ela_event_source *src)
+{
+    int ret;
+
+    if ( src->child_exited )
+        return 1;
+
+    ret = ela_child_reap(src->pid, &src->child_status);
+    if ( ret == 0 )
+        return 0;
+
+    src->child_err = ret < 0 ? -ret : 0;
+    src->child_exited = 1;
+    return 1;
+}
+
+static
+void _child_release(struct ela_event_source *src)
+{
+    if ( !(src->flags & ELA_EVENT_CHILD) )
+        return;
+
+    if ( !src->child_exited )
+        _child_unwatch(src);
+
+    src->flags &= ~ELA_EVENT_CHILD;
+    src->child_exited = 0;
+    src->pid = 0;
+}
+
 static
 void _ela_event_cb(int fd, short ev_flags, void *priv)
 {
     struct ela_event_source *src = priv;
+    int activated = src->activated;
     int ela_flags = 0;
 
+    src->activated = 0;
+
+    if ( (src->flags & ELA_EVENT_CHILD) && (ev_flags & (EV_READ|EV_SIGNAL)) ) {
+        /* Without pidfd, SIGCHLD may be for another child */
+        if ( !_child_reap(src) )
+            return;
+
+        /* A child exits only once */
+        _ela_event_remove(&src->ctx->base, src);
+        _child_unwatch(src);
+        ev_flags &= ~(EV_READ|EV_SIGNAL);
+        ela_flags |= ELA_EVENT_CHILD;
+        fd = -1;
+    }
+
+    if ( ev_flags == EV_TIMEOUT && !activated
+         && _timeout_requeue(src, ela_time_now()) )
+        return;
+
     if ( ev_flags & EV_READ ) ela_flags |= ELA_EVENT_READABLE;
     if ( ev_flags & EV_WRITE ) ela_flags |= ELA_EVENT_WRITABLE;
-    if ( ev_flags & EV_TIMEOUT ) ela_flags |= ELA_EVENT_TIMEOUT;
+    if ( ev_flags & EV_SIGNAL ) {
+        /* fd is the signal number here */
+        ela_flags |= ELA_EVENT_SIGNAL;
+        fd = -1;
+    }
+    if ( ev_flags & EV_TIMEOUT ) {
+        ela_flags |= ELA_EVENT_TIMEOUT;
+        src->ctx->stats.timeouts++;
+    }
 
-    if ( (src->flags & ELA_EVENT_TIMEOUT) && !(src->flags & ELA_EVENT_ONCE) )
-        _real_add(src);
+    _timeout_dispatched(src, ev_flags & EV_TIMEOUT);
+    src->ctx->dispatched++;
 
-    src->handler(src, fd, ela_flags, src->priv);
+    if ( src->completion )
+        _ela_event_complete(src, fd, ela_flags);
+    else
+        src->handler(src, fd, ela_flags, src->priv);
+}
+
+static
+void _ela_wheel_cb(int fd, short ev_flags, void *priv)
+{
+    struct libevent_mainloop *ctx = priv;
+    struct ela_wheel_node *node;
+
+    ela_wheel_advance(&ctx->wheel, ela_time_now());
+
+    /* One at a time, handlers may remove other expired sources */
+    while ( (node = ela_wheel_pop(&ctx->wheel)) ) {
+        struct ela_event_source *src = (struct ela_event_source *)
+            ((char *)node - offsetof(struct ela_event_source, wheel_node));
+
+        if ( _timeout_requeue(src, ela_time_now()) )
+            continue;
+
+        ctx->stats.timeouts++;
+        _timeout_dispatched(src, 1);
+        ctx->dispatched++;
+
+        if ( src->completion )
+            _ela_event_complete(src, event_get_fd(&src->event),
+                                ELA_EVENT_TIMEOUT);
+        else
+            src->handler(src, event_get_fd(&src->event),
+                         ELA_EVENT_TIMEOUT, src->priv);
+    }
+
+    _wheel_schedule(ctx);
 }
 
 static
@@ -80,24 +531,134 @@ ela_error_t _ela_event_set_fd(
     struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
     ela_error_t err = 0;
 
-    (void)ctx;
-
     int ev_flags = EV_PERSIST;
 
+    _child_release(src);
+
+    if ( ela_flags & ELA_EVENT_EDGE ) {
+#ifdef EV_ET
+        if ( !(event_base_get_features(ctx->event) & EV_FEATURE_ET) )
+            return ENOTSUP;
+        ev_flags |= EV_ET;
+#else
+        return ENOTSUP;
+#endif
+    }
+
     if ( ela_flags & ELA_EVENT_ONCE ) ev_flags &= ~EV_PERSIST;
     if ( ela_flags & ELA_EVENT_READABLE ) ev_flags |= EV_READ;
     if ( ela_flags & ELA_EVENT_WRITABLE ) ev_flags |= EV_WRITE;
 
     const uint32_t fd_flags
-        = (ELA_EVENT_ONCE|ELA_EVENT_READABLE|ELA_EVENT_WRITABLE);
+        = (ELA_EVENT_ONCE|ELA_EVENT_READABLE|ELA_EVENT_WRITABLE
+           |ELA_EVENT_EDGE);
 
-    src->flags = (src->flags & ~fd_flags) | (ela_flags & fd_flags);
+    src->flags = (src->flags & ~(fd_flags|ELA_EVENT_SIGNAL))
+        | (ela_flags & fd_flags);
 
     event_set(&src->event, fd, ev_flags, _ela_event_cb, src);
 
     return err;
 }
 
+static
+ela_error_t _ela_event_set_signal(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    int signo)
+{
+    const uint32_t fd_flags
+        = (ELA_EVENT_READABLE|ELA_EVENT_WRITABLE|ELA_EVENT_EDGE
+           |ELA_EVENT_SIGNAL);
+    short ev_flags = EV_SIGNAL;
+
+    if ( signo < 0 || signo >= NSIG || signo == SIGKILL || signo == SIGSTOP )
+        return EINVAL;
+
+    if ( src->completion )
+        return EINVAL;
+
+    _child_release(src);
+
+    if ( !(src->flags & ELA_EVENT_ONCE) )
+        ev_flags |= EV_PERSIST;
+
+    src->flags &= ~fd_flags;
+    if ( signo )
+        src->flags |= ELA_EVENT_SIGNAL;
+
+    /* Without a signal, only a timeout is left to watch */
+    event_set(&src->event, signo ? signo : -1, signo ? ev_flags : 0,
+              _ela_event_cb, src);
+
+    return 0;
+}
+
+static
+ela_error_t _ela_event_set_child(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    pid_t pid)
+{
+    const uint32_t fd_flags
+        = (ELA_EVENT_READABLE|ELA_EVENT_WRITABLE|ELA_EVENT_EDGE
+           |ELA_EVENT_SIGNAL);
+    int fd = -1;
+
+    if ( pid < 0 || src->completion )
+        return EINVAL;
+
+    if ( pid ) {
+        fd = ela_child_open(pid);
+        if ( fd < 0 && fd != -ENOSYS )
+            return -fd;
+    }
+
+    _child_release(src);
+    src->flags &= ~fd_flags;
+
+    if ( !pid ) {
+        event_set(&src->event, -1, 0, _ela_event_cb, src);
+        return 0;
+    }
+
+    src->pid = pid;
+    src->child_fd = fd;
+    src->child_status = 0;
+    src->child_err = 0;
+    src->flags |= ELA_EVENT_CHILD;
+
+    if ( fd >= 0 ) {
+        src->flags |= ELA_EVENT_READABLE;
+        event_set(&src->event, fd, EV_READ|EV_PERSIST, _ela_event_cb, src);
+    } else {
+        src->flags |= ELA_EVENT_SIGNAL;
+        event_set(&src->event, SIGCHLD, EV_SIGNAL|EV_PERSIST,
+                  _ela_event_cb, src);
+    }
+
+    return 0;
+}
+
+static
+ela_error_t _ela_event_child_status(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    int *status)
+{
+    if ( !(src->flags & ELA_EVENT_CHILD) )
+        return EINVAL;
+
+    if ( !src->child_exited )
+        return EAGAIN;
+
+    if ( src->child_err )
+        return src->child_err;
+
+    *status = src->child_status;
+    return 0;
+}
+
 static
 ela_error_t _ela_event_set_timeout(
     struct ela_el *ctx_,
@@ -107,10 +668,15 @@ ela_error_t _ela_event_set_timeout(
 {
     struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
 
-    const uint32_t timeout_flags = (ELA_EVENT_ONCE|ELA_EVENT_TIMEOUT);
+    const uint32_t timeout_flags
+        = (ELA_EVENT_ONCE|ELA_EVENT_TIMEOUT|ELA_EVENT_COARSE
+           |ELA_EVENT_PERIODIC|ELA_EVENT_CATCHUP);
 
     (void)ctx;
 
+    src->cls = NULL;
+    src->deadline_abs = 0;
+
     if ( tv != NULL ) {
         memcpy(&src->timeout, tv, sizeof(*tv));
         ela_flags |= ELA_EVENT_TIMEOUT;
@@ -123,15 +689,219 @@ ela_error_t _ela_event_set_timeout(
     return 0;
 }
 
+static
+ela_error_t _ela_event_timeout_class_create(
+    struct ela_el *ctx_,
+    const struct timeval *duration,
+    struct ela_timeout_class **ret)
+{
+    struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
+    struct ela_timeout_class *cls = malloc(sizeof(*cls));
+
+    if ( cls == NULL )
+        return ENOMEM;
+
+    cls->duration = ela_time_from_tv(duration);
+    cls->common = event_base_init_common_timeout(ctx->event, duration);
+    if ( cls->common == NULL ) {
+        free(cls);
+        return ENOMEM;
+    }
+
+    cls->next = ctx->classes;
+    ctx->classes = cls;
+
+    *ret = cls;
+    return 0;
+}
+
+static
+ela_error_t _ela_event_set_timeout_class(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    struct ela_timeout_class *cls,
+    uint32_t ela_flags)
+{
+    const uint32_t timeout_flags
+        = (ELA_EVENT_ONCE|ELA_EVENT_TIMEOUT|ELA_EVENT_COARSE
+           |ELA_EVENT_PERIODIC|ELA_EVENT_CATCHUP);
+
+    src->cls = cls;
+    src->deadline_abs = 0;
+
+    if ( cls != NULL )
+        src->flags = (src->flags & ~timeout_flags)
+            | ELA_EVENT_TIMEOUT | (ela_flags & ELA_EVENT_ONCE);
+    else
+        src->flags &= ~ELA_EVENT_TIMEOUT;
+
+    return 0;
+}
+
+static
+ela_error_t _ela_event_set_deadline(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    const struct timespec *deadline,
+    uint32_t ela_flags)
+{
+    const uint32_t timeout_flags
+        = (ELA_EVENT_ONCE|ELA_EVENT_TIMEOUT|ELA_EVENT_COARSE
+           |ELA_EVENT_PERIODIC|ELA_EVENT_CATCHUP);
+
+    src->cls = NULL;
+
+    if ( deadline != NULL ) {
+        src->deadline_abs = ela_time_from_ts(deadline);
+        /* 0 means no deadline */
+        if ( src->deadline_abs == 0 )
+            src->deadline_abs = 1;
+        ela_flags &= (ELA_EVENT_ONCE|ELA_EVENT_COARSE);
+        ela_flags |= ELA_EVENT_TIMEOUT;
+        src->flags = (src->flags & ~timeout_flags) | ela_flags;
+    } else {
+        src->deadline_abs = 0;
+        src->flags &= ~ELA_EVENT_TIMEOUT;
+    }
+
+    return 0;
+}
+
+static
+struct timespec _ela_event_now(struct ela_el *ctx_)
+{
+    struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
+
+    return ela_time_to_ts(_loop_now(ctx));
+}
+
+static
+ela_error_t _ela_event_set_completion(
+    struct libevent_mainloop *ctx,
+    struct ela_event_source *src,
+    int fd,
+    int op,
+    struct ela_buffer_group *group,
+    ela_completion_func *func)
+{
+    ela_error_t err = ela_completion_prepare(op, fd);
+
+    if ( err )
+        return err;
+
+    src->completion = func;
+    src->completion_op = op;
+    src->group = group;
+
+    return _ela_event_set_fd(&ctx->base, src, fd, ELA_EVENT_READABLE);
+}
+
+static
+ela_error_t _ela_event_recv_multishot(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    int fd,
+    uint16_t group_id,
+    ela_completion_func *func)
+{
+    struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
+    struct ela_buffer_group *group = ela_buffer_group_find(ctx->groups, group_id);
+
+    if ( group == NULL )
+        return ENOENT;
+
+    return _ela_event_set_completion(ctx, src, fd, ELA_COMPLETION_RECV,
+                                     group, func);
+}
+
+static
+ela_error_t _ela_event_accept_multishot(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    int fd,
+    ela_completion_func *func)
+{
+    struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
+
+    return _ela_event_set_completion(ctx, src, fd, ELA_COMPLETION_ACCEPT,
+                                     NULL, func);
+}
+
+static
+ela_error_t _ela_event_buffer_group_create(
+    struct ela_el *ctx_,
+    uint16_t id,
+    unsigned int count,
+    size_t size)
+{
+    struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
+    struct ela_buffer_group *group;
+
+    return ela_buffer_group_alloc(&ctx->groups, id, count, size, &group);
+}
+
+static
+ela_error_t _ela_event_set_timer_tick(
+    struct ela_el *ctx_,
+    const struct timeval *tick)
+{
+    struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
+    uint64_t tick_ns = ela_time_from_tv(tick);
+
+    if ( tick_ns == 0 )
+        return EINVAL;
+
+    if ( ctx->wheel.count )
+        return EBUSY;
+
+    ela_wheel_init(&ctx->wheel, tick_ns, ela_time_now());
+    return 0;
+}
+
+static
+ela_error_t _ela_event_set_timeout_slack(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    const struct timeval *slack)
+{
+    struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
+
+    if ( src == NULL )
+        ctx->slack = slack ? ela_time_from_tv(slack) : 0;
+    else
+        src->slack = slack ? ela_time_from_tv(slack) : SLACK_DEFAULT;
+
+    return 0;
+}
+
+static
+ela_error_t _ela_event_get_stats(
+    struct ela_el *ctx_,
+    struct ela_stats *stats)
+{
+    struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
+
+    *stats = ctx->stats;
+    return 0;
+}
+
 static
 ela_error_t _ela_event_remove(
     struct ela_el *ctx_,
     struct ela_event_source *src)
 {
     struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
-    (void)ctx;
 
-    event_del(&src->event);
+    /* event_set() forgets the base, libevent warns about deleting such
+       an event, and it cannot be pending anyway */
+    if ( event_get_base(&src->event) )
+        event_del(&src->event);
+    src->touched = 0;
+
+    if ( ela_wheel_node_armed(&src->wheel_node) ) {
+        ela_wheel_remove(&ctx->wheel, &src->wheel_node);
+        _wheel_schedule(ctx);
+    }
 
     return 0;
 }
@@ -142,33 +912,411 @@ ela_error_t _ela_event_add(
     struct ela_event_source *src)
 {
     struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
-    (void)ctx;
+    ela_error_t err;
 
     event_base_set(ctx->event, &src->event);
-    return _real_add(src);
+    err = _real_add(src);
+
+    /* SIGCHLD may have come before the event got added */
+    if ( !err && (src->flags & ELA_EVENT_CHILD)
+         && (src->flags & ELA_EVENT_SIGNAL) && _child_reap(src) )
+        event_active(&src->event, EV_SIGNAL, 1);
+
+    return err;
+}
+
+static
+ela_error_t _ela_event_touch_timeout(
+    struct ela_el *ctx_,
+    struct ela_event_source *src)
+{
+    struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
+    int armed;
+
+    if ( !ela_wheel_node_armed(&src->wheel_node)
+         && !event_pending(&src->event,
+                           EV_READ|EV_WRITE|EV_SIGNAL|EV_TIMEOUT, NULL) )
+        return ENOENT;
+
+    if ( src->deadline_abs || (src->flags & ELA_EVENT_PERIODIC) )
+        return EINVAL;
+
+    if ( _is_coarse(src) )
+        armed = ela_wheel_node_armed(&src->wheel_node);
+    else
+        armed = event_pending(&src->event, EV_TIMEOUT, NULL);
+
+    if ( !armed )
+        return _ela_event_add(ctx_, src);
+
+    src->touched = _loop_now(ctx);
+    return 0;
+}
+
+static
+ela_error_t _ela_event_activate(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    uint32_t mask)
+{
+    short ev_flags = 0;
+
+    if ( !ela_wheel_node_armed(&src->wheel_node)
+         && !event_pending(&src->event,
+                           EV_READ|EV_WRITE|EV_SIGNAL|EV_TIMEOUT, NULL) )
+        return ENOENT;
+
+    if ( src->completion )
+        return EINVAL;
+
+    if ( mask & ELA_EVENT_READABLE ) ev_flags |= EV_READ;
+    if ( mask & ELA_EVENT_WRITABLE ) ev_flags |= EV_WRITE;
+    if ( mask & ELA_EVENT_TIMEOUT ) ev_flags |= EV_TIMEOUT;
+
+    src->activated = 1;
+    event_active(&src->event, ev_flags, 1);
+    return 0;
+}
+
+static
+uint64_t _ela_event_timeout_overrun(
+    struct ela_el *ctx_,
+    struct ela_event_source *src)
+{
+    return src->overrun;
 }
 
 static
 void _ela_event_close(struct ela_el *ctx_)
 {
     struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
+#ifdef HAVE_EVENT2_WATCH_H
+    evwatch_free(ctx->prepare);
+    evwatch_free(ctx->check);
+#endif
+    event_del(&ctx->wheel_event);
+    if ( ctx->post_watched )
+        event_del(&ctx->post_event);
+    ela_post_queue_release(&ctx->post);
     if ( ctx->auto_allocated )
         event_base_free(ctx->event);
+    ela_buffer_group_free_all(&ctx->groups);
+    while ( ctx->classes ) {
+        struct ela_timeout_class *cls = ctx->classes;
+        ctx->classes = cls->next;
+        free(cls);
+    }
     free(ctx);
 }
 
+#ifdef HAVE_EVENT2_WATCH_H
+static
+void _ela_event_prepare_cb(struct evwatch *watcher,
+                           const struct evwatch_prepare_cb_info *info,
+                           void *data)
+{
+    struct libevent_mainloop *ctx = data;
+
+    ela_hooks_run(&ctx->base, ELA_HOOK_BEFORE_POLL);
+}
+
+static
+void _ela_event_check_cb(struct evwatch *watcher,
+                         const struct evwatch_check_cb_info *info,
+                         void *data)
+{
+    struct libevent_mainloop *ctx = data;
+
+    ela_hooks_run(&ctx->base, ELA_HOOK_AFTER_POLL);
+}
+#endif
+
+/* The post event alone must not keep the loop running */
+static int _has_events(struct libevent_mainloop *ctx)
+{
+    return event_base_get_num_events(
+        ctx->event, EVENT_BASE_COUNT_ADDED|EVENT_BASE_COUNT_VIRTUAL)
+        > ctx->post_watched;
+}
+
+static
+struct libevent_mainloop *_ela_event_enter(struct libevent_mainloop *ctx)
+{
+    struct libevent_mainloop *outer = _running_loop;
+
+    __atomic_add_fetch(&ctx->running, 1, __ATOMIC_RELEASE);
+    ctx->now_valid = 0;
+    _running_loop = ctx;
+
+    /* Posts are only watched while running, not to keep a base that
+       also gets dispatched elsewhere busy forever */
+    if ( !ctx->post_watched && ela_post_queue_fd(&ctx->post) >= 0 )
+        ctx->post_watched = !event_add(&ctx->post_event, NULL);
+
+    return outer;
+}
+
+static
+void _ela_event_leave(struct libevent_mainloop *ctx,
+                      struct libevent_mainloop *outer)
+{
+    _running_loop = outer;
+    __atomic_sub_fetch(&ctx->running, 1, __ATOMIC_RELEASE);
+
+    if ( !ctx->running && ctx->post_watched ) {
+        event_del(&ctx->post_event);
+        ctx->post_watched = 0;
+    }
+}
+
+/* One libevent iteration, 0 if the loop should go on */
+static
+int _ela_event_iterate(struct libevent_mainloop *ctx, int flags)
+{
+#ifndef HAVE_EVENT2_WATCH_H
+    /* No prepare/check watchers, stick to iteration boundaries */
+    ela_hooks_run(&ctx->base, ELA_HOOK_BEFORE_POLL);
+    if ( __atomic_load_n(&ctx->exit, __ATOMIC_ACQUIRE) )
+        return 1;
+#endif
+    if ( event_base_loop(ctx->event, flags) )
+        return 1;
+#ifndef HAVE_EVENT2_WATCH_H
+    ela_hooks_run(&ctx->base, ELA_HOOK_AFTER_POLL);
+#endif
+    ctx->stats.wakeups++;
+    ctx->now_valid = 0;
+    return 0;
+}
+
 static
 void _ela_event_run(struct ela_el *ctx_)
 {
     struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
-	event_base_dispatch(ctx->event);
+    struct libevent_mainloop *outer;
+
+    /* One iteration at a time, to count wakeups and refresh loop time */
+    __atomic_store_n(&ctx->exit, 0, __ATOMIC_RELAXED);
+    outer = _ela_event_enter(ctx);
+
+    while ( !__atomic_load_n(&ctx->exit, __ATOMIC_ACQUIRE)
+            && _has_events(ctx)
+            && !_ela_event_iterate(ctx, EVLOOP_ONCE) )
+        ;
+
+    _ela_event_leave(ctx, outer);
+}
+
+static
+void _ela_event_limit_cb(int fd, short ev_flags, void *priv)
+{
+    /* Only there to wake the loop up */
+}
+
+static
+int _ela_event_run_once(struct ela_el *ctx_,
+                        const struct timespec *deadline,
+                        int *done)
+{
+    struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
+    struct libevent_mainloop *outer;
+    unsigned int dispatched = ctx->dispatched;
+    int flags = EVLOOP_ONCE;
+    int stop;
+
+    if ( !_has_events(ctx) ) {
+        *done = 1;
+        __atomic_store_n(&ctx->exit, 0, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    if ( deadline ) {
+        uint64_t at = ela_time_from_ts(deadline), now = ela_time_now();
+        struct timeval tv;
+
+        if ( at <= now ) {
+            flags = EVLOOP_NONBLOCK;
+        } else {
+            tv.tv_sec = (at - now) / 1000000000ULL;
+            tv.tv_usec = (at - now) % 1000000000ULL / 1000;
+            evtimer_add(&ctx->limit_event, &tv);
+        }
+    }
+
+    outer = _ela_event_enter(ctx);
+    stop = _ela_event_iterate(ctx, flags);
+    _ela_event_leave(ctx, outer);
+
+    evtimer_del(&ctx->limit_event);
+
+    /* An exit only ends the step it came in */
+    *done = __atomic_exchange_n(&ctx->exit, 0, __ATOMIC_ACQ_REL)
+        || stop || !_has_events(ctx);
+
+    return ctx->dispatched - dispatched;
 }
 
 static
 void _ela_event_exit(struct ela_el *ctx_)
 {
     struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
-	event_base_loopbreak(ctx->event);
+
+    __atomic_store_n(&ctx->exit, 1, __ATOMIC_RELEASE);
+
+    /* Breaking a running ela_run() is only safe from its own thread,
+       others wake it up. A base dispatched by the application gets
+       broken as it always did. */
+    if ( _running_loop == ctx
+         || !__atomic_load_n(&ctx->running, __ATOMIC_ACQUIRE) )
+        event_base_loopbreak(ctx->event);
+    else
+        ela_post_queue_wake(&ctx->post);
+}
+
+static
+void _ela_event_post_cb(int fd, short what, void *arg)
+{
+    struct libevent_mainloop *ctx = arg;
+
+    ela_post_queue_drain(&ctx->post, &ctx->base);
+}
+
+static
+ela_error_t _ela_event_post(
+    struct ela_el *ctx_,
+    ela_post_func *func,
+    void *data)
+{
+    struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
+
+    return ela_post_queue_push(&ctx->post, func, data);
+}
+
+static
+ela_error_t _ela_source_detach(
+    struct ela_el *ctx_,
+    struct ela_event_source *src)
+{
+    struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
+    struct timeval tv, wall;
+    uint64_t expiry = 0;
+
+    /* Classes and buffer groups belong to the loop */
+    if ( src->cls || src->completion )
+        return EINVAL;
+
+    if ( ela_wheel_node_armed(&src->wheel_node) ) {
+        expiry = ela_wheel_node_deadline(&ctx->wheel, &src->wheel_node);
+    } else if ( event_pending(&src->event, EV_TIMEOUT, &tv) ) {
+        /* libevent reports expiry on the wall clock */
+        uint64_t at = ela_time_from_tv(&tv), now;
+
+        gettimeofday(&wall, NULL);
+        now = ela_time_from_tv(&wall);
+        expiry = ela_time_now() + (at > now ? at - now : 0);
+    } else if ( !event_pending(&src->event, EV_READ|EV_WRITE|EV_SIGNAL,
+                               NULL) ) {
+        return 0;
+    }
+
+    if ( src->touched )
+        expiry = _deadline(src, src->touched);
+
+    _ela_event_remove(ctx_, src);
+
+    src->migrate_expiry = expiry;
+    src->migrated = 1;
+    return 0;
+}
+
+static
+ela_error_t _ela_source_attach(
+    struct ela_el *ctx_,
+    struct ela_event_source *src)
+{
+    struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
+    uint64_t period_next = src->period_next;
+    uint64_t overrun = src->overrun;
+    uint64_t expiry = src->migrate_expiry;
+    struct timeval rel;
+    uint64_t now;
+    ela_error_t err;
+
+    src->ctx = ctx;
+    event_base_set(ctx->event, &src->event);
+
+    if ( !src->migrated )
+        return 0;
+
+    src->migrated = 0;
+    src->migrate_expiry = 0;
+
+    err = _real_add(src);
+    if ( err || !(src->flags & ELA_EVENT_TIMEOUT) || src->deadline_abs )
+        return err;
+
+    /* Keep the timeout running where it was, rather than restart it */
+    if ( src->flags & ELA_EVENT_PERIODIC ) {
+        src->period_next = period_next;
+        src->overrun = overrun;
+        expiry = period_next;
+    }
+
+    if ( expiry == 0 )
+        return 0;
+
+    if ( _is_coarse(src) ) {
+        ela_wheel_add(&ctx->wheel, &src->wheel_node, expiry);
+        _wheel_schedule(ctx);
+        return 0;
+    }
+
+    now = ela_time_now();
+    _ns_to_tv(expiry > now ? expiry - now : 0, &rel);
+    if ( event_add(&src->event, &rel) )
+        return ECANCELED;
+
+    return 0;
+}
+
+static
+size_t _ela_source_size(struct ela_el *ctx_)
+{
+    return sizeof(struct ela_event_source);
+}
+
+static
+ela_error_t _ela_source_init(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    ela_handler_func *func,
+    void *priv)
+{
+    struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
+
+    src->priv = priv;
+    src->handler = func;
+    src->ctx = ctx;
+    src->slack = SLACK_DEFAULT;
+    src->cls = NULL;
+    src->touched = 0;
+    src->deadline_abs = 0;
+    src->period_next = 0;
+    src->overrun = 0;
+    src->migrate_expiry = 0;
+    src->migrated = 0;
+    src->activated = 0;
+    src->pid = 0;
+    src->child_fd = -1;
+    src->child_exited = 0;
+    ela_wheel_node_init(&src->wheel_node);
+    src->flags = 0;
+    src->completion = NULL;
+    src->group = NULL;
+    event_set(&src->event, -1, EV_PERSIST, _ela_event_cb, src);
+    event_base_set(ctx->event, &src->event);
+
+    return 0;
 }
 
 static
@@ -178,28 +1326,32 @@ ela_error_t _ela_source_alloc(
     void *priv,
     struct ela_event_source **source)
 {
-    struct libevent_mainloop *ctx = (struct libevent_mainloop *)ctx_;
     struct ela_event_source *src = malloc(sizeof(*src));
 
     if ( src == NULL )
         return ENOMEM;
 
-    src->priv = priv;
-    src->handler = func;
-    src->flags = 0;
-    event_set(&src->event, -1, EV_PERSIST, _ela_event_cb, src);
-    event_base_set(ctx->event, &src->event);
+    _ela_source_init(ctx_, src, func, priv);
 
     *source = src;
     return 0;
 }
 
 static
-void _ela_source_free(
+void _ela_source_cleanup(
     struct ela_el *ctx_,
     struct ela_event_source *src)
 {
     _ela_event_remove(ctx_, src);
+    _child_release(src);
+}
+
+static
+void _ela_source_free(
+    struct ela_el *ctx_,
+    struct ela_event_source *src)
+{
+    _ela_source_cleanup(ctx_, src);
     free(src);
 }
 
@@ -226,6 +1378,29 @@ static const struct ela_el_backend event_backend =
     .exit = _ela_event_exit,
     .name = "libevent",
     .create = _ela_event_create,
+    .buffer_group_create = _ela_event_buffer_group_create,
+    .recv_multishot = _ela_event_recv_multishot,
+    .accept_multishot = _ela_event_accept_multishot,
+    .set_timer_tick = _ela_event_set_timer_tick,
+    .set_timeout_slack = _ela_event_set_timeout_slack,
+    .get_stats = _ela_event_get_stats,
+    .timeout_class_create = _ela_event_timeout_class_create,
+    .set_timeout_class = _ela_event_set_timeout_class,
+    .touch_timeout = _ela_event_touch_timeout,
+    .set_deadline = _ela_event_set_deadline,
+    .now = _ela_event_now,
+    .timeout_overrun = _ela_event_timeout_overrun,
+    .source_size = _ela_source_size,
+    .source_init = _ela_source_init,
+    .source_cleanup = _ela_source_cleanup,
+    .post = _ela_event_post,
+    .source_detach = _ela_source_detach,
+    .source_attach = _ela_source_attach,
+    .activate = _ela_event_activate,
+    .set_signal = _ela_event_set_signal,
+    .set_child = _ela_event_set_child,
+    .child_status = _ela_event_child_status,
+    .run_once = _ela_event_run_once,
 };
 
 ELA_EXPORT
@@ -237,7 +1412,34 @@ struct ela_el *ela_libevent(struct event_base *event)
 
     m->event = event;
     m->base.backend = &event_backend;
+    m->base.allocator = NULL;
+    m->base.shared = NULL;
+    m->base.hooks = NULL;
+    m->base.defer = NULL;
     m->auto_allocated = 0;
+    m->groups = NULL;
+    m->slack = 0;
+    m->classes = NULL;
+    m->running = 0;
+    m->now_valid = 0;
+    m->exit = 0;
+    memset(&m->stats, 0, sizeof(m->stats));
+
+    m->post_watched = 0;
+    m->dispatched = 0;
+    evtimer_set(&m->limit_event, _ela_event_limit_cb, m);
+    event_base_set(event, &m->limit_event);
+    ela_post_queue_init(&m->post);
+    event_set(&m->post_event, ela_post_queue_fd(&m->post),
+              EV_READ|EV_PERSIST, _ela_event_post_cb, m);
+    event_base_set(event, &m->post_event);
+    ela_wheel_init(&m->wheel, LIBEVENT_DEFAULT_TICK, ela_time_now());
+    evtimer_set(&m->wheel_event, _ela_wheel_cb, m);
+    event_base_set(event, &m->wheel_event);
+#ifdef HAVE_EVENT2_WATCH_H
+    m->prepare = evwatch_prepare_new(event, _ela_event_prepare_cb, m);
+    m->check = evwatch_check_new(event, _ela_event_check_cb, m);
+#endif
     return &m->base;
 }
 
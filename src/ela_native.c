@@ -0,0 +1,2100 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <ela/ela.h>
+#include <ela/backend.h>
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "ela_native.h"
+#include "ela_shared.h"
+#include "ela_child.h"
+
+#define TIMER_NONE ((size_t)-1)
+
+/* Emulated completions performed per readiness event */
+#define COMPLETION_BUDGET 16
+
+/* Internal source state */
+#define SOURCE_ADDED 1
+#define SOURCE_FD_LINKED 2
+#define SOURCE_READY 4
+/* Handler running on a thread of a shared loop */
+#define SOURCE_BUSY 8
+/* Detached while added, see ela_native_source_detach() */
+#define SOURCE_MIGRATED 16
+#define SOURCE_SIG_LINKED 32
+/* Watched child got reaped, see ela_native_child_status() */
+#define SOURCE_CHILD_EXITED 64
+
+/* Busy poll spin never shrinks below this, in ns */
+#define BUSY_SPIN_MIN 1000ULL
+
+/* Signals read from the signalfd at once */
+#define SIGNAL_BATCH 16
+
+/* A handler running on a thread of a shared loop */
+struct native_dispatch
+{
+    struct native_dispatch *next;
+    struct ela_event_source *src;
+    /** Source got released meanwhile, its thread leaves it alone once
+        the handler returns, and releases storage if left to it */
+    int released;
+    void (*release)(struct ela_el *ctx, void *mem);
+};
+
+/* Handler this thread runs */
+static __thread struct native_dispatch *_dispatch;
+
+struct ela_event_source
+{
+    ela_handler_func *handler;
+    void *priv;
+    uint32_t flags;
+    uint32_t state;
+
+    int fd;
+    struct ela_event_source *fd_prev;
+    struct ela_event_source *fd_next;
+
+    int signo;
+    struct ela_event_source *sig_prev;
+    struct ela_event_source *sig_next;
+
+    /** Child watched through the pidfd in fd, or SIGCHLD without one */
+    pid_t pid;
+    int child_status;
+    ela_error_t child_err;
+
+    struct timeval timeout;
+    uint64_t deadline;
+    size_t timer_index;
+    struct ela_wheel_node wheel_node;
+    uint64_t slack;
+    struct ela_timeout_class *cls;
+    /** Class FIFO the source is armed in, if any */
+    struct ela_timeout_class *cls_queue;
+    struct ela_event_source *cls_prev;
+    struct ela_event_source *cls_next;
+    /** Last ela_touch_timeout() time, 0 if none since arming */
+    uint64_t touched;
+    /** Absolute deadline from ela_set_deadline(), 0 if none */
+    uint64_t deadline_abs;
+    /** Next tick of a periodic timeout, and ticks missed before the
+        last one */
+    uint64_t period_next;
+    uint64_t overrun;
+    /** Timeout expiry kept while moving to another loop, 0 if none */
+    uint64_t migrate_expiry;
+
+    uint32_t ready_mask;
+    /** Loop ready_gen when the source got ready */
+    uint32_t ready_gen;
+    struct ela_event_source *ready_prev;
+    struct ela_event_source *ready_next;
+
+    ela_completion_func *completion;
+    int completion_op;
+    struct ela_buffer_group *group;
+    /** Poller operation, when the completion source runs natively */
+    void *completion_token;
+};
+
+/* No slack of its own, use the loop default */
+#define SLACK_DEFAULT UINT64_MAX
+
+struct ela_timeout_class
+{
+    struct ela_timeout_class *next;
+    uint64_t duration;
+    /** Armed sources, in expiry order */
+    struct ela_event_source *head;
+    struct ela_event_source *tail;
+};
+
+uint64_t ela_native_now(void)
+{
+    return ela_time_now();
+}
+
+/*
+  Timer heap
+ */
+
+static void _timer_swap(struct native_loop *ctx, size_t a, size_t b)
+{
+    struct ela_event_source *tmp = ctx->timers[a];
+
+    ctx->timers[a] = ctx->timers[b];
+    ctx->timers[b] = tmp;
+    ctx->timers[a]->timer_index = a;
+    ctx->timers[b]->timer_index = b;
+}
+
+static void _timer_sift_up(struct native_loop *ctx, size_t i)
+{
+    while ( i > 0 ) {
+        size_t parent = (i - 1) / 2;
+
+        if ( ctx->timers[parent]->deadline <= ctx->timers[i]->deadline )
+            break;
+
+        _timer_swap(ctx, i, parent);
+        i = parent;
+    }
+}
+
+static void _timer_sift_down(struct native_loop *ctx, size_t i)
+{
+    for (;;) {
+        size_t l = 2 * i + 1, r = l + 1, min = i;
+
+        if ( l < ctx->timer_count
+             && ctx->timers[l]->deadline < ctx->timers[min]->deadline )
+            min = l;
+        if ( r < ctx->timer_count
+             && ctx->timers[r]->deadline < ctx->timers[min]->deadline )
+            min = r;
+        if ( min == i )
+            break;
+
+        _timer_swap(ctx, i, min);
+        i = min;
+    }
+}
+
+static void _timer_remove(struct native_loop *ctx,
+                          struct ela_event_source *src)
+{
+    size_t i = src->timer_index;
+
+    if ( i == TIMER_NONE )
+        return;
+
+    src->timer_index = TIMER_NONE;
+    ctx->timer_count--;
+
+    if ( i == ctx->timer_count )
+        return;
+
+    ctx->timers[i] = ctx->timers[ctx->timer_count];
+    ctx->timers[i]->timer_index = i;
+    _timer_sift_up(ctx, i);
+    _timer_sift_down(ctx, ctx->timers[i]->timer_index);
+}
+
+static ela_error_t _timer_set(struct native_loop *ctx,
+                              struct ela_event_source *src,
+                              uint64_t deadline)
+{
+    if ( src->timer_index != TIMER_NONE ) {
+        uint64_t old = src->deadline;
+
+        src->deadline = deadline;
+        if ( deadline < old )
+            _timer_sift_up(ctx, src->timer_index);
+        else
+            _timer_sift_down(ctx, src->timer_index);
+        return 0;
+    }
+
+    if ( ctx->timer_count == ctx->timer_size ) {
+        size_t size = ctx->timer_size ? ctx->timer_size * 2 : 16;
+        struct ela_event_source **timers
+            = realloc(ctx->timers, size * sizeof(*timers));
+
+        if ( timers == NULL )
+            return ENOMEM;
+
+        ctx->timers = timers;
+        ctx->timer_size = size;
+    }
+
+    src->deadline = deadline;
+    src->timer_index = ctx->timer_count++;
+    ctx->timers[src->timer_index] = src;
+    _timer_sift_up(ctx, src->timer_index);
+
+    return 0;
+}
+
+/*
+  Timeout classes: all sources of a class share the same duration, so
+  appending at the tail mostly keeps the FIFO ordered by deadline.
+  Touched sources get queued again counting from their touch time,
+  possibly ahead of sources armed since, they are inserted in order.
+ */
+
+static void _cls_unlink(struct ela_event_source *src)
+{
+    struct ela_timeout_class *cls = src->cls_queue;
+
+    if ( cls == NULL )
+        return;
+
+    if ( src->cls_prev )
+        src->cls_prev->cls_next = src->cls_next;
+    else
+        cls->head = src->cls_next;
+
+    if ( src->cls_next )
+        src->cls_next->cls_prev = src->cls_prev;
+    else
+        cls->tail = src->cls_prev;
+
+    src->cls_queue = NULL;
+}
+
+static void _cls_append(struct ela_event_source *src, uint64_t now)
+{
+    struct ela_timeout_class *cls = src->cls;
+    struct ela_event_source *prev;
+
+    _cls_unlink(src);
+
+    src->deadline = now + cls->duration;
+
+    prev = cls->tail;
+    while ( prev && prev->deadline > src->deadline )
+        prev = prev->cls_prev;
+
+    src->cls_prev = prev;
+    src->cls_next = prev ? prev->cls_next : cls->head;
+    if ( src->cls_next )
+        src->cls_next->cls_prev = src;
+    else
+        cls->tail = src;
+    if ( prev )
+        prev->cls_next = src;
+    else
+        cls->head = src;
+    src->cls_queue = cls;
+}
+
+ela_error_t ela_native_timeout_class_create(
+    struct ela_el *ctx_,
+    const struct timeval *duration,
+    struct ela_timeout_class **ret)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+    struct ela_timeout_class *cls = calloc(1, sizeof(*cls));
+
+    if ( cls == NULL )
+        return ENOMEM;
+
+    cls->duration = ela_time_from_tv(duration);
+    cls->next = ctx->classes;
+    ctx->classes = cls;
+
+    *ret = cls;
+    return 0;
+}
+
+/*
+  Timeouts: class ones in their FIFO, exact ones in the heap, coarse
+  ones in the wheel
+ */
+
+static uint64_t _timeout_duration(const struct ela_event_source *src)
+{
+    return src->cls ? src->cls->duration : ela_time_from_tv(&src->timeout);
+}
+
+/* Arm the source timeout, counting from start */
+static ela_error_t _timeout_arm(struct native_loop *ctx,
+                                struct ela_event_source *src,
+                                uint64_t start)
+{
+    src->touched = 0;
+
+    if ( src->cls ) {
+        _timer_remove(ctx, src);
+        ela_wheel_remove(&ctx->wheel, &src->wheel_node);
+        _cls_append(src, start);
+        return 0;
+    }
+
+    uint64_t deadline = start + _timeout_duration(src);
+
+    if ( src->deadline_abs )
+        deadline = src->deadline_abs;
+    else if ( src->flags & ELA_EVENT_PERIODIC )
+        deadline = src->period_next;
+
+    deadline = ela_time_coalesce(
+        deadline, src->slack == SLACK_DEFAULT ? ctx->slack : src->slack);
+
+    if ( src->flags & ELA_EVENT_COARSE ) {
+        _cls_unlink(src);
+        _timer_remove(ctx, src);
+        ela_wheel_add(&ctx->wheel, &src->wheel_node, deadline);
+        return 0;
+    }
+
+    _cls_unlink(src);
+    ela_wheel_remove(&ctx->wheel, &src->wheel_node);
+    return _timer_set(ctx, src, deadline);
+}
+
+static void _timeout_disarm(struct native_loop *ctx,
+                            struct ela_event_source *src)
+{
+    src->touched = 0;
+    _cls_unlink(src);
+    _timer_remove(ctx, src);
+    ela_wheel_remove(&ctx->wheel, &src->wheel_node);
+}
+
+static int _timeout_armed(const struct ela_event_source *src)
+{
+    return src->timer_index != TIMER_NONE || src->cls_queue
+        || ela_wheel_node_armed(&src->wheel_node);
+}
+
+/*
+  Called with a source whose timeout just got unqueued as expired.
+  If it got touched meanwhile and is not due yet, queue it again for
+  the new deadline rather than firing.
+ */
+static int _timeout_requeue(struct native_loop *ctx,
+                            struct ela_event_source *src,
+                            uint64_t now)
+{
+    uint64_t touched = src->touched;
+
+    if ( touched == 0 || touched + _timeout_duration(src) <= now ) {
+        src->touched = 0;
+        return 0;
+    }
+
+    _timeout_arm(ctx, src, touched);
+    return 1;
+}
+
+ela_error_t ela_native_touch_timeout(
+    struct ela_el *ctx_,
+    struct ela_event_source *src)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+
+    if ( !(src->state & SOURCE_ADDED) )
+        return ENOENT;
+
+    if ( src->deadline_abs || (src->flags & ELA_EVENT_PERIODIC) )
+        return EINVAL;
+
+    if ( !_timeout_armed(src) )
+        return ela_native_add(ctx_, src);
+
+    src->touched = ela_native_loop_now(ctx);
+    return 0;
+}
+
+/*
+  Next tick of a periodic timeout that just fired, either the very
+  next one (catch-up) or the first one in the future.
+ */
+static void _periodic_advance(struct native_loop *ctx,
+                              struct ela_event_source *src)
+{
+    uint64_t period = _timeout_duration(src);
+    uint64_t missed = 0;
+
+    if ( ctx->now > src->period_next && !(src->flags & ELA_EVENT_CATCHUP) )
+        missed = (ctx->now - src->period_next) / period;
+
+    src->overrun = missed;
+    src->period_next += (missed + 1) * period;
+    _timeout_arm(ctx, src, ctx->now);
+}
+
+uint64_t ela_native_timeout_overrun(
+    struct ela_el *ctx_,
+    struct ela_event_source *src)
+{
+    return src->overrun;
+}
+
+uint64_t ela_native_loop_now(struct native_loop *ctx)
+{
+    return ctx->running ? ctx->now : ela_native_now();
+}
+
+struct timespec ela_native_get_now(struct ela_el *ctx_)
+{
+    return ela_time_to_ts(ela_native_loop_now((struct native_loop *)ctx_));
+}
+
+ela_error_t ela_native_set_timeout_slack(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    const struct timeval *slack)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+
+    if ( src == NULL )
+        ctx->slack = slack ? ela_time_from_tv(slack) : 0;
+    else
+        src->slack = slack ? ela_time_from_tv(slack) : SLACK_DEFAULT;
+
+    return 0;
+}
+
+ela_error_t ela_native_get_stats(
+    struct ela_el *ctx_,
+    struct ela_stats *stats)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+
+    *stats = ctx->stats;
+    return 0;
+}
+
+ela_error_t ela_native_set_timer_tick(
+    struct ela_el *ctx_,
+    const struct timeval *tick)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+    uint64_t tick_ns = ela_time_from_tv(tick);
+
+    if ( tick_ns == 0 )
+        return EINVAL;
+
+    if ( ctx->wheel.count )
+        return EBUSY;
+
+    ela_wheel_init(&ctx->wheel, tick_ns, ela_native_now());
+    return 0;
+}
+
+/*
+  Ready list
+ */
+
+static void _ready_push(struct native_loop *ctx,
+                        struct ela_event_source *src,
+                        uint32_t mask)
+{
+    src->ready_mask |= mask;
+
+    if ( src->state & SOURCE_READY )
+        return;
+
+    src->state |= SOURCE_READY;
+    src->ready_gen = ctx->ready_gen;
+    src->ready_next = NULL;
+    src->ready_prev = ctx->ready_tail;
+    if ( ctx->ready_tail )
+        ctx->ready_tail->ready_next = src;
+    else
+        ctx->ready_head = src;
+    ctx->ready_tail = src;
+}
+
+static void _ready_remove(struct native_loop *ctx,
+                          struct ela_event_source *src)
+{
+    if ( !(src->state & SOURCE_READY) )
+        return;
+
+    if ( src->ready_prev )
+        src->ready_prev->ready_next = src->ready_next;
+    else
+        ctx->ready_head = src->ready_next;
+
+    if ( src->ready_next )
+        src->ready_next->ready_prev = src->ready_prev;
+    else
+        ctx->ready_tail = src->ready_prev;
+
+    src->state &= ~SOURCE_READY;
+    src->ready_mask = 0;
+}
+
+/*
+  Per-fd interest state
+ */
+
+/* Interest the poller should have for fd */
+static uint32_t _fd_events(struct native_loop *ctx, int fd)
+{
+    const struct ela_event_source *src;
+    uint32_t events = 0;
+    uint32_t edge = ELA_EVENT_EDGE;
+
+    /* Busy sources are one-shot until their handler returns */
+    for ( src = ctx->fds[fd].sources; src; src = src->fd_next ) {
+        if ( src->state & SOURCE_BUSY )
+            continue;
+        events |= src->flags & (ELA_EVENT_READABLE|ELA_EVENT_WRITABLE);
+        edge &= src->flags;
+    }
+
+    /* Edge-triggered only if all sources agree */
+    if ( events )
+        events |= edge;
+
+    return events;
+}
+
+static ela_error_t _fd_apply(struct native_loop *ctx, int fd,
+                             uint32_t events)
+{
+    struct native_fd *entry = &ctx->fds[fd];
+    ela_error_t err;
+
+    if ( events == entry->events )
+        return 0;
+
+    err = ctx->poller->fd_update(ctx, fd, events);
+    if ( err )
+        return err;
+
+    entry->events = events;
+    return 0;
+}
+
+/*
+  Interest changes on an fd the poller already watches go to the
+  changelist, merged per fd, and only reach the poller right before
+  it blocks: turning write interest on and off again within an
+  iteration costs nothing. Watching a new fd goes through at once so
+  that errors are reported, and so does dropping one, as the fd may
+  be closed and reused right after. Shared loops apply everything at
+  once, busy sources must stop being reported to other threads.
+ */
+static ela_error_t _fd_sync(struct native_loop *ctx, int fd)
+{
+    struct native_fd *entry = &ctx->fds[fd];
+    uint32_t events = _fd_events(ctx, fd);
+
+    if ( entry->events == 0 || events == 0 || ctx->base.shared )
+        return _fd_apply(ctx, fd, events);
+
+    if ( entry->changed )
+        return 0;
+
+    if ( ctx->change_count == ctx->change_size ) {
+        size_t size = ctx->change_size ? ctx->change_size * 2 : 64;
+        int *changes = realloc(ctx->changes, size * sizeof(*changes));
+
+        if ( changes == NULL )
+            return _fd_apply(ctx, fd, events);
+
+        ctx->changes = changes;
+        ctx->change_size = size;
+    }
+
+    ctx->changes[ctx->change_count++] = fd;
+    entry->changed = 1;
+    return 0;
+}
+
+/* Push the changelist to the poller */
+static void _fd_flush(struct native_loop *ctx)
+{
+    size_t i;
+
+    for ( i = 0; i < ctx->change_count; ++i ) {
+        int fd = ctx->changes[i];
+
+        ctx->fds[fd].changed = 0;
+        _fd_apply(ctx, fd, _fd_events(ctx, fd));
+    }
+
+    ctx->change_count = 0;
+}
+
+static ela_error_t _fd_reserve(struct native_loop *ctx, int fd)
+{
+    size_t size;
+    struct native_fd *fds;
+
+    if ( (size_t)fd < ctx->fd_size )
+        return 0;
+
+    size = ctx->fd_size ? ctx->fd_size : 64;
+    while ( size <= (size_t)fd )
+        size *= 2;
+
+    fds = realloc(ctx->fds, size * sizeof(*fds));
+    if ( fds == NULL )
+        return ENOMEM;
+
+    memset(fds + ctx->fd_size, 0, (size - ctx->fd_size) * sizeof(*fds));
+    ctx->fds = fds;
+    ctx->fd_size = size;
+
+    return 0;
+}
+
+static void _fd_unlink(struct native_loop *ctx,
+                       struct ela_event_source *src)
+{
+    struct native_fd *entry;
+
+    if ( !(src->state & SOURCE_FD_LINKED) )
+        return;
+
+    entry = &ctx->fds[src->fd];
+
+    if ( src->fd_prev )
+        src->fd_prev->fd_next = src->fd_next;
+    else
+        entry->sources = src->fd_next;
+    if ( src->fd_next )
+        src->fd_next->fd_prev = src->fd_prev;
+
+    src->state &= ~SOURCE_FD_LINKED;
+    _fd_sync(ctx, src->fd);
+}
+
+/* Best effort, fd may not even be a socket */
+static void _busy_poll_socket(struct native_loop *ctx, int fd)
+{
+    int usec = (int)(ctx->busy_max / 1000);
+    int one = 1;
+
+    setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+#ifdef SO_PREFER_BUSY_POLL
+    setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one));
+#else
+    (void)one;
+#endif
+}
+
+static ela_error_t _fd_link(struct native_loop *ctx,
+                            struct ela_event_source *src)
+{
+    struct native_fd *entry;
+    ela_error_t err;
+
+    err = _fd_reserve(ctx, src->fd);
+    if ( err )
+        return err;
+
+    entry = &ctx->fds[src->fd];
+
+    if ( !entry->sources && (ctx->busy_flags & ELA_BUSY_POLL_SOCKETS) )
+        _busy_poll_socket(ctx, src->fd);
+
+    if ( !(src->state & SOURCE_FD_LINKED) ) {
+        src->fd_prev = NULL;
+        src->fd_next = entry->sources;
+        if ( entry->sources )
+            entry->sources->fd_prev = src;
+        entry->sources = src;
+        src->state |= SOURCE_FD_LINKED;
+    }
+
+    err = _fd_sync(ctx, src->fd);
+    if ( err )
+        _fd_unlink(ctx, src);
+
+    return err;
+}
+
+/*
+  Signals: one signalfd per loop carries all the signals its sources
+  watch. Signals get blocked in the loop thread while watched, so
+  that they stay pending for the signalfd.
+ */
+
+static ela_error_t _sig_update(struct native_loop *ctx)
+{
+    int fd = signalfd(ctx->sig_fd, &ctx->sig_mask, SFD_NONBLOCK|SFD_CLOEXEC);
+    ela_error_t err;
+
+    if ( fd < 0 )
+        return errno;
+
+    if ( ctx->sig_fd >= 0 )
+        return 0;
+
+    err = _fd_reserve(ctx, fd);
+    if ( !err )
+        err = ctx->poller->fd_update(ctx, fd, ELA_EVENT_READABLE);
+    if ( err ) {
+        close(fd);
+        return err;
+    }
+
+    ctx->fds[fd].events = ELA_EVENT_READABLE;
+    ctx->sig_fd = fd;
+    return 0;
+}
+
+static void _sig_unblock(struct native_loop *ctx, int signo)
+{
+    sigset_t set;
+
+    if ( !sigismember(&ctx->sig_blocked, signo) )
+        return;
+
+    sigdelset(&ctx->sig_blocked, signo);
+    sigemptyset(&set);
+    sigaddset(&set, signo);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+}
+
+static void _sig_unlink(struct native_loop *ctx,
+                        struct ela_event_source *src)
+{
+    int signo = src->signo;
+
+    if ( !(src->state & SOURCE_SIG_LINKED) )
+        return;
+
+    if ( src->sig_prev )
+        src->sig_prev->sig_next = src->sig_next;
+    else
+        ctx->sig_sources[signo] = src->sig_next;
+    if ( src->sig_next )
+        src->sig_next->sig_prev = src->sig_prev;
+
+    src->state &= ~SOURCE_SIG_LINKED;
+
+    if ( ctx->sig_sources[signo] )
+        return;
+
+    sigdelset(&ctx->sig_mask, signo);
+    _sig_update(ctx);
+    _sig_unblock(ctx, signo);
+}
+
+static ela_error_t _sig_link(struct native_loop *ctx,
+                             struct ela_event_source *src)
+{
+    int signo = src->signo;
+    sigset_t set, old;
+    ela_error_t err;
+
+    if ( src->state & SOURCE_SIG_LINKED )
+        return 0;
+
+    if ( ctx->sig_sources[signo] == NULL ) {
+        sigemptyset(&set);
+        sigaddset(&set, signo);
+        pthread_sigmask(SIG_BLOCK, &set, &old);
+        if ( !sigismember(&old, signo) )
+            sigaddset(&ctx->sig_blocked, signo);
+
+        sigaddset(&ctx->sig_mask, signo);
+        err = _sig_update(ctx);
+        if ( err ) {
+            sigdelset(&ctx->sig_mask, signo);
+            _sig_unblock(ctx, signo);
+            return err;
+        }
+    }
+
+    src->sig_prev = NULL;
+    src->sig_next = ctx->sig_sources[signo];
+    if ( src->sig_next )
+        src->sig_next->sig_prev = src;
+    ctx->sig_sources[signo] = src;
+    src->state |= SOURCE_SIG_LINKED;
+
+    return 0;
+}
+
+/*
+  Children: a pidfd gets readable when its process exits. Without
+  pidfd support, every SIGCHLD may be the one of any watched child.
+ */
+
+static void _child_unwatch(struct native_loop *ctx,
+                           struct ela_event_source *src)
+{
+    if ( src->fd >= 0 ) {
+        _fd_unlink(ctx, src);
+        close(src->fd);
+        src->fd = -1;
+    }
+    _sig_unlink(ctx, src);
+    src->signo = 0;
+    src->flags &= ~(ELA_EVENT_READABLE|ELA_EVENT_SIGNAL);
+}
+
+/* Reaps the child, its source gets ready once it is gone */
+static void _child_check(struct native_loop *ctx,
+                         struct ela_event_source *src)
+{
+    int ret;
+
+    if ( src->state & SOURCE_CHILD_EXITED )
+        return;
+
+    ret = ela_child_reap(src->pid, &src->child_status);
+    if ( ret == 0 )
+        return;
+
+    src->child_err = ret < 0 ? -ret : 0;
+    src->state |= SOURCE_CHILD_EXITED;
+    _child_unwatch(ctx, src);
+    _ready_push(ctx, src, ELA_EVENT_CHILD);
+}
+
+static void _child_release(struct native_loop *ctx,
+                           struct ela_event_source *src)
+{
+    if ( !(src->flags & ELA_EVENT_CHILD) )
+        return;
+
+    if ( !(src->state & SOURCE_CHILD_EXITED) )
+        _child_unwatch(ctx, src);
+
+    src->flags &= ~ELA_EVENT_CHILD;
+    src->state &= ~SOURCE_CHILD_EXITED;
+    src->pid = 0;
+}
+
+/* Everything pending comes out of as few reads as possible */
+static void _sig_read(struct native_loop *ctx)
+{
+    struct signalfd_siginfo info[SIGNAL_BATCH];
+    ssize_t ret;
+    size_t i, n;
+
+    do {
+        ret = read(ctx->sig_fd, info, sizeof(info));
+        if ( ret <= 0 )
+            return;
+
+        n = ret / sizeof(info[0]);
+        for ( i = 0; i < n; ++i ) {
+            struct ela_event_source *src, *next;
+            unsigned int signo = info[i].ssi_signo;
+
+            if ( signo >= NSIG )
+                continue;
+
+            for ( src = ctx->sig_sources[signo]; src; src = next ) {
+                next = src->sig_next;
+                if ( src->flags & ELA_EVENT_CHILD )
+                    _child_check(ctx, src);
+                else
+                    _ready_push(ctx, src, ELA_EVENT_SIGNAL);
+            }
+        }
+    } while ( n == SIGNAL_BATCH );
+}
+
+void ela_native_fd_ready(struct native_loop *ctx, int fd, uint32_t mask)
+{
+    struct ela_event_source *src, *next;
+
+    if ( (size_t)fd >= ctx->fd_size )
+        return;
+
+    ctx->polled++;
+
+    if ( fd == ctx->sig_fd ) {
+        ctx->sig_pending = 1;
+        return;
+    }
+
+    if ( ctx->post_watched && fd == ela_post_queue_fd(&ctx->post) ) {
+        ctx->post_pending = 1;
+        return;
+    }
+
+    for ( src = ctx->fds[fd].sources; src; src = next ) {
+        uint32_t m = mask & src->flags;
+
+        next = src->fd_next;
+        if ( m && (src->flags & ELA_EVENT_CHILD) )
+            _child_check(ctx, src);
+        else if ( m )
+            _ready_push(ctx, src, m);
+    }
+}
+
+/*
+  Backend
+ */
+
+ela_error_t ela_native_remove(
+    struct ela_el *ctx_,
+    struct ela_event_source *src)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+
+    if ( !(src->state & SOURCE_ADDED) )
+        return 0;
+
+    if ( ctx->current == src )
+        ctx->current = NULL;
+
+    if ( src->completion_token ) {
+        ctx->poller->completion_stop(ctx, src->completion_token);
+        src->completion_token = NULL;
+    }
+
+    _fd_unlink(ctx, src);
+    _sig_unlink(ctx, src);
+    _timeout_disarm(ctx, src);
+    _ready_remove(ctx, src);
+
+    src->state &= ~SOURCE_ADDED;
+    ctx->source_count--;
+
+    return 0;
+}
+
+ela_error_t ela_native_add(
+    struct ela_el *ctx_,
+    struct ela_event_source *src)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+    ela_error_t err;
+
+    if ( src->completion && !src->completion_token
+         && ctx->poller->completion_start
+         && (!src->group || src->group->backend_data) )
+        ctx->poller->completion_start(ctx, src, src->completion_op, src->fd,
+                                      src->group, &src->completion_token);
+
+    if ( src->completion_token ) {
+        _fd_unlink(ctx, src);
+    } else if ( src->fd >= 0 && (src->flags & (ELA_EVENT_READABLE|ELA_EVENT_WRITABLE)) ) {
+        err = _fd_link(ctx, src);
+        if ( err )
+            return err;
+    } else {
+        _fd_unlink(ctx, src);
+    }
+
+    if ( src->flags & ELA_EVENT_SIGNAL ) {
+        err = _sig_link(ctx, src);
+        if ( err ) {
+            _fd_unlink(ctx, src);
+            return err;
+        }
+    }
+
+    if ( src->flags & ELA_EVENT_TIMEOUT ) {
+        uint64_t now = ela_native_now();
+
+        /* Anchor periodic timeouts here */
+        src->period_next = now + _timeout_duration(src);
+        src->overrun = 0;
+
+        err = _timeout_arm(ctx, src, now);
+        if ( err ) {
+            _fd_unlink(ctx, src);
+            _sig_unlink(ctx, src);
+            return err;
+        }
+    } else {
+        _timeout_disarm(ctx, src);
+    }
+
+    if ( !(src->state & SOURCE_ADDED) ) {
+        src->state |= SOURCE_ADDED;
+        ctx->source_count++;
+    }
+
+    /* SIGCHLD may have come before it got blocked */
+    if ( (src->flags & ELA_EVENT_CHILD) && src->signo )
+        _child_check(ctx, src);
+
+    return 0;
+}
+
+ela_error_t ela_native_source_detach(
+    struct ela_el *ctx_,
+    struct ela_event_source *src)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+    uint64_t expiry = 0;
+
+    /* Classes and buffer groups belong to the loop */
+    if ( src->cls || src->completion )
+        return EINVAL;
+
+    if ( !(src->state & SOURCE_ADDED) )
+        return 0;
+
+    if ( (src->state & SOURCE_READY)
+         && (src->ready_mask & ELA_EVENT_TIMEOUT) )
+        expiry = ela_native_loop_now(ctx);
+    else if ( src->touched )
+        expiry = src->touched + _timeout_duration(src);
+    else if ( ela_wheel_node_armed(&src->wheel_node) )
+        expiry = ela_wheel_node_deadline(&ctx->wheel, &src->wheel_node);
+    else if ( _timeout_armed(src) )
+        expiry = src->deadline;
+
+    ela_native_remove(ctx_, src);
+
+    src->migrate_expiry = expiry;
+    src->state |= SOURCE_MIGRATED;
+    return 0;
+}
+
+ela_error_t ela_native_source_attach(
+    struct ela_el *ctx_,
+    struct ela_event_source *src)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+    uint64_t period_next = src->period_next;
+    uint64_t overrun = src->overrun;
+    uint64_t expiry = src->migrate_expiry;
+    ela_error_t err;
+
+    if ( !(src->state & SOURCE_MIGRATED) )
+        return 0;
+
+    src->state &= ~SOURCE_MIGRATED;
+    src->migrate_expiry = 0;
+
+    err = ela_native_add(ctx_, src);
+    if ( err || !(src->flags & ELA_EVENT_TIMEOUT) || src->deadline_abs )
+        return err;
+
+    /* Keep the timeout running where it was, rather than restart it */
+    if ( src->flags & ELA_EVENT_PERIODIC ) {
+        src->period_next = period_next;
+        src->overrun = overrun;
+        return _timeout_arm(ctx, src, ela_native_now());
+    }
+
+    if ( expiry == 0 )
+        return 0;
+
+    return _timeout_arm(ctx, src, expiry - _timeout_duration(src));
+}
+
+ela_error_t ela_native_set_fd(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    int fd,
+    uint32_t ela_flags)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+    const uint32_t fd_flags
+        = (ELA_EVENT_ONCE|ELA_EVENT_READABLE|ELA_EVENT_WRITABLE
+           |ELA_EVENT_EDGE);
+
+    _child_release(ctx, src);
+    if ( fd != src->fd )
+        _fd_unlink(ctx, src);
+    _sig_unlink(ctx, src);
+
+    src->fd = fd;
+    src->signo = 0;
+    src->flags = (src->flags & ~(fd_flags|ELA_EVENT_SIGNAL))
+        | (ela_flags & fd_flags);
+
+    if ( src->state & SOURCE_ADDED )
+        return ela_native_add(ctx_, src);
+
+    return 0;
+}
+
+ela_error_t ela_native_set_signal(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    int signo)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+    const uint32_t fd_flags
+        = (ELA_EVENT_READABLE|ELA_EVENT_WRITABLE|ELA_EVENT_EDGE
+           |ELA_EVENT_SIGNAL);
+
+    if ( signo < 0 || signo >= NSIG || signo == SIGKILL || signo == SIGSTOP )
+        return EINVAL;
+
+    if ( src->completion )
+        return EINVAL;
+
+    /* A source watches either an fd or a signal */
+    _child_release(ctx, src);
+    _fd_unlink(ctx, src);
+    _sig_unlink(ctx, src);
+    src->fd = -1;
+    src->signo = signo;
+    src->flags &= ~fd_flags;
+    if ( signo )
+        src->flags |= ELA_EVENT_SIGNAL;
+
+    if ( src->state & SOURCE_ADDED )
+        return ela_native_add(ctx_, src);
+
+    return 0;
+}
+
+ela_error_t ela_native_set_child(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    pid_t pid)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+    const uint32_t fd_flags
+        = (ELA_EVENT_READABLE|ELA_EVENT_WRITABLE|ELA_EVENT_EDGE
+           |ELA_EVENT_SIGNAL);
+    int fd = -1;
+
+    if ( pid < 0 || src->completion )
+        return EINVAL;
+
+    if ( pid ) {
+        fd = ela_child_open(pid);
+        if ( fd < 0 && fd != -ENOSYS )
+            return -fd;
+    }
+
+    _child_release(ctx, src);
+    _fd_unlink(ctx, src);
+    _sig_unlink(ctx, src);
+    src->fd = -1;
+    src->signo = 0;
+    src->flags &= ~fd_flags;
+
+    if ( pid ) {
+        src->pid = pid;
+        src->child_status = 0;
+        src->child_err = 0;
+        src->flags |= ELA_EVENT_CHILD;
+
+        if ( fd >= 0 ) {
+            src->fd = fd;
+            src->flags |= ELA_EVENT_READABLE;
+        } else {
+            src->signo = SIGCHLD;
+            src->flags |= ELA_EVENT_SIGNAL;
+        }
+    }
+
+    if ( src->state & SOURCE_ADDED )
+        return ela_native_add(ctx_, src);
+
+    return 0;
+}
+
+ela_error_t ela_native_child_status(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    int *status)
+{
+    if ( !(src->flags & ELA_EVENT_CHILD) )
+        return EINVAL;
+
+    if ( !(src->state & SOURCE_CHILD_EXITED) )
+        return EAGAIN;
+
+    if ( src->child_err )
+        return src->child_err;
+
+    *status = src->child_status;
+    return 0;
+}
+
+ela_error_t ela_native_set_timeout(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    const struct timeval *tv,
+    uint32_t ela_flags)
+{
+    const uint32_t timeout_flags
+        = (ELA_EVENT_ONCE|ELA_EVENT_TIMEOUT|ELA_EVENT_COARSE
+           |ELA_EVENT_PERIODIC|ELA_EVENT_CATCHUP);
+
+    src->cls = NULL;
+    src->deadline_abs = 0;
+
+    if ( tv != NULL ) {
+        memcpy(&src->timeout, tv, sizeof(*tv));
+        ela_flags |= ELA_EVENT_TIMEOUT;
+        src->flags
+            = (src->flags & ~timeout_flags) | (ela_flags & timeout_flags);
+    } else {
+        src->flags &= ~ELA_EVENT_TIMEOUT;
+    }
+
+    return 0;
+}
+
+ela_error_t ela_native_set_timeout_class(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    struct ela_timeout_class *cls,
+    uint32_t ela_flags)
+{
+    const uint32_t timeout_flags
+        = (ELA_EVENT_ONCE|ELA_EVENT_TIMEOUT|ELA_EVENT_COARSE
+           |ELA_EVENT_PERIODIC|ELA_EVENT_CATCHUP);
+
+    src->cls = cls;
+    src->deadline_abs = 0;
+
+    if ( cls != NULL ) {
+        src->flags = (src->flags & ~timeout_flags)
+            | ELA_EVENT_TIMEOUT | (ela_flags & ELA_EVENT_ONCE);
+    } else {
+        src->flags &= ~ELA_EVENT_TIMEOUT;
+    }
+
+    return 0;
+}
+
+ela_error_t ela_native_set_deadline(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    const struct timespec *deadline,
+    uint32_t ela_flags)
+{
+    const uint32_t timeout_flags
+        = (ELA_EVENT_ONCE|ELA_EVENT_TIMEOUT|ELA_EVENT_COARSE
+           |ELA_EVENT_PERIODIC|ELA_EVENT_CATCHUP);
+
+    src->cls = NULL;
+
+    if ( deadline != NULL ) {
+        src->deadline_abs = ela_time_from_ts(deadline);
+        /* 0 means no deadline */
+        if ( src->deadline_abs == 0 )
+            src->deadline_abs = 1;
+        ela_flags &= (ELA_EVENT_ONCE|ELA_EVENT_COARSE);
+        ela_flags |= ELA_EVENT_TIMEOUT;
+        src->flags = (src->flags & ~timeout_flags) | ela_flags;
+    } else {
+        src->deadline_abs = 0;
+        src->flags &= ~ELA_EVENT_TIMEOUT;
+    }
+
+    return 0;
+}
+
+static
+ela_error_t _ela_native_set_completion(
+    struct native_loop *ctx,
+    struct ela_event_source *src,
+    int fd,
+    int op,
+    struct ela_buffer_group *group,
+    ela_completion_func *func)
+{
+    const uint32_t fd_flags
+        = (ELA_EVENT_ONCE|ELA_EVENT_READABLE|ELA_EVENT_WRITABLE
+           |ELA_EVENT_EDGE);
+    int added = src->state & SOURCE_ADDED;
+    ela_error_t err;
+
+    err = ela_completion_prepare(op, fd);
+    if ( err )
+        return err;
+
+    if ( added )
+        ela_native_remove(&ctx->base, src);
+
+    src->fd = fd;
+    src->flags = (src->flags & ~fd_flags) | ELA_EVENT_READABLE;
+    src->completion = func;
+    src->completion_op = op;
+    src->group = group;
+
+    if ( added )
+        return ela_native_add(&ctx->base, src);
+
+    return 0;
+}
+
+ela_error_t ela_native_recv_multishot(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    int fd,
+    uint16_t group_id,
+    ela_completion_func *func)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+    struct ela_buffer_group *group = ela_buffer_group_find(ctx->groups, group_id);
+
+    if ( group == NULL )
+        return ENOENT;
+
+    return _ela_native_set_completion(ctx, src, fd, ELA_COMPLETION_RECV,
+                                      group, func);
+}
+
+ela_error_t ela_native_accept_multishot(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    int fd,
+    ela_completion_func *func)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+
+    return _ela_native_set_completion(ctx, src, fd, ELA_COMPLETION_ACCEPT,
+                                      NULL, func);
+}
+
+ela_error_t ela_native_buffer_group_create(
+    struct ela_el *ctx_,
+    uint16_t id,
+    unsigned int count,
+    size_t size)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+    struct ela_buffer_group *group;
+    ela_error_t err;
+
+    err = ela_buffer_group_alloc(&ctx->groups, id, count, size, &group);
+    if ( err )
+        return err;
+
+    if ( ctx->poller->buffer_group_init )
+        ctx->poller->buffer_group_init(ctx, group);
+
+    return 0;
+}
+
+void ela_native_complete(struct native_loop *ctx,
+                         struct ela_event_source *src,
+                         ssize_t res, const void *buf, int more)
+{
+    if ( !more )
+        src->completion_token = NULL;
+
+    if ( !more || res < 0
+         || (res == 0 && src->completion_op == ELA_COMPLETION_RECV) )
+        ela_native_remove(&ctx->base, src);
+
+    src->completion(src, src->fd, res, buf, src->priv);
+}
+
+static
+void _ela_native_complete_emulated(struct native_loop *ctx,
+                                   struct ela_event_source *src)
+{
+    unsigned int budget = COMPLETION_BUDGET;
+
+    ctx->current = src;
+
+    while ( budget-- && ctx->current == src ) {
+        ssize_t res = ela_completion_emulate(src->completion_op, src->fd,
+                                             src->group);
+
+        if ( res == -EAGAIN || res == -EWOULDBLOCK )
+            break;
+
+        if ( src->completion_op == ELA_COMPLETION_ACCEPT
+             && res == -ECONNABORTED )
+            continue;
+
+        ela_native_complete(ctx, src, res,
+                            src->group ? src->group->mem : NULL, 1);
+    }
+
+    if ( ctx->current == src )
+        ctx->current = NULL;
+}
+
+/* Loop bookkeeping before calling a source */
+static
+void _ela_native_dispatch_prepare(struct native_loop *ctx,
+                                  struct ela_event_source *src,
+                                  uint32_t mask)
+{
+    /* A child exits only once */
+    if ( (src->flags & ELA_EVENT_ONCE) || (mask & ELA_EVENT_CHILD) )
+        ela_native_remove(&ctx->base, src);
+    else if ( src->deadline_abs ) {
+        /* Deadlines fire once and are never restarted */
+        if ( mask & ELA_EVENT_TIMEOUT )
+            src->flags &= ~ELA_EVENT_TIMEOUT;
+    } else if ( src->flags & ELA_EVENT_PERIODIC ) {
+        if ( (src->flags & ELA_EVENT_TIMEOUT) && (mask & ELA_EVENT_TIMEOUT) )
+            _periodic_advance(ctx, src);
+    } else if ( (src->flags & ELA_EVENT_TIMEOUT) && _timeout_armed(src) )
+        src->touched = ctx->now;
+    else if ( src->flags & ELA_EVENT_TIMEOUT )
+        _timeout_arm(ctx, src, ela_native_now());
+}
+
+static
+void _ela_native_dispatch(struct native_loop *ctx,
+                          struct ela_event_source *src,
+                          uint32_t mask)
+{
+    _ela_native_dispatch_prepare(ctx, src, mask);
+
+    if ( !src->completion )
+        src->handler(src, src->fd, mask, src->priv);
+    else if ( mask & ELA_EVENT_READABLE )
+        _ela_native_complete_emulated(ctx, src);
+    else
+        src->completion(src, src->fd, -ETIMEDOUT, NULL, src->priv);
+}
+
+/* Earliest timeout, NATIVE_WAIT_FOREVER if none */
+static
+uint64_t _ela_native_next_deadline(struct native_loop *ctx)
+{
+    uint64_t deadline = NATIVE_WAIT_FOREVER;
+    struct ela_timeout_class *cls;
+
+    if ( ctx->timer_count )
+        deadline = ctx->timers[0]->deadline;
+    for ( cls = ctx->classes; cls; cls = cls->next )
+        if ( cls->head && cls->head->deadline < deadline )
+            deadline = cls->head->deadline;
+    if ( ctx->wheel.count ) {
+        uint64_t next = ela_wheel_next(&ctx->wheel);
+        if ( next < deadline )
+            deadline = next;
+    }
+
+    return deadline;
+}
+
+/* Poll without blocking for a while. Returns whether it found
+   anything, the loop then needs not block. */
+static
+int _busy_poll(struct native_loop *ctx, uint64_t deadline)
+{
+    uint64_t start = ela_native_now(), now = start;
+    uint64_t end = start + ctx->busy_spin;
+    uint32_t polled = ctx->polled;
+    int found = 0;
+
+    if ( end > deadline )
+        end = deadline;
+
+    while ( !found && now < end ) {
+        ctx->poller->wait(ctx, NATIVE_WAIT_NONE);
+        ctx->stats.busy_polls++;
+        found = ctx->polled != polled || ctx->ready_head != NULL;
+        now = ela_native_now();
+    }
+
+    ctx->stats.busy_ns += now - start;
+
+    if ( found ) {
+        /* Events flow, spin all the way */
+        ctx->stats.busy_hits++;
+        ctx->busy_spin = ctx->busy_max;
+    } else if ( now < deadline && ctx->busy_spin > BUSY_SPIN_MIN ) {
+        ctx->busy_spin /= 2;
+    }
+
+    return found;
+}
+
+/* Wait for events until deadline, then queue expired timeouts */
+static
+void _ela_native_poll(struct native_loop *ctx, uint64_t deadline)
+{
+    int spin = ctx->busy_max && deadline != NATIVE_WAIT_NONE;
+    uint32_t polled;
+
+    _fd_flush(ctx);
+
+    ctx->poll_deadline = deadline;
+
+    if ( !spin || !_busy_poll(ctx, deadline) ) {
+        polled = ctx->polled;
+        ctx->poller->wait(ctx, deadline);
+        if ( deadline != NATIVE_WAIT_NONE )
+            ctx->stats.wakeups++;
+
+        /* Events came while asleep, a longer spin would have seen
+           them */
+        if ( spin && ctx->polled != polled ) {
+            ctx->busy_spin *= 2;
+            if ( ctx->busy_spin > ctx->busy_max )
+                ctx->busy_spin = ctx->busy_max;
+        }
+    }
+
+    ctx->now = ela_native_now();
+
+    if ( ctx->sig_pending ) {
+        ctx->sig_pending = 0;
+        _sig_read(ctx);
+    }
+
+    if ( ctx->post_pending ) {
+        ctx->post_pending = 0;
+        /* Posted functions run like handlers */
+        ela_shared_unlock(&ctx->base);
+        ela_post_queue_drain(&ctx->post, &ctx->base);
+        ela_shared_lock(&ctx->base);
+    }
+
+    if ( ctx->timer_count || ctx->wheel.count || ctx->classes ) {
+        uint64_t now = ctx->now;
+        struct ela_wheel_node *node;
+        struct ela_timeout_class *cls;
+
+        for ( cls = ctx->classes; cls; cls = cls->next ) {
+            while ( cls->head && cls->head->deadline <= now ) {
+                struct ela_event_source *src = cls->head;
+
+                _cls_unlink(src);
+                if ( _timeout_requeue(ctx, src, now) )
+                    continue;
+                _ready_push(ctx, src, ELA_EVENT_TIMEOUT);
+                ctx->stats.timeouts++;
+            }
+        }
+
+        while ( ctx->timer_count && ctx->timers[0]->deadline <= now ) {
+            struct ela_event_source *src = ctx->timers[0];
+
+            _timer_remove(ctx, src);
+            if ( _timeout_requeue(ctx, src, now) )
+                continue;
+            _ready_push(ctx, src, ELA_EVENT_TIMEOUT);
+            ctx->stats.timeouts++;
+        }
+
+        ela_wheel_advance(&ctx->wheel, now);
+        while ( (node = ela_wheel_pop(&ctx->wheel)) ) {
+            struct ela_event_source *src = (struct ela_event_source *)
+                ((char *)node - offsetof(struct ela_event_source, wheel_node));
+
+            if ( _timeout_requeue(ctx, src, now) )
+                continue;
+            _ready_push(ctx, src, ELA_EVENT_TIMEOUT);
+            ctx->stats.timeouts++;
+        }
+    }
+}
+
+/* One iteration, waiting until limit at most. Returns the number of
+   sources dispatched. */
+static
+unsigned int _ela_native_iterate(struct native_loop *ctx, uint64_t limit)
+{
+    unsigned int count = 0;
+    uint64_t deadline;
+
+    ela_hooks_run(&ctx->base, ELA_HOOK_BEFORE_POLL);
+    if ( ctx->exit )
+        return 0;
+
+    deadline = ctx->ready_head ? NATIVE_WAIT_NONE
+        : _ela_native_next_deadline(ctx);
+    _ela_native_poll(ctx, deadline < limit ? deadline : limit);
+    ela_hooks_run(&ctx->base, ELA_HOOK_AFTER_POLL);
+
+    /* Sources activated by handlers from now on run next time */
+    ctx->ready_gen++;
+
+    while ( ctx->ready_head && ctx->ready_head->ready_gen != ctx->ready_gen
+            && !ctx->exit ) {
+        struct ela_event_source *src = ctx->ready_head;
+        uint32_t mask = src->ready_mask;
+
+        _ready_remove(ctx, src);
+        _ela_native_dispatch(ctx, src, mask);
+        count++;
+    }
+
+    return count;
+}
+
+/* Poller may only be touched from the loop thread, start watching
+   the post queue there */
+static void _post_watch(struct native_loop *ctx)
+{
+    int fd = ela_post_queue_fd(&ctx->post);
+
+    if ( ctx->post_watched || fd < 0 )
+        return;
+
+    if ( _fd_reserve(ctx, fd)
+         || ctx->poller->fd_update(ctx, fd, ELA_EVENT_READABLE) )
+        return;
+
+    ctx->fds[fd].events = ELA_EVENT_READABLE;
+    ctx->post_watched = 1;
+}
+
+void ela_native_run(struct ela_el *ctx_)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+
+    __atomic_store_n(&ctx->exit, 0, __ATOMIC_RELAXED);
+    ctx->now = ela_native_now();
+    ctx->running++;
+
+    _post_watch(ctx);
+
+    while ( !__atomic_load_n(&ctx->exit, __ATOMIC_ACQUIRE)
+            && ctx->source_count )
+        _ela_native_iterate(ctx, NATIVE_WAIT_FOREVER);
+
+    ctx->running--;
+}
+
+ela_error_t ela_native_set_busy_poll(
+    struct ela_el *ctx_,
+    const struct timeval *spin,
+    uint32_t flags)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+    size_t fd;
+
+    ctx->busy_max = spin ? ela_time_from_tv(spin) : 0;
+    ctx->busy_spin = ctx->busy_max;
+    ctx->busy_flags = ctx->busy_max ? flags : 0;
+
+    if ( ctx->busy_flags & ELA_BUSY_POLL_SOCKETS )
+        for ( fd = 0; fd < ctx->fd_size; ++fd )
+            if ( ctx->fds[fd].sources )
+                _busy_poll_socket(ctx, fd);
+
+    return 0;
+}
+
+int ela_native_run_once(struct ela_el *ctx_,
+                        const struct timespec *deadline,
+                        int *done)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+    uint64_t limit = NATIVE_WAIT_FOREVER;
+    unsigned int count;
+
+    if ( ctx->base.shared )
+        return -EBUSY;
+
+    if ( !ctx->source_count ) {
+        *done = 1;
+        __atomic_store_n(&ctx->exit, 0, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    if ( deadline )
+        limit = ela_time_from_ts(deadline);
+
+    ctx->now = ela_native_now();
+    ctx->running++;
+
+    _post_watch(ctx);
+    count = _ela_native_iterate(ctx, limit);
+
+    ctx->running--;
+
+    /* An exit only ends the step it came in */
+    *done = __atomic_exchange_n(&ctx->exit, 0, __ATOMIC_ACQ_REL)
+        || !ctx->source_count;
+
+    return count;
+}
+
+void ela_native_exit(struct ela_el *ctx_)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+
+    __atomic_store_n(&ctx->exit, 1, __ATOMIC_RELEASE);
+
+    /* May come from another thread, while the loop sleeps */
+    ela_post_queue_wake(&ctx->post);
+}
+
+/*
+  Shared loop, see ela_run_shared(). The loop lock is held all along,
+  except while polling and while running handlers.
+ */
+
+void ela_native_wait_begin(struct native_loop *ctx)
+{
+    ela_shared_unlock(&ctx->base);
+}
+
+void ela_native_wait_end(struct native_loop *ctx)
+{
+    ela_shared_lock(&ctx->base);
+}
+
+/* Ready source no other thread is running the handler of */
+static
+struct ela_event_source *_shared_ready_take(struct native_loop *ctx)
+{
+    struct ela_event_source *src;
+
+    for ( src = ctx->ready_head; src; src = src->ready_next )
+        if ( !(src->state & SOURCE_BUSY) && src->ready_gen != ctx->ready_gen )
+            return src;
+
+    return NULL;
+}
+
+/* Ready source left for after the next poll */
+static
+int _shared_ready_later(struct native_loop *ctx)
+{
+    struct ela_event_source *src;
+
+    for ( src = ctx->ready_head; src; src = src->ready_next )
+        if ( !(src->state & SOURCE_BUSY) )
+            return 1;
+
+    return 0;
+}
+
+static
+void _shared_dispatch(struct native_loop *ctx, struct ela_event_source *src)
+{
+    struct ela_shared *shared = ctx->base.shared;
+    struct native_dispatch d, *outer, **prev;
+    uint32_t mask = src->ready_mask;
+    ela_handler_func *handler = src->handler;
+    void *priv = src->priv;
+    int fd = src->fd;
+
+    _ready_remove(ctx, src);
+
+    if ( src->completion ) {
+        _ela_native_dispatch(ctx, src, mask);
+        return;
+    }
+
+    _ela_native_dispatch_prepare(ctx, src, mask);
+
+    src->state |= SOURCE_BUSY;
+    if ( src->state & SOURCE_FD_LINKED )
+        _fd_sync(ctx, src->fd);
+
+    outer = _dispatch;
+    d.src = src;
+    d.released = 0;
+    d.release = NULL;
+    d.next = ctx->dispatches;
+    ctx->dispatches = &d;
+    _dispatch = &d;
+    ela_shared_unlock(&ctx->base);
+
+    handler(src, fd, mask, priv);
+
+    ela_shared_lock(&ctx->base);
+    _dispatch = outer;
+    for ( prev = &ctx->dispatches; *prev != &d; prev = &(*prev)->next )
+        ;
+    *prev = d.next;
+
+    /* Source memory may be gone if it got released meanwhile */
+    if ( !d.released ) {
+        src->state &= ~SOURCE_BUSY;
+        if ( src->state & SOURCE_FD_LINKED )
+            _fd_sync(ctx, src->fd);
+    } else if ( d.release ) {
+        d.release(&ctx->base, src);
+    }
+
+    pthread_cond_broadcast(&shared->cond);
+
+    /* Poller may sleep past a timeout the handler set */
+    if ( ctx->polling
+         && _ela_native_next_deadline(ctx) < ctx->poll_deadline )
+        ela_post_queue_wake(&ctx->post);
+}
+
+static
+void _shared_run(struct native_loop *ctx)
+{
+    struct ela_shared *shared = ctx->base.shared;
+
+    /* Taken once: ela_run_shared() cannot nest, so waiting is fine */
+    ela_shared_lock(&ctx->base);
+
+    while ( !__atomic_load_n(&ctx->exit, __ATOMIC_ACQUIRE)
+            && ctx->source_count ) {
+        struct ela_event_source *src = _shared_ready_take(ctx);
+
+        if ( src ) {
+            _shared_dispatch(ctx, src);
+        } else if ( ctx->polling ) {
+            pthread_cond_wait(&shared->cond, &shared->lock);
+        } else {
+            /* Lead until events come, then hand them over */
+            ctx->polling = 1;
+            ela_hooks_run(&ctx->base, ELA_HOOK_BEFORE_POLL);
+            _ela_native_poll(ctx, _shared_ready_later(ctx)
+                             ? NATIVE_WAIT_NONE
+                             : _ela_native_next_deadline(ctx));
+            ela_hooks_run(&ctx->base, ELA_HOOK_AFTER_POLL);
+            ctx->polling = 0;
+            ctx->ready_gen++;
+            pthread_cond_broadcast(&shared->cond);
+        }
+    }
+
+    /* Others may wait for a poller that is not coming back */
+    pthread_cond_broadcast(&shared->cond);
+    if ( ctx->polling )
+        ela_post_queue_wake(&ctx->post);
+
+    ela_shared_unlock(&ctx->base);
+}
+
+static
+void *_shared_thread(void *data)
+{
+    _shared_run(data);
+    return NULL;
+}
+
+ela_error_t ela_native_run_shared(struct ela_el *ctx_,
+                                  unsigned int nthreads)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+    struct ela_shared shared;
+    pthread_t *threads;
+    unsigned int i, started;
+    ela_error_t err;
+
+    if ( !ctx->poller->shared )
+        return ENOTSUP;
+
+    if ( ctx->base.shared || ctx->running )
+        return EBUSY;
+
+    if ( nthreads <= 1 ) {
+        ela_native_run(ctx_);
+        return 0;
+    }
+
+    threads = calloc(nthreads - 1, sizeof(*threads));
+    if ( threads == NULL )
+        return ENOMEM;
+
+    err = ela_shared_init(&shared);
+    if ( err ) {
+        free(threads);
+        return err;
+    }
+
+    ctx->exit = 0;
+    ctx->now = ela_native_now();
+    ctx->running++;
+    _post_watch(ctx);
+
+    ctx->base.shared = &shared;
+
+    for ( started = 0; started < nthreads - 1; ++started )
+        if ( pthread_create(&threads[started], NULL, _shared_thread, ctx) )
+            break;
+
+    _shared_run(ctx);
+
+    for ( i = 0; i < started; ++i )
+        pthread_join(threads[i], NULL);
+
+    ctx->base.shared = NULL;
+    ctx->running--;
+
+    ela_shared_release(&shared);
+    free(threads);
+
+    return 0;
+}
+
+ela_error_t ela_native_activate(struct ela_el *ctx_,
+                                struct ela_event_source *src,
+                                uint32_t mask)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+
+    if ( !(src->state & SOURCE_ADDED) )
+        return ENOENT;
+
+    /* Native completions are driven by the poller */
+    if ( src->completion )
+        return EINVAL;
+
+    /* A deadline reported now must not fire again */
+    if ( (mask & ELA_EVENT_TIMEOUT) && src->deadline_abs )
+        _timeout_disarm(ctx, src);
+
+    _ready_push(ctx, src, mask);
+
+    if ( ctx->polling )
+        ela_post_queue_wake(&ctx->post);
+
+    return 0;
+}
+
+ela_error_t ela_native_post(struct ela_el *ctx_,
+                            ela_post_func *func,
+                            void *data)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+
+    return ela_post_queue_push(&ctx->post, func, data);
+}
+
+void ela_native_close(struct ela_el *ctx_)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+    struct ela_buffer_group *group;
+
+    for ( group = ctx->groups; group; group = group->next )
+        if ( group->backend_data )
+            ctx->poller->buffer_group_release(ctx, group);
+    ela_buffer_group_free_all(&ctx->groups);
+
+    while ( ctx->classes ) {
+        struct ela_timeout_class *cls = ctx->classes;
+
+        ctx->classes = cls->next;
+        free(cls);
+    }
+
+    ctx->poller->close(ctx);
+    ela_post_queue_release(&ctx->post);
+
+    if ( ctx->sig_fd >= 0 ) {
+        close(ctx->sig_fd);
+        pthread_sigmask(SIG_UNBLOCK, &ctx->sig_blocked, NULL);
+    }
+    free(ctx->fds);
+    free(ctx->changes);
+    free(ctx->timers);
+    free(ctx);
+}
+
+size_t ela_native_source_size(struct ela_el *ctx_)
+{
+    return sizeof(struct ela_event_source);
+}
+
+ela_error_t ela_native_source_init(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    ela_handler_func *func,
+    void *priv)
+{
+    memset(src, 0, sizeof(*src));
+    src->priv = priv;
+    src->handler = func;
+    src->fd = -1;
+    src->timer_index = TIMER_NONE;
+    src->slack = SLACK_DEFAULT;
+    ela_wheel_node_init(&src->wheel_node);
+
+    return 0;
+}
+
+static struct native_dispatch *_dispatch_find(struct native_loop *ctx,
+                                              struct ela_event_source *src)
+{
+    struct native_dispatch *d;
+
+    for ( d = ctx->dispatches; d; d = d->next )
+        if ( d->src == src )
+            return d;
+
+    return NULL;
+}
+
+void ela_native_source_cleanup(
+    struct ela_el *ctx_,
+    struct ela_event_source *src)
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+    struct ela_shared *shared = ctx_->shared;
+    struct native_dispatch *d = shared ? _dispatch_find(ctx, src) : NULL;
+
+    /* Never pull a source from under a running handler: wait for it,
+       unless it runs on this thread, or the lock is held more than
+       once and the wait would not release it */
+    if ( d && (d == _dispatch || !ela_shared_can_wait(ctx_)) )
+        d->released = 1;
+    else if ( d )
+        while ( src->state & SOURCE_BUSY )
+            pthread_cond_wait(&shared->cond, &shared->lock);
+
+    ela_native_remove(ctx_, src);
+    _child_release(ctx, src);
+}
+
+int ela_native_source_release_later(
+    struct ela_el *ctx_,
+    struct ela_event_source *src,
+    void (*release)(struct ela_el *ctx, void *mem))
+{
+    struct native_loop *ctx = (struct native_loop *)ctx_;
+    struct native_dispatch *d;
+
+    if ( ctx_->shared == NULL )
+        return 0;
+
+    /* Released without waiting for another thread, see
+       ela_native_source_cleanup() */
+    d = _dispatch_find(ctx, src);
+    if ( d == NULL || d == _dispatch || !d->released )
+        return 0;
+
+    d->release = release;
+    return 1;
+}
+
+static void _source_storage_free(struct ela_el *ctx, void *mem)
+{
+    free(mem);
+}
+
+ela_error_t ela_native_source_alloc(
+    struct ela_el *ctx_,
+    ela_handler_func *func,
+    void *priv,
+    struct ela_event_source **source)
+{
+    struct ela_event_source *src = malloc(sizeof(*src));
+
+    if ( src == NULL )
+        return ENOMEM;
+
+    ela_native_source_init(ctx_, src, func, priv);
+
+    *source = src;
+    return 0;
+}
+
+void ela_native_source_free(
+    struct ela_el *ctx_,
+    struct ela_event_source *src)
+{
+    ela_native_source_cleanup(ctx_, src);
+    if ( !ela_native_source_release_later(ctx_, src, _source_storage_free) )
+        free(src);
+}
+
+void ela_native_init(struct native_loop *ctx,
+                     const struct ela_el_backend *backend,
+                     const struct native_poller *poller)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->base.backend = backend;
+    ctx->poller = poller;
+    ela_wheel_init(&ctx->wheel, NATIVE_DEFAULT_TICK, ela_native_now());
+    ela_post_queue_init(&ctx->post);
+    sigemptyset(&ctx->sig_mask);
+    sigemptyset(&ctx->sig_blocked);
+    ctx->sig_fd = -1;
+}
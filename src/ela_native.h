@@ -0,0 +1,329 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef ELA_NATIVE_H
+#define ELA_NATIVE_H
+
+/*
+  Event loop core shared by the backends that talk to the kernel
+  directly (epoll, io_uring). The core owns sources, per-fd interest
+  state, timers and the ready list; a poller only has to push the
+  per-fd interest to the kernel and report readiness back through
+  ela_native_fd_ready().
+ */
+
+#include <stdint.h>
+#include <signal.h>
+#include <ela/ela.h>
+#include <ela/backend.h>
+
+#include "ela_completion.h"
+#include "ela_post.h"
+#include "ela_wheel.h"
+#include "ela_time.h"
+
+#define NATIVE_WAIT_NONE 0
+#define NATIVE_WAIT_FOREVER UINT64_MAX
+
+/** Default timer wheel tick, in ns */
+#define NATIVE_DEFAULT_TICK 1000000ULL
+
+struct native_loop;
+struct native_dispatch;
+
+struct native_fd
+{
+    /** Sources watching this fd */
+    struct ela_event_source *sources;
+    /** ELA_EVENT_READABLE/WRITABLE mask currently known to the
+        poller, with ELA_EVENT_EDGE if edge-triggered */
+    uint32_t events;
+    /** Free for poller use */
+    uint32_t gen;
+    uint32_t pending;
+    /** Queued in the loop changelist */
+    uint32_t changed;
+};
+
+struct native_poller
+{
+    /** Change kernel interest for fd. Old mask is in loop->fds[fd].events */
+    ela_error_t (*fd_update)(struct native_loop *loop, int fd,
+                             uint32_t events);
+
+    /** Wait for events until the absolute monotonic deadline (ns),
+        reporting them with ela_native_fd_ready(). */
+    void (*wait)(struct native_loop *loop, uint64_t deadline);
+
+    /** Release poller resources */
+    void (*close)(struct native_loop *loop);
+
+    /** Set if wait calls ela_native_wait_begin() and
+        ela_native_wait_end() around blocking, and the poller may be
+        updated from another thread meanwhile. Required for
+        ela_run_shared(). */
+    int shared;
+
+    /** Optional: set kernel-side buffer selection up for a group, group
+        is emulated on failure */
+    ela_error_t (*buffer_group_init)(struct native_loop *loop,
+                                     struct ela_buffer_group *group);
+    void (*buffer_group_release)(struct native_loop *loop,
+                                 struct ela_buffer_group *group);
+
+    /** Optional: run a completion source natively, results go through
+        ela_native_complete(). Source is emulated on failure. */
+    ela_error_t (*completion_start)(struct native_loop *loop,
+                                    struct ela_event_source *src,
+                                    int op, int fd,
+                                    struct ela_buffer_group *group,
+                                    void **token);
+    void (*completion_stop)(struct native_loop *loop, void *token);
+};
+
+struct native_loop
+{
+    struct ela_el base;
+    const struct native_poller *poller;
+    int exit;
+
+    /** Per-fd interest state, indexed by fd */
+    struct native_fd *fds;
+    size_t fd_size;
+
+    /** Fds whose interest changed since the last poll */
+    int *changes;
+    size_t change_count;
+    size_t change_size;
+
+    /** Timer min-heap, ordered by deadline */
+    struct ela_event_source **timers;
+    size_t timer_count;
+    size_t timer_size;
+
+    /** Coarse timeouts */
+    struct ela_wheel wheel;
+
+    /** Timeout classes, each with its FIFO of armed sources */
+    struct ela_timeout_class *classes;
+
+    /** Loop time, taken once per iteration */
+    uint64_t now;
+    /** Nesting level of ela_run() */
+    int running;
+
+    /** Default timeout slack, ns */
+    uint64_t slack;
+
+    struct ela_stats stats;
+
+    /** Sources to dispatch in this iteration */
+    struct ela_event_source *ready_head;
+    struct ela_event_source *ready_tail;
+    /** Bumped after each poll, sources made ready since then wait for
+        the next iteration */
+    uint32_t ready_gen;
+
+    /** Registered sources, loop exits when it drops to 0 */
+    size_t source_count;
+
+    /** Buffer groups for completion sources */
+    struct ela_buffer_group *groups;
+
+    /** Completion source being emulated, reset if it goes away */
+    struct ela_event_source *current;
+
+    /** ela_post() queue, its fd is watched once the loop runs */
+    struct ela_post_queue post;
+    int post_watched;
+    int post_pending;
+
+    /** Signal sources by signal number, all read from one signalfd,
+        watched once the first one is added */
+    struct ela_event_source *sig_sources[NSIG];
+    sigset_t sig_mask;
+    /** Signals the loop blocked, unblocked once no longer watched */
+    sigset_t sig_blocked;
+    int sig_fd;
+    int sig_pending;
+
+    /** Busy polling: longest and current spin before blocking, in
+        ns, and ela_set_busy_poll() flags */
+    uint64_t busy_max;
+    uint64_t busy_spin;
+    uint32_t busy_flags;
+    /** Bumped on each readiness report */
+    uint32_t polled;
+
+    /** Handlers running on threads of a shared loop */
+    struct native_dispatch *dispatches;
+
+    /** A thread of a shared loop is polling, until poll_deadline */
+    int polling;
+    uint64_t poll_deadline;
+};
+
+uint64_t ela_native_now(void);
+
+/** Cached loop time when running, current time otherwise */
+uint64_t ela_native_loop_now(struct native_loop *loop);
+
+void ela_native_init(struct native_loop *loop,
+                     const struct ela_el_backend *backend,
+                     const struct native_poller *poller);
+
+void ela_native_fd_ready(struct native_loop *loop, int fd, uint32_t mask);
+
+/** Release the loop lock while blocking, for shared pollers */
+void ela_native_wait_begin(struct native_loop *loop);
+void ela_native_wait_end(struct native_loop *loop);
+
+/** Report a completion. With more unset, the poller dropped its token
+    and the source gets removed from the loop. */
+void ela_native_complete(struct native_loop *loop,
+                         struct ela_event_source *src,
+                         ssize_t res, const void *buf, int more);
+
+ela_error_t ela_native_source_alloc(struct ela_el *ctx,
+                                    ela_handler_func *func,
+                                    void *priv,
+                                    struct ela_event_source **ret);
+void ela_native_source_free(struct ela_el *ctx,
+                            struct ela_event_source *src);
+size_t ela_native_source_size(struct ela_el *ctx);
+ela_error_t ela_native_source_init(struct ela_el *ctx,
+                                   struct ela_event_source *src,
+                                   ela_handler_func *func,
+                                   void *priv);
+void ela_native_source_cleanup(struct ela_el *ctx,
+                               struct ela_event_source *src);
+int ela_native_source_release_later(
+    struct ela_el *ctx,
+    struct ela_event_source *src,
+    void (*release)(struct ela_el *ctx, void *mem));
+ela_error_t ela_native_set_fd(struct ela_el *ctx,
+                              struct ela_event_source *src,
+                              int fd,
+                              uint32_t flags);
+ela_error_t ela_native_set_signal(struct ela_el *ctx,
+                                  struct ela_event_source *src,
+                                  int signo);
+ela_error_t ela_native_set_child(struct ela_el *ctx,
+                                 struct ela_event_source *src,
+                                 pid_t pid);
+ela_error_t ela_native_child_status(struct ela_el *ctx,
+                                    struct ela_event_source *src,
+                                    int *status);
+ela_error_t ela_native_set_timeout(struct ela_el *ctx,
+                                   struct ela_event_source *src,
+                                   const struct timeval *tv,
+                                   uint32_t flags);
+ela_error_t ela_native_add(struct ela_el *ctx,
+                           struct ela_event_source *src);
+ela_error_t ela_native_remove(struct ela_el *ctx,
+                              struct ela_event_source *src);
+void ela_native_run(struct ela_el *ctx);
+ela_error_t ela_native_set_busy_poll(struct ela_el *ctx,
+                                     const struct timeval *spin,
+                                     uint32_t flags);
+int ela_native_run_once(struct ela_el *ctx,
+                        const struct timespec *deadline,
+                        int *done);
+void ela_native_exit(struct ela_el *ctx);
+void ela_native_close(struct ela_el *ctx);
+ela_error_t ela_native_run_shared(struct ela_el *ctx,
+                                  unsigned int nthreads);
+ela_error_t ela_native_source_detach(struct ela_el *ctx,
+                                     struct ela_event_source *src);
+ela_error_t ela_native_source_attach(struct ela_el *ctx,
+                                     struct ela_event_source *src);
+ela_error_t ela_native_activate(struct ela_el *ctx,
+                                struct ela_event_source *src,
+                                uint32_t mask);
+ela_error_t ela_native_post(struct ela_el *ctx,
+                            ela_post_func *func,
+                            void *data);
+ela_error_t ela_native_set_timer_tick(struct ela_el *ctx,
+                                      const struct timeval *tick);
+ela_error_t ela_native_set_timeout_slack(struct ela_el *ctx,
+                                         struct ela_event_source *src,
+                                         const struct timeval *slack);
+ela_error_t ela_native_get_stats(struct ela_el *ctx,
+                                 struct ela_stats *stats);
+ela_error_t ela_native_touch_timeout(struct ela_el *ctx,
+                                     struct ela_event_source *src);
+ela_error_t ela_native_set_deadline(struct ela_el *ctx,
+                                    struct ela_event_source *src,
+                                    const struct timespec *deadline,
+                                    uint32_t flags);
+struct timespec ela_native_get_now(struct ela_el *ctx);
+uint64_t ela_native_timeout_overrun(struct ela_el *ctx,
+                                   struct ela_event_source *src);
+ela_error_t ela_native_timeout_class_create(struct ela_el *ctx,
+                                            const struct timeval *duration,
+                                            struct ela_timeout_class **cls);
+ela_error_t ela_native_set_timeout_class(struct ela_el *ctx,
+                                         struct ela_event_source *src,
+                                         struct ela_timeout_class *cls,
+                                         uint32_t flags);
+ela_error_t ela_native_buffer_group_create(struct ela_el *ctx,
+                                           uint16_t group,
+                                           unsigned int count,
+                                           size_t size);
+ela_error_t ela_native_recv_multishot(struct ela_el *ctx,
+                                      struct ela_event_source *src,
+                                      int fd,
+                                      uint16_t group,
+                                      ela_completion_func *func);
+ela_error_t ela_native_accept_multishot(struct ela_el *ctx,
+                                        struct ela_event_source *src,
+                                        int fd,
+                                        ela_completion_func *func);
+
+/** Backend operations every native backend shares */
+#define NATIVE_BACKEND_OPS                              \
+    .source_alloc = ela_native_source_alloc,            \
+    .source_free = ela_native_source_free,              \
+    .set_fd = ela_native_set_fd,                        \
+    .set_timeout = ela_native_set_timeout,              \
+    .remove = ela_native_remove,                        \
+    .add = ela_native_add,                              \
+    .close = ela_native_close,                          \
+    .run = ela_native_run,                              \
+    .exit = ela_native_exit,                            \
+    .buffer_group_create = ela_native_buffer_group_create, \
+    .recv_multishot = ela_native_recv_multishot,        \
+    .accept_multishot = ela_native_accept_multishot,    \
+    .set_timer_tick = ela_native_set_timer_tick,        \
+    .set_timeout_slack = ela_native_set_timeout_slack,  \
+    .get_stats = ela_native_get_stats,                  \
+    .timeout_class_create = ela_native_timeout_class_create, \
+    .set_timeout_class = ela_native_set_timeout_class,  \
+    .touch_timeout = ela_native_touch_timeout,          \
+    .set_deadline = ela_native_set_deadline,            \
+    .now = ela_native_get_now,                          \
+    .timeout_overrun = ela_native_timeout_overrun,      \
+    .source_size = ela_native_source_size,              \
+    .source_init = ela_native_source_init,              \
+    .source_cleanup = ela_native_source_cleanup,        \
+    .post = ela_native_post,                            \
+    .run_shared = ela_native_run_shared,                \
+    .source_detach = ela_native_source_detach,          \
+    .source_attach = ela_native_source_attach,          \
+    .activate = ela_native_activate,                    \
+    .set_signal = ela_native_set_signal,                \
+    .set_child = ela_native_set_child,                  \
+    .child_status = ela_native_child_status,            \
+    .run_once = ela_native_run_once,                    \
+    .set_busy_poll = ela_native_set_busy_poll,         \
+    .source_release_later = ela_native_source_release_later
+
+#endif
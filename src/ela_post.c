@@ -0,0 +1,172 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef __linux__
+# include <sys/eventfd.h>
+#endif
+
+#include "ela_post.h"
+
+struct ela_post_item
+{
+    struct ela_post_item *next;
+    ela_post_func *func;
+    void *data;
+};
+
+#ifndef __linux__
+static int _set_flags(int fd)
+{
+    return fcntl(fd, F_SETFD, FD_CLOEXEC) < 0
+        || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0;
+}
+#endif
+
+static ela_error_t _fds_open(int fd[2])
+{
+#ifdef __linux__
+    fd[0] = fd[1] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if ( fd[0] < 0 )
+        return errno;
+#else
+    if ( pipe(fd) )
+        return errno;
+
+    if ( _set_flags(fd[0]) || _set_flags(fd[1]) ) {
+        ela_error_t err = errno;
+
+        close(fd[0]);
+        close(fd[1]);
+        return err;
+    }
+#endif
+
+    return 0;
+}
+
+ela_error_t ela_post_queue_init(struct ela_post_queue *queue)
+{
+    queue->head = NULL;
+    queue->error = _fds_open(queue->fd);
+
+    if ( queue->error )
+        queue->fd[0] = queue->fd[1] = -1;
+
+    return queue->error;
+}
+
+void ela_post_queue_release(struct ela_post_queue *queue)
+{
+    struct ela_post_item *item = queue->head;
+
+    while ( item ) {
+        struct ela_post_item *next = item->next;
+
+        free(item);
+        item = next;
+    }
+    queue->head = NULL;
+
+    if ( queue->fd[0] < 0 )
+        return;
+
+    close(queue->fd[0]);
+    if ( queue->fd[1] != queue->fd[0] )
+        close(queue->fd[1]);
+}
+
+void ela_post_queue_wake(struct ela_post_queue *queue)
+{
+    uint64_t one = 1;
+    ssize_t ret;
+
+    if ( queue->fd[1] < 0 )
+        return;
+
+    /* A full pipe or a saturated counter are already readable */
+#ifdef __linux__
+    ret = write(queue->fd[1], &one, sizeof(one));
+#else
+    ret = write(queue->fd[1], &one, 1);
+#endif
+    (void)ret;
+}
+
+ela_error_t ela_post_queue_push(struct ela_post_queue *queue,
+                                ela_post_func *func, void *data)
+{
+    struct ela_post_item *item;
+    struct ela_post_item *old;
+
+    if ( queue->error )
+        return queue->error;
+
+    item = malloc(sizeof(*item));
+    if ( item == NULL )
+        return ENOMEM;
+
+    item->func = func;
+    item->data = data;
+
+    old = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    do {
+        item->next = old;
+    } while ( !__atomic_compare_exchange_n(&queue->head, &old, item, 1,
+                                           __ATOMIC_RELEASE,
+                                           __ATOMIC_RELAXED) );
+
+    /* Only the first post after a drain has to wake the loop up */
+    if ( old == NULL )
+        ela_post_queue_wake(queue);
+
+    return 0;
+}
+
+void ela_post_queue_drain(struct ela_post_queue *queue, struct ela_el *ctx)
+{
+    struct ela_post_item *item, *list = NULL;
+    char buf[64];
+
+    /* Acknowledge before taking the list, a post that comes after
+       the exchange sees it empty and signals again */
+    while ( read(queue->fd[0], buf, sizeof(buf)) > 0
+            && queue->fd[0] != queue->fd[1] )
+        ;
+
+    item = __atomic_exchange_n(&queue->head, NULL, __ATOMIC_ACQUIRE);
+
+    /* Stack is newest first */
+    while ( item ) {
+        struct ela_post_item *next = item->next;
+
+        item->next = list;
+        list = item;
+        item = next;
+    }
+
+    while ( list ) {
+        item = list;
+        list = item->next;
+
+        item->func(ctx, item->data);
+        free(item);
+    }
+}
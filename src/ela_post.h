@@ -0,0 +1,60 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef ELA_POST_H
+#define ELA_POST_H
+
+/*
+  Cross-thread call queue for ela_post(). Producers push to a lock-free
+  stack and signal a single eventfd (a pipe where there is none) only
+  when the stack was empty, so a burst of posts wakes the loop once.
+  The loop thread watches the read side and drains everything in one
+  go, in posting order.
+ */
+
+#include <ela/ela.h>
+
+struct ela_post_item;
+
+struct ela_post_queue
+{
+    struct ela_post_item *head;
+    /** Read and write sides, the same eventfd when available, -1
+        if init failed */
+    int fd[2];
+    /** Init error, returned by pushes */
+    ela_error_t error;
+};
+
+/** On failure, the queue is still safe to use and release, pushes
+    return the same error. */
+ela_error_t ela_post_queue_init(struct ela_post_queue *queue);
+
+/** Close fds, pending calls are dropped. */
+void ela_post_queue_release(struct ela_post_queue *queue);
+
+/** Fd to watch for readability on the loop thread */
+static inline int ela_post_queue_fd(const struct ela_post_queue *queue)
+{
+    return queue->fd[0];
+}
+
+/** Thread-safe */
+ela_error_t ela_post_queue_push(struct ela_post_queue *queue,
+                                ela_post_func *func, void *data);
+
+/** Wake the loop up without queueing anything. Thread-safe. */
+void ela_post_queue_wake(struct ela_post_queue *queue);
+
+/** Run all queued calls, loop thread only */
+void ela_post_queue_drain(struct ela_post_queue *queue, struct ela_el *ctx);
+
+#endif
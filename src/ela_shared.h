@@ -0,0 +1,84 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef ELA_SHARED_H
+#define ELA_SHARED_H
+
+/*
+  Loop state while it runs from several threads, see ela_run_shared().
+  The lock is recursive and serializes every call on the loop. It is
+  only released while a thread sleeps in the poller or runs a source
+  handler. Waiting on the condition needs it held exactly once.
+ */
+
+#include <pthread.h>
+#include <ela/ela.h>
+#include <ela/backend.h>
+
+struct ela_shared
+{
+    pthread_mutex_t lock;
+    /** Signalled when a source handler returns, or dispatching
+        threads have something new to look at */
+    pthread_cond_t cond;
+    /** Times the lock holder took it */
+    int depth;
+};
+
+static inline ela_error_t ela_shared_init(struct ela_shared *shared)
+{
+    pthread_mutexattr_t attr;
+    ela_error_t err;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    shared->depth = 0;
+    err = pthread_mutex_init(&shared->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if ( err )
+        return err;
+
+    err = pthread_cond_init(&shared->cond, NULL);
+    if ( err )
+        pthread_mutex_destroy(&shared->lock);
+
+    return err;
+}
+
+static inline void ela_shared_release(struct ela_shared *shared)
+{
+    pthread_cond_destroy(&shared->cond);
+    pthread_mutex_destroy(&shared->lock);
+}
+
+static inline void ela_shared_lock(struct ela_el *ctx)
+{
+    if ( ctx->shared ) {
+        pthread_mutex_lock(&ctx->shared->lock);
+        ctx->shared->depth++;
+    }
+}
+
+static inline void ela_shared_unlock(struct ela_el *ctx)
+{
+    if ( ctx->shared ) {
+        ctx->shared->depth--;
+        pthread_mutex_unlock(&ctx->shared->lock);
+    }
+}
+
+/** Whether the caller, holding the lock, may wait on the condition */
+static inline int ela_shared_can_wait(struct ela_el *ctx)
+{
+    return ctx->shared->depth == 1;
+}
+
+#endif
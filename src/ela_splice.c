@@ -0,0 +1,388 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifdef __linux__
+# define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <ela/ela.h>
+#include <ela/splice.h>
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef __linux__
+
+#include <sys/sendfile.h>
+
+#define SPLICE_DEFAULT_CHUNK 65536
+/** Moves done in a row before letting other sources run */
+#define SPLICE_BURST 16
+
+#define SPLICE_MOVED 0
+#define SPLICE_WAIT_READ 1
+#define SPLICE_WAIT_WRITE 2
+#define SPLICE_DONE 3
+
+struct ela_splice
+{
+    struct ela_el *ctx;
+    int in_fd;
+    int out_fd;
+    /** Private pipe, unused with sendfile() */
+    int pipe[2];
+    int use_sendfile;
+    /** Regular files never make us wait, and cannot be watched */
+    int in_file;
+    int out_file;
+
+    size_t chunk;
+    uint64_t max;
+    uint64_t moved;
+    /** Bytes taken from the input, still in the pipe */
+    size_t in_pipe;
+    int eof;
+
+    ela_splice_func *func;
+    void *priv;
+
+    struct ela_event_source *reader;
+    struct ela_event_source *writer;
+    int reading;
+    int writing;
+    /** A deferred call is pending, it frees the relay if cancelled */
+    int deferred;
+    int cancelled;
+};
+
+static void _splice_free(struct ela_splice *sp)
+{
+    if ( sp->reader )
+        ela_source_free(sp->ctx, sp->reader);
+    if ( sp->writer )
+        ela_source_free(sp->ctx, sp->writer);
+    if ( sp->pipe[0] >= 0 ) {
+        close(sp->pipe[0]);
+        close(sp->pipe[1]);
+    }
+    free(sp);
+}
+
+static ela_error_t _splice_pipe_open(struct ela_splice *sp)
+{
+    int size;
+
+    if ( pipe2(sp->pipe, O_NONBLOCK | O_CLOEXEC) ) {
+        sp->pipe[0] = sp->pipe[1] = -1;
+        return errno;
+    }
+
+#ifdef F_SETPIPE_SZ
+    if ( sp->chunk > SPLICE_DEFAULT_CHUNK )
+        fcntl(sp->pipe[1], F_SETPIPE_SZ, (int)sp->chunk);
+    size = fcntl(sp->pipe[1], F_GETPIPE_SZ);
+    if ( size > 0 && (size_t)size < sp->chunk )
+        sp->chunk = size;
+#else
+    (void)size;
+#endif
+
+    return 0;
+}
+
+/* Bytes the next call may take from the input */
+static size_t _splice_len(const struct ela_splice *sp)
+{
+    uint64_t left;
+
+    if ( !sp->max )
+        return sp->chunk;
+
+    left = sp->max - sp->moved - sp->in_pipe;
+    return left < sp->chunk ? (size_t)left : sp->chunk;
+}
+
+static int _splice_sendfile(struct ela_splice *sp, ela_error_t *err)
+{
+    size_t len = _splice_len(sp);
+    ssize_t ret;
+
+    if ( len == 0 )
+        return SPLICE_DONE;
+
+    ret = sendfile(sp->out_fd, sp->in_fd, NULL, len);
+    if ( ret > 0 ) {
+        sp->moved += ret;
+        return SPLICE_MOVED;
+    }
+    if ( ret == 0 )
+        return SPLICE_DONE;
+
+    if ( errno == EAGAIN || errno == EINTR )
+        return SPLICE_WAIT_WRITE;
+
+    /* Output sendfile() cannot write to, go through a pipe */
+    if ( (errno == EINVAL || errno == ENOSYS) && sp->moved == 0 ) {
+        *err = _splice_pipe_open(sp);
+        if ( *err )
+            return SPLICE_DONE;
+        sp->use_sendfile = 0;
+        return SPLICE_MOVED;
+    }
+
+    *err = errno;
+    return SPLICE_DONE;
+}
+
+static int _splice_step(struct ela_splice *sp, ela_error_t *err)
+{
+    ssize_t ret;
+    size_t len;
+
+    if ( sp->use_sendfile )
+        return _splice_sendfile(sp, err);
+
+    if ( sp->in_pipe ) {
+        ret = splice(sp->pipe[0], NULL, sp->out_fd, NULL, sp->in_pipe,
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK
+                     | (sp->eof ? 0 : SPLICE_F_MORE));
+        if ( ret > 0 ) {
+            sp->in_pipe -= ret;
+            sp->moved += ret;
+            return SPLICE_MOVED;
+        }
+        if ( ret < 0 && (errno == EAGAIN || errno == EINTR) )
+            return SPLICE_WAIT_WRITE;
+
+        *err = ret < 0 ? errno : EPIPE;
+        return SPLICE_DONE;
+    }
+
+    len = _splice_len(sp);
+    if ( sp->eof || len == 0 )
+        return SPLICE_DONE;
+
+    ret = splice(sp->in_fd, NULL, sp->pipe[1], NULL, len,
+                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if ( ret > 0 ) {
+        sp->in_pipe = ret;
+        return SPLICE_MOVED;
+    }
+    if ( ret == 0 ) {
+        sp->eof = 1;
+        return SPLICE_DONE;
+    }
+    if ( errno == EAGAIN || errno == EINTR )
+        return SPLICE_WAIT_READ;
+
+    *err = errno;
+    return SPLICE_DONE;
+}
+
+/* Sources are only removed once added, added tells which ones are */
+static ela_error_t _splice_watch(struct ela_splice *sp,
+                                 struct ela_event_source *src,
+                                 int wanted, int *added)
+{
+    ela_error_t err;
+
+    if ( src == NULL || *added == wanted )
+        return 0;
+
+    if ( wanted ) {
+        err = ela_add(sp->ctx, src);
+        if ( err )
+            return err;
+    } else {
+        ela_remove(sp->ctx, src);
+    }
+
+    *added = wanted;
+    return 0;
+}
+
+static ela_error_t _splice_interest(struct ela_splice *sp,
+                                    int reading, int writing)
+{
+    ela_error_t err;
+
+    err = _splice_watch(sp, sp->reader, reading, &sp->reading);
+    if ( !err )
+        err = _splice_watch(sp, sp->writer, writing, &sp->writing);
+    return err;
+}
+
+static void _splice_deferred(struct ela_el *ctx, void *data);
+
+static void _splice_pump(struct ela_splice *sp)
+{
+    ela_error_t err = 0;
+    int i, state = SPLICE_MOVED;
+
+    for ( i = 0; i < SPLICE_BURST && state == SPLICE_MOVED; ++i )
+        state = _splice_step(sp, &err);
+
+    switch ( state ) {
+    case SPLICE_WAIT_READ:
+        if ( !sp->in_file ) {
+            err = _splice_interest(sp, 1, 0);
+            if ( !err )
+                return;
+            state = SPLICE_DONE;
+        }
+        break;
+
+    case SPLICE_WAIT_WRITE:
+        if ( !sp->out_file ) {
+            err = _splice_interest(sp, 0, 1);
+            if ( !err )
+                return;
+            state = SPLICE_DONE;
+        }
+        break;
+    }
+
+    if ( state == SPLICE_DONE ) {
+        _splice_interest(sp, 0, 0);
+        sp->func(sp->ctx, sp->moved, err, sp->priv);
+        _splice_free(sp);
+        return;
+    }
+
+    /* More to do, after other sources got their turn */
+    _splice_interest(sp, 0, 0);
+    err = ela_defer(sp->ctx, _splice_deferred, sp);
+    if ( err ) {
+        sp->func(sp->ctx, sp->moved, err, sp->priv);
+        _splice_free(sp);
+        return;
+    }
+    sp->deferred = 1;
+}
+
+static void _splice_deferred(struct ela_el *ctx, void *data)
+{
+    struct ela_splice *sp = data;
+
+    sp->deferred = 0;
+    if ( sp->cancelled )
+        _splice_free(sp);
+    else
+        _splice_pump(sp);
+}
+
+static
+void _splice_cb(struct ela_event_source *source, int fd,
+                uint32_t mask, void *data)
+{
+    _splice_pump(data);
+}
+
+static int _splice_is_file(int fd)
+{
+    struct stat st;
+
+    return !fstat(fd, &st) && S_ISREG(st.st_mode);
+}
+
+static ela_error_t _splice_source(struct ela_splice *sp, int fd,
+                                  uint32_t flags,
+                                  struct ela_event_source **ret)
+{
+    ela_error_t err;
+
+    err = ela_source_alloc(sp->ctx, _splice_cb, sp, ret);
+    if ( err )
+        return err;
+
+    return ela_set_fd(sp->ctx, *ret, fd, flags);
+}
+
+ELA_EXPORT
+ela_error_t ela_splice_pipe(struct ela_el *ctx, int in_fd, int out_fd,
+                            const struct ela_splice_opts *opts,
+                            struct ela_splice **ret)
+{
+    struct ela_splice *sp;
+    ela_error_t err = 0;
+
+    if ( opts->func == NULL )
+        return EINVAL;
+
+    sp = calloc(1, sizeof(*sp));
+    if ( sp == NULL )
+        return ENOMEM;
+
+    sp->ctx = ctx;
+    sp->in_fd = in_fd;
+    sp->out_fd = out_fd;
+    sp->pipe[0] = sp->pipe[1] = -1;
+    sp->chunk = opts->chunk ? opts->chunk : SPLICE_DEFAULT_CHUNK;
+    sp->max = opts->max;
+    sp->func = opts->func;
+    sp->priv = opts->priv;
+    sp->in_file = _splice_is_file(in_fd);
+    sp->out_file = _splice_is_file(out_fd);
+    sp->use_sendfile = sp->in_file;
+
+    if ( !sp->use_sendfile )
+        err = _splice_pipe_open(sp);
+    if ( !err && !sp->in_file )
+        err = _splice_source(sp, in_fd, ELA_EVENT_READABLE, &sp->reader);
+    if ( !err && !sp->out_file )
+        err = _splice_source(sp, out_fd, ELA_EVENT_WRITABLE, &sp->writer);
+    if ( !err )
+        err = ela_defer(ctx, _splice_deferred, sp);
+
+    if ( err ) {
+        _splice_free(sp);
+        return err;
+    }
+
+    sp->deferred = 1;
+    if ( ret )
+        *ret = sp;
+    return 0;
+}
+
+ELA_EXPORT
+void ela_splice_cancel(struct ela_splice *splice)
+{
+    _splice_interest(splice, 0, 0);
+
+    if ( splice->deferred )
+        splice->cancelled = 1;
+    else
+        _splice_free(splice);
+}
+
+#else
+
+ELA_EXPORT
+ela_error_t ela_splice_pipe(struct ela_el *ctx, int in_fd, int out_fd,
+                            const struct ela_splice_opts *opts,
+                            struct ela_splice **ret)
+{
+    return ENOTSUP;
+}
+
+ELA_EXPORT
+void ela_splice_cancel(struct ela_splice *splice)
+{
+}
+
+#endif
@@ -0,0 +1,730 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <ela/ela.h>
+#include <ela/stream.h>
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+/** Size of buffers the stream allocates */
+#define STREAM_SEG_SIZE 16384
+/** Fresh buffers a single read may fill at most */
+#define STREAM_READ_SEGS 4
+/** Segments a single write sends at most */
+#define STREAM_IOV_MAX 64
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
+/* Refcounted memory, owned or caller-provided */
+struct stream_buf
+{
+    unsigned int refs;
+    size_t size;
+    char *data;
+    /** Unset for caller memory, never written to then */
+    int owned;
+    ela_stream_release_func *release;
+    void *priv;
+    char storage[];
+};
+
+/* A view on part of a buffer, buffers may be shared between
+   segments of different streams */
+struct stream_seg
+{
+    struct stream_seg *next;
+    struct stream_buf *buf;
+    size_t start;
+    size_t end;
+};
+
+struct stream_chain
+{
+    struct stream_seg *head;
+    struct stream_seg *last;
+    size_t len;
+};
+
+struct ela_stream
+{
+    struct ela_el *ctx;
+    int fd;
+    ela_stream_func *func;
+    void *priv;
+
+    struct ela_event_source *reader;
+    struct ela_event_source *writer;
+    /** Sources currently added */
+    int reading;
+    int writing;
+    /** Input ended or failed, never read again */
+    int eof;
+    /** fd is not a socket, output goes through writev() */
+    int not_socket;
+    /** Queued output went above the low watermark since the last
+        ELA_STREAM_DRAINED */
+    int drain_wanted;
+
+    /** Callback nesting, destruction waits for it to drop to 0 */
+    int in_cb;
+    int destroyed;
+
+    size_t low;
+    size_t high;
+
+    struct stream_chain in;
+    struct stream_chain out;
+
+    /** Fresh buffers the next read may fill, grows while reads fill
+        all of them */
+    unsigned int read_segs;
+    /** Unused read buffers, kept for the next read */
+    struct stream_buf *spare[STREAM_READ_SEGS];
+    unsigned int spare_count;
+};
+
+static struct stream_buf *_buf_new(size_t size)
+{
+    struct stream_buf *buf = malloc(sizeof(*buf) + size);
+
+    if ( buf == NULL )
+        return NULL;
+
+    buf->refs = 1;
+    buf->size = size;
+    buf->data = buf->storage;
+    buf->owned = 1;
+    buf->release = NULL;
+    buf->priv = NULL;
+    return buf;
+}
+
+static void _buf_put(struct stream_buf *buf)
+{
+    if ( --buf->refs )
+        return;
+
+    if ( buf->release )
+        buf->release(buf->data, buf->priv);
+    free(buf);
+}
+
+static struct stream_seg *_seg_new(struct stream_buf *buf,
+                                   size_t start, size_t end)
+{
+    struct stream_seg *seg = malloc(sizeof(*seg));
+
+    if ( seg == NULL )
+        return NULL;
+
+    seg->next = NULL;
+    seg->buf = buf;
+    seg->start = start;
+    seg->end = end;
+    return seg;
+}
+
+static void _chain_init(struct stream_chain *chain)
+{
+    chain->head = NULL;
+    chain->last = NULL;
+    chain->len = 0;
+}
+
+static void _chain_append(struct stream_chain *chain, struct stream_seg *seg)
+{
+    seg->next = NULL;
+    if ( chain->last )
+        chain->last->next = seg;
+    else
+        chain->head = seg;
+    chain->last = seg;
+    chain->len += seg->end - seg->start;
+}
+
+static struct stream_seg *_chain_pop(struct stream_chain *chain)
+{
+    struct stream_seg *seg = chain->head;
+
+    chain->head = seg->next;
+    if ( chain->head == NULL )
+        chain->last = NULL;
+    chain->len -= seg->end - seg->start;
+    return seg;
+}
+
+static void _chain_drop(struct stream_chain *chain, size_t len)
+{
+    while ( len ) {
+        struct stream_seg *seg = chain->head;
+        size_t size = seg->end - seg->start;
+
+        if ( len < size ) {
+            seg->start += len;
+            chain->len -= len;
+            return;
+        }
+
+        _chain_pop(chain);
+        _buf_put(seg->buf);
+        free(seg);
+        len -= size;
+    }
+}
+
+static void _chain_clear(struct stream_chain *chain)
+{
+    _chain_drop(chain, chain->len);
+}
+
+/* Free room at the chain tail, only in owned buffers no other
+   segment refers to */
+static size_t _chain_room(const struct stream_chain *chain)
+{
+    const struct stream_seg *seg = chain->last;
+
+    if ( seg == NULL || !seg->buf->owned || seg->buf->refs != 1 )
+        return 0;
+
+    return seg->buf->size - seg->end;
+}
+
+/* Read interest follows the input watermarks */
+static void _stream_reading(struct ela_stream *s)
+{
+    if ( s->destroyed )
+        return;
+
+    if ( s->reading ) {
+        if ( s->eof || (s->high && s->in.len >= s->high) ) {
+            ela_remove(s->ctx, s->reader);
+            s->reading = 0;
+        }
+    } else if ( !s->eof && (!s->high || s->in.len <= s->low) ) {
+        if ( !ela_add(s->ctx, s->reader) )
+            s->reading = 1;
+    }
+}
+
+/* Write interest lasts as long as output is queued */
+static void _stream_writing(struct ela_stream *s)
+{
+    if ( s->destroyed )
+        return;
+
+    if ( s->out.len > s->low )
+        s->drain_wanted = 1;
+
+    if ( s->writing && s->out.len == 0 ) {
+        ela_remove(s->ctx, s->writer);
+        s->writing = 0;
+    } else if ( !s->writing && s->out.len ) {
+        if ( !ela_add(s->ctx, s->writer) )
+            s->writing = 1;
+    }
+}
+
+static void _stream_free(struct ela_stream *s)
+{
+    unsigned int i;
+
+    if ( s->reader )
+        ela_source_free(s->ctx, s->reader);
+    if ( s->writer )
+        ela_source_free(s->ctx, s->writer);
+
+    _chain_clear(&s->in);
+    _chain_clear(&s->out);
+    for ( i = 0; i < s->spare_count; ++i )
+        free(s->spare[i]);
+    free(s);
+}
+
+/* Stream may be gone once this returns */
+static void _stream_call(struct ela_stream *s, uint32_t events,
+                         ela_error_t err)
+{
+    s->in_cb++;
+    s->func(s, events, err, s->priv);
+    s->in_cb--;
+
+    if ( !s->in_cb && s->destroyed )
+        _stream_free(s);
+}
+
+/* One readv() into the tail room of input, then fresh buffers */
+static ssize_t _stream_fill(struct ela_stream *s)
+{
+    struct iovec iov[STREAM_READ_SEGS + 1];
+    struct stream_buf *bufs[STREAM_READ_SEGS];
+    size_t limit = SIZE_MAX, room, fresh = 0;
+    unsigned int nbufs = 0, i;
+    ssize_t ret, left;
+    int n = 0;
+
+    if ( s->high )
+        limit = s->in.len < s->high ? s->high - s->in.len : 0;
+
+    room = _chain_room(&s->in);
+    if ( room && limit ) {
+        iov[n].iov_base = s->in.last->buf->data + s->in.last->end;
+        iov[n].iov_len = room < limit ? room : limit;
+        limit -= iov[n].iov_len;
+        n++;
+    }
+    room = n ? iov[0].iov_len : 0;
+
+    while ( limit && nbufs < s->read_segs ) {
+        struct stream_buf *buf = s->spare_count
+            ? s->spare[--s->spare_count]
+            : _buf_new(STREAM_SEG_SIZE);
+
+        if ( buf == NULL )
+            break;
+
+        bufs[nbufs++] = buf;
+        iov[n].iov_base = buf->data;
+        iov[n].iov_len = buf->size < limit ? buf->size : limit;
+        limit -= iov[n].iov_len;
+        fresh += iov[n].iov_len;
+        n++;
+    }
+
+    /* Callers check the limit, no iovec means no buffer */
+    if ( n == 0 )
+        return -ENOMEM;
+
+    ret = readv(s->fd, iov, n);
+    if ( ret < 0 )
+        ret = -errno;
+    left = ret > 0 ? ret : 0;
+
+    if ( room && left ) {
+        size_t len = (size_t)left < room ? (size_t)left : room;
+
+        s->in.last->end += len;
+        s->in.len += len;
+        left -= len;
+    }
+
+    /* Fresh buffers follow what reads need, up to the limit */
+    if ( nbufs == s->read_segs ) {
+        if ( (size_t)left == fresh && s->read_segs < STREAM_READ_SEGS )
+            s->read_segs++;
+        else if ( (size_t)left <= fresh / 2 && s->read_segs > 1 )
+            s->read_segs--;
+    }
+
+    for ( i = 0; i < nbufs; ++i ) {
+        struct stream_buf *buf = bufs[i];
+        size_t len = iov[n - nbufs + i].iov_len;
+        struct stream_seg *seg;
+
+        if ( (size_t)left < len )
+            len = left;
+        left -= len;
+
+        if ( len == 0 ) {
+            s->spare[s->spare_count++] = buf;
+            continue;
+        }
+
+        seg = _seg_new(buf, 0, len);
+        if ( seg == NULL ) {
+            free(buf);
+            ret = -ENOMEM;
+            continue;
+        }
+        _chain_append(&s->in, seg);
+    }
+
+    /* Keep as many spares as reads need */
+    while ( s->spare_count > s->read_segs )
+        free(s->spare[--s->spare_count]);
+
+    return ret;
+}
+
+static
+void _stream_read_cb(struct ela_event_source *source, int fd,
+                     uint32_t mask, void *data)
+{
+    struct ela_stream *s = data;
+    uint32_t events;
+    ela_error_t err = 0;
+    ssize_t ret;
+
+    /* Readiness may still get reported with input full, this is no
+       error, just no room */
+    if ( s->high && s->in.len >= s->high ) {
+        _stream_reading(s);
+        return;
+    }
+
+    ret = _stream_fill(s);
+
+    if ( ret > 0 ) {
+        events = ELA_STREAM_READ;
+    } else if ( ret == 0 ) {
+        events = ELA_STREAM_EOF;
+        s->eof = 1;
+    } else if ( ret == -EAGAIN || ret == -EWOULDBLOCK || ret == -EINTR ) {
+        return;
+    } else {
+        events = ELA_STREAM_ERROR;
+        err = -ret;
+        s->eof = 1;
+    }
+
+    _stream_reading(s);
+    _stream_call(s, events, err);
+}
+
+/* One write of queued output, 0 or the error after which output got
+   dropped */
+static ela_error_t _stream_send(struct ela_stream *s)
+{
+    struct iovec iov[STREAM_IOV_MAX];
+    struct stream_seg *seg;
+    ssize_t ret;
+    int n = 0;
+
+    if ( s->out.len == 0 )
+        return 0;
+
+    for ( seg = s->out.head; seg && n < STREAM_IOV_MAX; seg = seg->next ) {
+        iov[n].iov_base = seg->buf->data + seg->start;
+        iov[n].iov_len = seg->end - seg->start;
+        n++;
+    }
+
+    if ( s->not_socket ) {
+        ret = writev(s->fd, iov, n);
+    } else {
+        /* A write to a closed peer must not raise SIGPIPE */
+        struct msghdr msg;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+        ret = sendmsg(s->fd, &msg, MSG_NOSIGNAL);
+        if ( ret < 0 && errno == ENOTSOCK ) {
+            s->not_socket = 1;
+            ret = writev(s->fd, iov, n);
+        }
+    }
+
+    if ( ret >= 0 ) {
+        _chain_drop(&s->out, ret);
+    } else if ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) {
+        ela_error_t err = errno;
+
+        _chain_clear(&s->out);
+        _stream_writing(s);
+        return err;
+    }
+
+    _stream_writing(s);
+    return 0;
+}
+
+static
+void _stream_write_cb(struct ela_event_source *source, int fd,
+                      uint32_t mask, void *data)
+{
+    struct ela_stream *s = data;
+    ela_error_t err;
+
+    err = _stream_send(s);
+
+    if ( err ) {
+        s->drain_wanted = 0;
+        _stream_call(s, ELA_STREAM_ERROR, err);
+    } else if ( s->drain_wanted && s->out.len <= s->low ) {
+        s->drain_wanted = 0;
+        _stream_call(s, ELA_STREAM_DRAINED, 0);
+    }
+}
+
+static ela_error_t _stream_source(struct ela_stream *s,
+                                  ela_handler_func *func, uint32_t flags,
+                                  struct ela_event_source **ret)
+{
+    ela_error_t err;
+
+    err = ela_source_alloc(s->ctx, func, s, ret);
+    if ( err )
+        return err;
+
+    return ela_set_fd(s->ctx, *ret, s->fd, flags);
+}
+
+ELA_EXPORT
+ela_error_t ela_stream_create(struct ela_el *ctx, int fd,
+                              ela_stream_func *func, void *priv,
+                              struct ela_stream **ret)
+{
+    struct ela_stream *s;
+    ela_error_t err;
+
+    s = calloc(1, sizeof(*s));
+    if ( s == NULL )
+        return ENOMEM;
+
+    s->ctx = ctx;
+    s->fd = fd;
+    s->func = func;
+    s->priv = priv;
+    s->read_segs = 1;
+    _chain_init(&s->in);
+    _chain_init(&s->out);
+
+    err = _stream_source(s, _stream_read_cb, ELA_EVENT_READABLE, &s->reader);
+    if ( !err )
+        err = _stream_source(s, _stream_write_cb, ELA_EVENT_WRITABLE,
+                             &s->writer);
+    if ( !err )
+        err = ela_add(ctx, s->reader);
+
+    if ( err ) {
+        _stream_free(s);
+        return err;
+    }
+
+    s->reading = 1;
+    *ret = s;
+    return 0;
+}
+
+ELA_EXPORT
+void ela_stream_destroy(struct ela_stream *stream)
+{
+    if ( stream->reading )
+        ela_remove(stream->ctx, stream->reader);
+    if ( stream->writing )
+        ela_remove(stream->ctx, stream->writer);
+    stream->reading = 0;
+    stream->writing = 0;
+    stream->destroyed = 1;
+
+    if ( !stream->in_cb )
+        _stream_free(stream);
+}
+
+ELA_EXPORT
+ela_error_t ela_stream_set_watermarks(struct ela_stream *stream,
+                                      size_t low, size_t high)
+{
+    if ( high && high <= low )
+        return EINVAL;
+
+    stream->low = low;
+    stream->high = high;
+    _stream_reading(stream);
+    _stream_writing(stream);
+    return 0;
+}
+
+ELA_EXPORT
+size_t ela_stream_readable(const struct ela_stream *stream)
+{
+    return stream->in.len;
+}
+
+ELA_EXPORT
+int ela_stream_peek(const struct ela_stream *stream,
+                    struct iovec *iov, int iovcnt)
+{
+    const struct stream_seg *seg;
+    int n = 0;
+
+    for ( seg = stream->in.head; seg && n < iovcnt; seg = seg->next ) {
+        iov[n].iov_base = seg->buf->data + seg->start;
+        iov[n].iov_len = seg->end - seg->start;
+        n++;
+    }
+
+    return n;
+}
+
+ELA_EXPORT
+void ela_stream_consume(struct ela_stream *stream, size_t len)
+{
+    if ( len > stream->in.len )
+        len = stream->in.len;
+
+    _chain_drop(&stream->in, len);
+    _stream_reading(stream);
+}
+
+ELA_EXPORT
+size_t ela_stream_read(struct ela_stream *stream, void *buf, size_t len)
+{
+    const struct stream_seg *seg;
+    size_t done = 0;
+
+    for ( seg = stream->in.head; seg && done < len; seg = seg->next ) {
+        size_t size = seg->end - seg->start;
+
+        if ( size > len - done )
+            size = len - done;
+        memcpy((char *)buf + done, seg->buf->data + seg->start, size);
+        done += size;
+    }
+
+    ela_stream_consume(stream, done);
+    return done;
+}
+
+ELA_EXPORT
+ela_error_t ela_stream_write(struct ela_stream *stream,
+                             const void *data, size_t len)
+{
+    size_t room = _chain_room(&stream->out);
+
+    if ( room ) {
+        struct stream_seg *last = stream->out.last;
+
+        if ( room > len )
+            room = len;
+        memcpy(last->buf->data + last->end, data, room);
+        last->end += room;
+        stream->out.len += room;
+        data = (const char *)data + room;
+        len -= room;
+    }
+
+    if ( len ) {
+        struct stream_buf *buf;
+        struct stream_seg *seg;
+
+        buf = _buf_new(len > STREAM_SEG_SIZE ? len : STREAM_SEG_SIZE);
+        if ( buf == NULL )
+            return ENOMEM;
+
+        seg = _seg_new(buf, 0, len);
+        if ( seg == NULL ) {
+            free(buf);
+            return ENOMEM;
+        }
+
+        memcpy(buf->data, data, len);
+        _chain_append(&stream->out, seg);
+    }
+
+    _stream_writing(stream);
+    return 0;
+}
+
+ELA_EXPORT
+ela_error_t ela_stream_write_ref(struct ela_stream *stream,
+                                 const void *data, size_t len,
+                                 ela_stream_release_func *release,
+                                 void *priv)
+{
+    struct stream_buf *buf;
+    struct stream_seg *seg = NULL;
+
+    if ( len == 0 ) {
+        if ( release )
+            release(data, priv);
+        return 0;
+    }
+
+    buf = malloc(sizeof(*buf));
+    if ( buf )
+        seg = _seg_new(buf, 0, len);
+
+    if ( seg == NULL ) {
+        free(buf);
+        if ( release )
+            release(data, priv);
+        return ENOMEM;
+    }
+
+    buf->refs = 1;
+    buf->size = len;
+    buf->data = (char *)data;
+    buf->owned = 0;
+    buf->release = release;
+    buf->priv = priv;
+
+    _chain_append(&stream->out, seg);
+    _stream_writing(stream);
+    return 0;
+}
+
+ELA_EXPORT
+size_t ela_stream_forward(struct ela_stream *from, struct ela_stream *to,
+                          size_t len)
+{
+    size_t moved = 0;
+
+    if ( to->high ) {
+        if ( to->out.len >= to->high )
+            return 0;
+        if ( len > to->high - to->out.len )
+            len = to->high - to->out.len;
+    }
+    if ( len > from->in.len )
+        len = from->in.len;
+
+    while ( moved < len ) {
+        struct stream_seg *seg = from->in.head;
+        size_t size = seg->end - seg->start;
+
+        if ( size <= len - moved ) {
+            _chain_append(&to->out, _chain_pop(&from->in));
+            moved += size;
+        } else {
+            /* Split, both parts share the buffer */
+            size_t part = len - moved;
+            struct stream_seg *head;
+
+            head = _seg_new(seg->buf, seg->start, seg->start + part);
+            if ( head == NULL )
+                break;
+
+            seg->buf->refs++;
+            seg->start += part;
+            from->in.len -= part;
+            _chain_append(&to->out, head);
+            moved += part;
+        }
+    }
+
+    _stream_reading(from);
+    _stream_writing(to);
+    return moved;
+}
+
+ELA_EXPORT
+size_t ela_stream_queued(const struct ela_stream *stream)
+{
+    return stream->out.len;
+}
+
+ELA_EXPORT
+ela_error_t ela_stream_flush(struct ela_stream *stream)
+{
+    return _stream_send(stream);
+}
@@ -0,0 +1,62 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef ELA_TIME_H
+#define ELA_TIME_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+
+/** Monotonic time, in ns */
+static inline uint64_t ela_time_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t ela_time_from_tv(const struct timeval *tv)
+{
+    return (uint64_t)tv->tv_sec * 1000000000ULL + tv->tv_usec * 1000ULL;
+}
+
+static inline uint64_t ela_time_from_ts(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static inline struct timespec ela_time_to_ts(uint64_t ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    return ts;
+}
+
+/*
+  Pick the deadline in [deadline, deadline + slack] that is aligned on
+  the coarsest power of two. Timers with overlapping windows end up on
+  the same instant and expire in one wakeup.
+ */
+static inline uint64_t ela_time_coalesce(uint64_t deadline, uint64_t slack)
+{
+    uint64_t last = deadline + slack;
+
+    if ( slack == 0 || deadline == 0 || last < deadline )
+        return deadline;
+
+    return last & ~((1ULL << (63 - __builtin_clzll((deadline - 1) ^ last))) - 1);
+}
+
+#endif
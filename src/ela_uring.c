@@ -0,0 +1,692 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <ela/ela.h>
+#include <ela/backend.h>
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <linux/io_uring.h>
+
+#include "ela_native.h"
+
+/*
+  FD watches are multishot poll requests, one per fd, carrying the
+  merged interest of all the sources on that fd. Multishot poll only
+  reports wakeups, so level-triggered behavior is obtained by queueing
+  a single-shot "recheck" poll after each report: it completes
+  immediately on the next submission if the fd is still ready.
+  Edge-triggered fds simply go without it.
+
+  The nearest timer deadline is a single absolute IORING_OP_TIMEOUT.
+
+  Nothing is submitted on registration: SQEs accumulate and go to the
+  kernel in the one io_uring_enter() the loop does per iteration.
+
+  Note a pending poll holds a reference on the watched file: sources
+  must be removed before their fd is closed for the close to take
+  effect.
+ */
+
+#define URING_ENTRIES 256
+
+#define UD_KIND_SHIFT 60
+#define UD_IGNORE 0ULL
+#define UD_POLL 1ULL
+#define UD_RECHECK 2ULL
+#define UD_TIMER 3ULL
+#define UD_OP 4ULL
+#define UD_PTR_MASK ((1ULL << UD_KIND_SHIFT) - 1)
+
+#define UD_FD(fd, gen, kind) \
+    (((kind) << UD_KIND_SHIFT) \
+     | ((uint64_t)((gen) & 0x0fffffff) << 32) \
+     | (uint32_t)(fd))
+
+struct uring_mainloop
+{
+    struct native_loop base;
+    int ring_fd;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    void *cq_ring;
+    size_t cq_ring_size;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /** Armed loop timer, NATIVE_WAIT_FOREVER if none */
+    uint64_t timer_deadline;
+    uint64_t timer_seq;
+    struct __kernel_timespec timer_ts;
+
+    /** Kernel has multishot recv/accept and provided buffer rings */
+    int has_multishot;
+};
+
+/*
+  Multishot recv/accept request. Outlives its source until the kernel
+  posts the final completion.
+ */
+struct uring_op
+{
+    struct ela_event_source *src;
+    int op;
+    int fd;
+    struct ela_buffer_group *group;
+};
+
+struct uring_buf_ring
+{
+    struct io_uring_buf_ring *ring;
+    unsigned int mask;
+};
+
+static uint32_t _poll_mask(uint32_t events)
+{
+    uint32_t mask = 0;
+
+    if ( events & ELA_EVENT_READABLE ) mask |= POLLIN;
+    if ( events & ELA_EVENT_WRITABLE ) mask |= POLLOUT;
+
+#if __BYTE_ORDER == __BIG_ENDIAN
+    mask = (mask << 16) | (mask >> 16);
+#endif
+    return mask;
+}
+
+static int _enter(struct uring_mainloop *ctx,
+                  unsigned min_complete, unsigned flags)
+{
+    unsigned to_submit = *ctx->sq_tail
+        - __atomic_load_n(ctx->sq_head, __ATOMIC_ACQUIRE);
+
+    return syscall(__NR_io_uring_enter, ctx->ring_fd, to_submit,
+                   min_complete, flags, NULL, 0);
+}
+
+static struct io_uring_sqe *_sqe_get(struct uring_mainloop *ctx)
+{
+    unsigned tail = *ctx->sq_tail;
+    struct io_uring_sqe *sqe;
+
+    if ( tail - __atomic_load_n(ctx->sq_head, __ATOMIC_ACQUIRE)
+         >= ctx->sq_entries ) {
+        _enter(ctx, 0, 0);
+        if ( tail - __atomic_load_n(ctx->sq_head, __ATOMIC_ACQUIRE)
+             >= ctx->sq_entries )
+            return NULL;
+    }
+
+    sqe = &ctx->sqes[tail & ctx->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ctx->sq_array[tail & ctx->sq_mask] = tail & ctx->sq_mask;
+
+    return sqe;
+}
+
+static void _sqe_commit(struct uring_mainloop *ctx)
+{
+    __atomic_store_n(ctx->sq_tail, *ctx->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+static ela_error_t _queue_poll(struct uring_mainloop *ctx, int fd,
+                               uint64_t kind)
+{
+    struct native_fd *entry = &ctx->base.fds[fd];
+    struct io_uring_sqe *sqe = _sqe_get(ctx);
+
+    if ( sqe == NULL )
+        return EBUSY;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = _poll_mask(entry->events);
+    sqe->user_data = UD_FD(fd, entry->gen, kind);
+    if ( kind == UD_POLL )
+        sqe->len = IORING_POLL_ADD_MULTI;
+    else
+        entry->pending = 1;
+
+    _sqe_commit(ctx);
+    return 0;
+}
+
+static void _queue_cancel(struct uring_mainloop *ctx, uint8_t opcode,
+                          uint64_t target)
+{
+    struct io_uring_sqe *sqe = _sqe_get(ctx);
+
+    if ( sqe == NULL )
+        return;
+
+    sqe->opcode = opcode;
+    sqe->addr = target;
+    sqe->user_data = UD_IGNORE;
+    _sqe_commit(ctx);
+}
+
+static
+ela_error_t _ela_uring_fd_update(struct native_loop *loop, int fd,
+                                 uint32_t events)
+{
+    struct uring_mainloop *ctx = (struct uring_mainloop *)loop;
+    struct native_fd *entry = &loop->fds[fd];
+    ela_error_t err;
+
+    if ( entry->events )
+        _queue_cancel(ctx, IORING_OP_POLL_REMOVE,
+                      UD_FD(fd, entry->gen, UD_POLL));
+    if ( entry->pending )
+        _queue_cancel(ctx, IORING_OP_POLL_REMOVE,
+                      UD_FD(fd, entry->gen, UD_RECHECK));
+
+    entry->gen++;
+    entry->pending = 0;
+    entry->events = events;
+
+    if ( events == 0 )
+        return 0;
+
+    err = _queue_poll(ctx, fd, UD_POLL);
+    if ( err )
+        entry->events = 0;
+
+    return err;
+}
+
+static void _timer_arm(struct uring_mainloop *ctx, uint64_t deadline)
+{
+    struct io_uring_sqe *sqe;
+
+    if ( deadline == ctx->timer_deadline )
+        return;
+
+    if ( ctx->timer_deadline != NATIVE_WAIT_FOREVER )
+        _queue_cancel(ctx, IORING_OP_TIMEOUT_REMOVE,
+                      (UD_TIMER << UD_KIND_SHIFT) | ctx->timer_seq);
+
+    ctx->timer_deadline = NATIVE_WAIT_FOREVER;
+    ctx->timer_seq = (ctx->timer_seq + 1) & ((1ULL << UD_KIND_SHIFT) - 1);
+
+    sqe = _sqe_get(ctx);
+    if ( sqe == NULL )
+        return;
+
+    ctx->timer_ts.tv_sec = deadline / 1000000000ULL;
+    ctx->timer_ts.tv_nsec = deadline % 1000000000ULL;
+
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (uintptr_t)&ctx->timer_ts;
+    sqe->len = 1;
+    sqe->timeout_flags = IORING_TIMEOUT_ABS;
+    sqe->user_data = (UD_TIMER << UD_KIND_SHIFT) | ctx->timer_seq;
+    _sqe_commit(ctx);
+
+    ctx->timer_deadline = deadline;
+}
+
+#ifdef IORING_RECV_MULTISHOT
+
+static void _buf_recycle(struct ela_buffer_group *group, unsigned int bid)
+{
+    struct uring_buf_ring *br = group->backend_data;
+    uint16_t tail = br->ring->tail;
+    struct io_uring_buf *buf = &br->ring->bufs[tail & br->mask];
+
+    buf->addr = (uintptr_t)(group->mem + bid * group->size);
+    buf->len = group->size;
+    buf->bid = bid;
+
+    __atomic_store_n(&br->ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static
+ela_error_t _ela_uring_buffer_group_init(struct native_loop *loop,
+                                         struct ela_buffer_group *group)
+{
+    struct uring_mainloop *ctx = (struct uring_mainloop *)loop;
+    struct io_uring_buf_reg reg;
+    struct uring_buf_ring *br;
+    unsigned int i;
+
+    if ( !ctx->has_multishot || group->count > 32768 )
+        return ENOTSUP;
+
+    br = malloc(sizeof(*br));
+    if ( br == NULL )
+        return ENOMEM;
+
+    if ( posix_memalign((void **)&br->ring, sysconf(_SC_PAGESIZE),
+                        group->count * sizeof(struct io_uring_buf)) ) {
+        free(br);
+        return ENOMEM;
+    }
+
+    memset(br->ring, 0, group->count * sizeof(struct io_uring_buf));
+    br->mask = group->count - 1;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)br->ring;
+    reg.ring_entries = group->count;
+    reg.bgid = group->id;
+
+    if ( syscall(__NR_io_uring_register, ctx->ring_fd,
+                 IORING_REGISTER_PBUF_RING, &reg, 1) ) {
+        ela_error_t err = errno;
+        free(br->ring);
+        free(br);
+        return err;
+    }
+
+    group->backend_data = br;
+    for ( i = 0; i < group->count; ++i )
+        _buf_recycle(group, i);
+
+    return 0;
+}
+
+static
+void _ela_uring_buffer_group_release(struct native_loop *loop,
+                                     struct ela_buffer_group *group)
+{
+    struct uring_mainloop *ctx = (struct uring_mainloop *)loop;
+    struct uring_buf_ring *br = group->backend_data;
+    struct io_uring_buf_reg reg;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = group->id;
+    syscall(__NR_io_uring_register, ctx->ring_fd,
+            IORING_UNREGISTER_PBUF_RING, &reg, 1);
+
+    free(br->ring);
+    free(br);
+    group->backend_data = NULL;
+}
+
+static ela_error_t _queue_op(struct uring_mainloop *ctx, struct uring_op *op)
+{
+    struct io_uring_sqe *sqe = _sqe_get(ctx);
+
+    if ( sqe == NULL )
+        return EBUSY;
+
+    sqe->fd = op->fd;
+    sqe->user_data = (UD_OP << UD_KIND_SHIFT) | (uintptr_t)op;
+
+    if ( op->op == ELA_COMPLETION_RECV ) {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = op->group->id;
+    } else {
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK|SOCK_CLOEXEC;
+    }
+
+    _sqe_commit(ctx);
+    return 0;
+}
+
+static
+ela_error_t _ela_uring_completion_start(struct native_loop *loop,
+                                        struct ela_event_source *src,
+                                        int kind, int fd,
+                                        struct ela_buffer_group *group,
+                                        void **token)
+{
+    struct uring_mainloop *ctx = (struct uring_mainloop *)loop;
+    struct uring_op *op;
+    ela_error_t err;
+
+    if ( !ctx->has_multishot )
+        return ENOTSUP;
+
+    op = malloc(sizeof(*op));
+    if ( op == NULL )
+        return ENOMEM;
+
+    op->src = src;
+    op->op = kind;
+    op->fd = fd;
+    op->group = group;
+
+    err = _queue_op(ctx, op);
+    if ( err ) {
+        free(op);
+        return err;
+    }
+
+    *token = op;
+    return 0;
+}
+
+static
+void _ela_uring_completion_stop(struct native_loop *loop, void *token)
+{
+    struct uring_mainloop *ctx = (struct uring_mainloop *)loop;
+    struct uring_op *op = token;
+
+    op->src = NULL;
+    _queue_cancel(ctx, IORING_OP_ASYNC_CANCEL,
+                  (UD_OP << UD_KIND_SHIFT) | (uintptr_t)op);
+}
+
+static void _cqe_handle_op(struct uring_mainloop *ctx,
+                           const struct io_uring_cqe *cqe)
+{
+    struct uring_op *op = (struct uring_op *)(uintptr_t)
+        (cqe->user_data & UD_PTR_MASK);
+    int more = cqe->flags & IORING_CQE_F_MORE;
+    const void *buf = NULL;
+    int bid = -1;
+
+    if ( cqe->flags & IORING_CQE_F_BUFFER ) {
+        bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        buf = op->group->mem + bid * op->group->size;
+    }
+
+    if ( op->src && cqe->res == -ENOBUFS ) {
+        /* Out of buffers, they get recycled as callbacks return */
+        if ( !more ) {
+            struct ela_event_source *src = op->src;
+
+            if ( _queue_op(ctx, op) == 0 )
+                return;
+
+            /* Ring still full, end the op rather than leave the source
+               pointing at it */
+            free(op);
+            ela_native_complete(&ctx->base, src, -ENOBUFS, NULL, 0);
+            return;
+        }
+    } else if ( op->src && (cqe->res > 0
+                            || (cqe->res == 0
+                                && op->op == ELA_COMPLETION_ACCEPT)) ) {
+        ela_native_complete(&ctx->base, op->src, cqe->res, buf, 1);
+
+        if ( bid >= 0 )
+            _buf_recycle(op->group, bid);
+
+        if ( more )
+            return;
+        if ( op->src && _queue_op(ctx, op) == 0 )
+            return;
+        if ( op->src )
+            ela_native_complete(&ctx->base, op->src, -EBUSY, NULL, 0);
+
+        free(op);
+        return;
+    } else if ( op->src ) {
+        /* End of stream or error */
+        struct ela_event_source *src = op->src;
+        struct ela_buffer_group *group = op->group;
+
+        if ( !more )
+            free(op);
+
+        ela_native_complete(&ctx->base, src, cqe->res, buf, more);
+
+        if ( bid >= 0 )
+            _buf_recycle(group, bid);
+        return;
+    }
+
+    if ( bid >= 0 )
+        _buf_recycle(op->group, bid);
+
+    if ( !more )
+        free(op);
+}
+
+#endif
+
+static void _cqe_handle(struct uring_mainloop *ctx,
+                        const struct io_uring_cqe *cqe)
+{
+    uint64_t kind = cqe->user_data >> UD_KIND_SHIFT;
+    int fd = (int)(uint32_t)cqe->user_data;
+    uint32_t gen = (cqe->user_data >> 32) & 0x0fffffff;
+    struct native_fd *entry;
+    uint32_t mask = 0;
+
+    switch ( kind ) {
+    case UD_TIMER:
+        if ( (cqe->user_data & ((1ULL << UD_KIND_SHIFT) - 1))
+             == ctx->timer_seq )
+            ctx->timer_deadline = NATIVE_WAIT_FOREVER;
+        return;
+
+#ifdef IORING_RECV_MULTISHOT
+    case UD_OP:
+        _cqe_handle_op(ctx, cqe);
+        return;
+#endif
+
+    case UD_POLL:
+    case UD_RECHECK:
+        break;
+
+    default:
+        return;
+    }
+
+    if ( (size_t)fd >= ctx->base.fd_size )
+        return;
+
+    entry = &ctx->base.fds[fd];
+    if ( gen != (entry->gen & 0x0fffffff) || entry->events == 0 )
+        return;
+
+    if ( kind == UD_RECHECK )
+        entry->pending = 0;
+    else if ( !(cqe->flags & IORING_CQE_F_MORE) && cqe->res >= 0 )
+        /* Multishot got terminated by the kernel, restart it */
+        _queue_poll(ctx, fd, UD_POLL);
+
+    if ( cqe->res < 0 )
+        return;
+
+    if ( cqe->res & (POLLIN|POLLERR|POLLHUP) )
+        mask |= ELA_EVENT_READABLE;
+    if ( cqe->res & (POLLOUT|POLLERR|POLLHUP) )
+        mask |= ELA_EVENT_WRITABLE;
+
+    ela_native_fd_ready(&ctx->base, fd, mask);
+
+    if ( !entry->pending && !(entry->events & ELA_EVENT_EDGE) )
+        _queue_poll(ctx, fd, UD_RECHECK);
+}
+
+static
+void _ela_uring_wait(struct native_loop *loop, uint64_t deadline)
+{
+    struct uring_mainloop *ctx = (struct uring_mainloop *)loop;
+    unsigned head, tail;
+
+    if ( deadline != NATIVE_WAIT_FOREVER && deadline != NATIVE_WAIT_NONE )
+        _timer_arm(ctx, deadline);
+
+    _enter(ctx, deadline == NATIVE_WAIT_NONE ? 0 : 1,
+           IORING_ENTER_GETEVENTS);
+
+    head = *ctx->cq_head;
+    tail = __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE);
+
+    for ( ; head != tail; ++head )
+        _cqe_handle(ctx, &ctx->cqes[head & ctx->cq_mask]);
+
+    __atomic_store_n(ctx->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void _ring_unmap(struct uring_mainloop *ctx)
+{
+    if ( ctx->sqes )
+        munmap(ctx->sqes, ctx->sqes_size);
+    if ( ctx->cq_ring )
+        munmap(ctx->cq_ring, ctx->cq_ring_size);
+    if ( ctx->sq_ring )
+        munmap(ctx->sq_ring, ctx->sq_ring_size);
+}
+
+static
+void _ela_uring_close(struct native_loop *loop)
+{
+    struct uring_mainloop *ctx = (struct uring_mainloop *)loop;
+
+    _ring_unmap(ctx);
+    close(ctx->ring_fd);
+}
+
+static int _ring_setup(struct uring_mainloop *ctx)
+{
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset(&p, 0, sizeof(p));
+
+    ctx->ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if ( ctx->ring_fd < 0 )
+        return -1;
+
+    /* Multishot poll and absolute timeouts need at least 5.17 */
+    if ( !(p.features & IORING_FEAT_CQE_SKIP) )
+        goto fail;
+
+    ctx->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ctx->cq_ring_size = p.cq_off.cqes
+        + p.cq_entries * sizeof(struct io_uring_cqe);
+    ctx->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    sq = mmap(NULL, ctx->sq_ring_size, PROT_READ|PROT_WRITE,
+              MAP_SHARED|MAP_POPULATE, ctx->ring_fd, IORING_OFF_SQ_RING);
+    if ( sq == MAP_FAILED )
+        goto fail;
+    ctx->sq_ring = sq;
+
+    cq = mmap(NULL, ctx->cq_ring_size, PROT_READ|PROT_WRITE,
+              MAP_SHARED|MAP_POPULATE, ctx->ring_fd, IORING_OFF_CQ_RING);
+    if ( cq == MAP_FAILED )
+        goto fail;
+    ctx->cq_ring = cq;
+
+    ctx->sqes = mmap(NULL, ctx->sqes_size, PROT_READ|PROT_WRITE,
+                     MAP_SHARED|MAP_POPULATE, ctx->ring_fd, IORING_OFF_SQES);
+    if ( ctx->sqes == MAP_FAILED ) {
+        ctx->sqes = NULL;
+        goto fail;
+    }
+
+    ctx->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ctx->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ctx->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    ctx->sq_entries = p.sq_entries;
+    ctx->sq_array = (unsigned *)(sq + p.sq_off.array);
+
+    ctx->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ctx->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ctx->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    ctx->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+#ifdef IORING_RECV_MULTISHOT
+    {
+        /* Multishot recv came with 6.0, like IORING_OP_SEND_ZC */
+        size_t size = sizeof(struct io_uring_probe)
+            + 256 * sizeof(struct io_uring_probe_op);
+        struct io_uring_probe *probe = calloc(1, size);
+
+        if ( probe
+             && !syscall(__NR_io_uring_register, ctx->ring_fd,
+                         IORING_REGISTER_PROBE, probe, 256)
+             && probe->last_op >= IORING_OP_SEND_ZC )
+            ctx->has_multishot = 1;
+
+        free(probe);
+    }
+#endif
+
+    return 0;
+
+fail:
+    _ring_unmap(ctx);
+    close(ctx->ring_fd);
+    return -1;
+}
+
+static const struct native_poller uring_poller =
+{
+    .fd_update = _ela_uring_fd_update,
+    .wait = _ela_uring_wait,
+    .close = _ela_uring_close,
+#ifdef IORING_RECV_MULTISHOT
+    .buffer_group_init = _ela_uring_buffer_group_init,
+    .buffer_group_release = _ela_uring_buffer_group_release,
+    .completion_start = _ela_uring_completion_start,
+    .completion_stop = _ela_uring_completion_stop,
+#endif
+};
+
+static struct ela_el *_ela_uring_create(void);
+
+static const struct ela_el_backend uring_backend =
+{
+    NATIVE_BACKEND_OPS,
+    .name = "io_uring",
+    .create = _ela_uring_create,
+};
+
+static
+struct ela_el *_ela_uring_create(void)
+{
+    struct uring_mainloop *ctx = malloc(sizeof(*ctx));
+    if ( ctx == NULL )
+        return NULL;
+
+    memset(ctx, 0, sizeof(*ctx));
+    ela_native_init(&ctx->base, &uring_backend, &uring_poller);
+    ctx->timer_deadline = NATIVE_WAIT_FOREVER;
+
+    if ( _ring_setup(ctx) ) {
+        ela_post_queue_release(&ctx->base.post);
+        free(ctx);
+        return NULL;
+    }
+
+    return &ctx->base.base;
+}
+
+__attribute__((constructor))
+static void _ela_uring_register(void)
+{
+    ela_register(&uring_backend);
+}
@@ -0,0 +1,232 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <string.h>
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "ela_wheel.h"
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_NONE UINT64_MAX
+
+static void _list_init(struct ela_wheel_node *head)
+{
+    head->prev = head->next = head;
+}
+
+static int _list_empty(const struct ela_wheel_node *head)
+{
+    return head->next == head;
+}
+
+static void _list_append(struct ela_wheel_node *head,
+                         struct ela_wheel_node *node)
+{
+    node->next = head;
+    node->prev = head->prev;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+static void _list_unlink(struct ela_wheel_node *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+}
+
+void ela_wheel_init(struct ela_wheel *wheel, uint64_t tick_ns, uint64_t now)
+{
+    size_t l, s;
+
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->tick_ns = tick_ns;
+    wheel->origin = now;
+
+    for ( l = 0; l < WHEEL_LEVELS; ++l )
+        for ( s = 0; s < WHEEL_SLOTS; ++s )
+            _list_init(&wheel->slots[l][s]);
+
+    _list_init(&wheel->expired);
+}
+
+static void _insert(struct ela_wheel *wheel, struct ela_wheel_node *node)
+{
+    unsigned int level, slot;
+
+    if ( node->expire <= wheel->current ) {
+        node->level = WHEEL_LEVELS;
+        _list_append(&wheel->expired, node);
+        return;
+    }
+
+    level = (63 - __builtin_clzll(node->expire ^ wheel->current)) / WHEEL_BITS;
+    if ( level >= WHEEL_LEVELS ) {
+        /* Out of range, fire at the far end of the wheel */
+        level = WHEEL_LEVELS - 1;
+        node->expire = wheel->current
+            | ((1ULL << (WHEEL_LEVELS * WHEEL_BITS)) - 1);
+    }
+
+    slot = (node->expire >> (level * WHEEL_BITS)) & WHEEL_MASK;
+
+    node->level = level;
+    node->slot = slot;
+    _list_append(&wheel->slots[level][slot], node);
+    wheel->occupied[level] |= 1ULL << slot;
+}
+
+static void _detach(struct ela_wheel *wheel, struct ela_wheel_node *node)
+{
+    _list_unlink(node);
+
+    if ( node->level < WHEEL_LEVELS
+         && _list_empty(&wheel->slots[node->level][node->slot]) )
+        wheel->occupied[node->level] &= ~(1ULL << node->slot);
+}
+
+void ela_wheel_add(struct ela_wheel *wheel, struct ela_wheel_node *node,
+                   uint64_t deadline)
+{
+    if ( ela_wheel_node_armed(node) )
+        _detach(wheel, node);
+    else
+        wheel->count++;
+
+    if ( deadline <= wheel->origin )
+        node->expire = 0;
+    else
+        node->expire = (deadline - wheel->origin + wheel->tick_ns - 1)
+            / wheel->tick_ns;
+
+    _insert(wheel, node);
+}
+
+void ela_wheel_remove(struct ela_wheel *wheel, struct ela_wheel_node *node)
+{
+    if ( !ela_wheel_node_armed(node) )
+        return;
+
+    _detach(wheel, node);
+    node->level = -1;
+    wheel->count--;
+}
+
+/*
+  Next tick where a slot becomes current: either level 0 timers expire
+  or a higher level slot has to be cascaded.
+ */
+static uint64_t _next_tick(const struct ela_wheel *wheel)
+{
+    uint64_t best = WHEEL_NONE;
+    unsigned int l;
+
+    for ( l = 0; l < WHEEL_LEVELS; ++l ) {
+        unsigned int digit = (wheel->current >> (l * WHEEL_BITS)) & WHEEL_MASK;
+        uint64_t later = wheel->occupied[l] & ~((2ULL << digit) - 1);
+        uint64_t tick;
+
+        if ( !later )
+            continue;
+
+        tick = (wheel->current >> ((l + 1) * WHEEL_BITS)) << ((l + 1) * WHEEL_BITS);
+        tick |= (uint64_t)__builtin_ctzll(later) << (l * WHEEL_BITS);
+
+        if ( tick < best )
+            best = tick;
+    }
+
+    return best;
+}
+
+uint64_t ela_wheel_next(const struct ela_wheel *wheel)
+{
+    uint64_t tick;
+
+    if ( !_list_empty(&wheel->expired) )
+        return wheel->origin;
+
+    tick = _next_tick(wheel);
+    if ( tick == WHEEL_NONE )
+        return UINT64_MAX;
+
+    return wheel->origin + tick * wheel->tick_ns;
+}
+
+static void _cascade(struct ela_wheel *wheel, unsigned int level)
+{
+    unsigned int slot = (wheel->current >> (level * WHEEL_BITS)) & WHEEL_MASK;
+    struct ela_wheel_node *head = &wheel->slots[level][slot];
+    struct ela_wheel_node pending;
+
+    if ( _list_empty(head) )
+        return;
+
+    /* Move the slot away first, as reinsertion may target it again */
+    pending.next = head->next;
+    pending.prev = head->prev;
+    pending.next->prev = &pending;
+    pending.prev->next = &pending;
+    _list_init(head);
+    wheel->occupied[level] &= ~(1ULL << slot);
+
+    while ( !_list_empty(&pending) ) {
+        struct ela_wheel_node *node = pending.next;
+
+        _list_unlink(node);
+        _insert(wheel, node);
+    }
+}
+
+void ela_wheel_advance(struct ela_wheel *wheel, uint64_t now)
+{
+    uint64_t target;
+
+    if ( wheel->count == 0 || now < wheel->origin )
+        return;
+
+    target = (now - wheel->origin) / wheel->tick_ns;
+
+    while ( wheel->current < target ) {
+        uint64_t next = _next_tick(wheel);
+        unsigned int l;
+
+        if ( next > target ) {
+            wheel->current = target;
+            break;
+        }
+
+        wheel->current = next;
+
+        for ( l = WHEEL_LEVELS - 1; l > 0; --l )
+            if ( !(next & ((1ULL << (l * WHEEL_BITS)) - 1)) )
+                _cascade(wheel, l);
+
+        _cascade(wheel, 0);
+    }
+}
+
+struct ela_wheel_node *ela_wheel_pop(struct ela_wheel *wheel)
+{
+    struct ela_wheel_node *node;
+
+    if ( _list_empty(&wheel->expired) )
+        return NULL;
+
+    node = wheel->expired.next;
+    _list_unlink(node);
+    node->level = -1;
+    wheel->count--;
+
+    return node;
+}
@@ -0,0 +1,91 @@
+/*
+  Libela, an event-loop abstraction library.
+
+  This file is part of FOILS, the Freebox Open Interface Libraries.
+  This file is distributed under a 2-clause BSD license, see
+  LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef ELA_WHEEL_H
+#define ELA_WHEEL_H
+
+/*
+  Hierarchical timing wheel for coarse timeouts. Arming and cancelling
+  are O(1); only the next interesting tick is handed to the poller.
+
+  Each level has WHEEL_SLOTS slots, level l slots are WHEEL_SLOTS^l
+  ticks wide. A timer lives at the level of the highest digit where
+  its expiry tick differs from the current tick, and gets cascaded to
+  lower levels as time catches up with it.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 6
+
+struct ela_wheel_node
+{
+    struct ela_wheel_node *prev;
+    struct ela_wheel_node *next;
+    uint64_t expire;
+    /** Level, WHEEL_LEVELS for expired nodes, -1 when not armed */
+    int8_t level;
+    uint8_t slot;
+};
+
+struct ela_wheel
+{
+    uint64_t tick_ns;
+    uint64_t origin;
+    /** All ticks up to this one have been processed */
+    uint64_t current;
+    size_t count;
+    uint64_t occupied[WHEEL_LEVELS];
+    struct ela_wheel_node slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    /** Due nodes, waiting for ela_wheel_pop() */
+    struct ela_wheel_node expired;
+};
+
+void ela_wheel_init(struct ela_wheel *wheel, uint64_t tick_ns, uint64_t now);
+
+static inline void ela_wheel_node_init(struct ela_wheel_node *node)
+{
+    node->level = -1;
+}
+
+static inline int ela_wheel_node_armed(const struct ela_wheel_node *node)
+{
+    return node->level >= 0;
+}
+
+/** Deadline node is armed for, rounded up to its tick */
+static inline uint64_t ela_wheel_node_deadline(const struct ela_wheel *wheel,
+                                               const struct ela_wheel_node *node)
+{
+    return wheel->origin + node->expire * wheel->tick_ns;
+}
+
+/** (Re)arm node for an absolute monotonic deadline (ns), rounded up
+    to the next tick. */
+void ela_wheel_add(struct ela_wheel *wheel, struct ela_wheel_node *node,
+                   uint64_t deadline);
+
+void ela_wheel_remove(struct ela_wheel *wheel, struct ela_wheel_node *node);
+
+/** Monotonic time (ns) the wheel needs processing at, UINT64_MAX if
+    empty. */
+uint64_t ela_wheel_next(const struct ela_wheel *wheel);
+
+/** Move all nodes due at now to the expired list. */
+void ela_wheel_advance(struct ela_wheel *wheel, uint64_t now);
+
+/** Unlink and return next expired node, or NULL. */
+struct ela_wheel_node *ela_wheel_pop(struct ela_wheel *wheel);
+
+#endif
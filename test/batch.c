@@ -0,0 +1,159 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <ela/ela.h>
+
+/*
+  Sources added and removed in bulk, and write interest toggled from
+  a handler of another source on the same fd: interest changes that
+  cancel out within an iteration must leave the fd as it was.
+ */
+
+#define PAIRS 8
+#define TOGGLES 100
+
+static struct ela_el *el;
+static struct ela_event_source *readers[PAIRS], *writer;
+static int sv[PAIRS][2];
+static unsigned int reads, writes;
+/* Whether the reader of the first pair leaves write interest on */
+static int leave_writing;
+
+static
+void read_cb(struct ela_event_source *source, int fd,
+             uint32_t mask, void *data)
+{
+    char c;
+    int i;
+
+    if ( read(fd, &c, 1) == 1 )
+        reads++;
+
+    if ( source != readers[0] )
+        return;
+
+    for ( i = 0; i < TOGGLES; ++i ) {
+        ela_add(el, writer);
+        ela_remove(el, writer);
+    }
+    if ( leave_writing )
+        ela_add(el, writer);
+}
+
+static
+void write_cb(struct ela_event_source *source, int fd,
+              uint32_t mask, void *data)
+{
+    writes++;
+    ela_remove(el, source);
+}
+
+static void poke(int i)
+{
+    if ( write(sv[i][1], "x", 1) != 1 )
+        perror("write");
+}
+
+/* Iterations until wanted reads are done, a few at most */
+static void run(unsigned int wanted)
+{
+    struct timeval t20 = { 0, 20000 };
+    int i;
+
+    for ( i = 0; i < 5 && reads < wanted; ++i )
+        ela_run_once(el, &t20);
+    /* Then one more, for anything that should not happen */
+    ela_run_once(el, &t20);
+}
+
+int main(int argc, char **argv)
+{
+    const char *backend_name = argc > 1 ? argv[1] : NULL;
+    struct timeval t20 = { 0, 20000 };
+    unsigned int off_writes, on_writes, on_reads;
+    ela_error_t added, removed;
+    int i, idle, ok;
+
+    el = ela_create(backend_name);
+
+    if ( el == NULL ) {
+        fprintf(stderr, "No suitable event loop\n");
+        return 1;
+    }
+
+    for ( i = 0; i < PAIRS; ++i ) {
+        if ( socketpair(AF_UNIX, SOCK_STREAM, 0, sv[i]) ) {
+            perror("socketpair");
+            return 1;
+        }
+        ela_source_alloc(el, read_cb, NULL, &readers[i]);
+        ela_set_fd(el, readers[i], sv[i][0], ELA_EVENT_READABLE);
+    }
+    ela_source_alloc(el, write_cb, NULL, &writer);
+    ela_set_fd(el, writer, sv[0][0], ELA_EVENT_WRITABLE);
+
+    added = ela_add_many(el, readers, PAIRS);
+
+    for ( i = 0; i < PAIRS; ++i )
+        poke(i);
+    run(PAIRS);
+    printf("bulk add: %d, %u reads\n", added, reads);
+    ok = added == 0 && reads == PAIRS;
+
+    /* Writable all along, but interest ends up off */
+    poke(0);
+    run(PAIRS + 1);
+    off_writes = writes;
+
+    leave_writing = 1;
+    poke(0);
+    run(PAIRS + 2);
+    on_writes = writes;
+    on_reads = reads;
+    printf("toggled off: %u writes, on: %u writes\n",
+           off_writes, on_writes);
+    ok = ok && on_reads == PAIRS + 2 && off_writes == 0 && on_writes == 1;
+
+    removed = ela_remove_many(el, readers, PAIRS);
+    for ( i = 0; i < PAIRS; ++i )
+        poke(i);
+    idle = ela_run_once(el, &t20);
+    printf("bulk remove: %d, %d handlers called\n", removed, idle);
+    ok = ok && removed == 0 && idle == 0 && reads == on_reads;
+
+    for ( i = 0; i < PAIRS; ++i ) {
+        ela_source_free(el, readers[i]);
+        close(sv[i][0]);
+        close(sv[i][1]);
+    }
+    ela_source_free(el, writer);
+    ela_close(el);
+
+    return ok ? 0 : 1;
+}
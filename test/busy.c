@@ -0,0 +1,113 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <ela/ela.h>
+
+#define MESSAGES 500
+
+static struct ela_el *el;
+static int fds[2];
+static unsigned int received;
+
+/* Sends a byte every 100us, as a feed would */
+static void *feed(void *data)
+{
+    unsigned int i;
+
+    for ( i = 0; i < MESSAGES; ++i ) {
+        if ( write(fds[1], "x", 1) != 1 )
+            break;
+        usleep(100);
+    }
+
+    return NULL;
+}
+
+static
+void read_cb(struct ela_event_source *source, int fd,
+             uint32_t mask, void *data)
+{
+    char buf[64];
+    ssize_t ret = read(fd, buf, sizeof(buf));
+
+    if ( ret > 0 )
+        received += ret;
+    if ( ret <= 0 || received == MESSAGES )
+        ela_exit(el);
+}
+
+int main(int argc, char **argv)
+{
+    const char *backend_name = argc > 1 ? argv[1] : NULL;
+    struct timeval spin = {0, 1000};
+    struct ela_event_source *reader;
+    struct ela_stats stats;
+    pthread_t thread;
+    ela_error_t err;
+
+    el = ela_create(backend_name);
+
+    if ( el == NULL ) {
+        fprintf(stderr, "No suitable event loop\n");
+        return 1;
+    }
+
+    err = ela_set_busy_poll(el, &spin, 0);
+    if ( err == ENOTSUP ) {
+        printf("ela_set_busy_poll not supported\n");
+        ela_close(el);
+        return 0;
+    }
+
+    if ( pipe(fds) ) {
+        perror("pipe");
+        return 1;
+    }
+
+    ela_source_alloc(el, read_cb, NULL, &reader);
+    ela_set_fd(el, reader, fds[0], ELA_EVENT_READABLE);
+    ela_add(el, reader);
+
+    pthread_create(&thread, NULL, feed, NULL);
+    ela_run(el);
+    pthread_join(thread, NULL);
+
+    ela_get_stats(el, &stats);
+
+    /* Exact counts vary from run to run */
+    printf("received %u/%u, spins %s events\n", received, MESSAGES,
+           stats.busy_hits ? "found" : "never found");
+
+    ela_source_free(el, reader);
+    ela_close(el);
+    close(fds[0]);
+    close(fds[1]);
+
+    return received == MESSAGES && stats.busy_hits ? 0 : 1;
+}
@@ -0,0 +1,109 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <ela/ela.h>
+
+#define CHILDREN 8
+
+static struct ela_el *el;
+static unsigned int exited, bad;
+
+static
+void child_cb(struct ela_event_source *source, int fd,
+              uint32_t mask, void *data)
+{
+    int expected = (int)(intptr_t)data;
+    int status;
+
+    exited++;
+
+    if ( !(mask & ELA_EVENT_CHILD)
+         || ela_child_status(el, source, &status)
+         || !WIFEXITED(status) || WEXITSTATUS(status) != expected )
+        bad++;
+}
+
+int main(int argc, char **argv)
+{
+    const char *backend_name = argc > 1 ? argv[1] : NULL;
+    struct ela_event_source *src[CHILDREN];
+    ela_error_t err;
+    int i;
+
+    el = ela_create(backend_name);
+
+    if ( el == NULL ) {
+        fprintf(stderr, "No suitable event loop\n");
+        return 1;
+    }
+
+    for ( i = 0; i < CHILDREN; ++i ) {
+        pid_t pid = fork();
+
+        if ( pid < 0 ) {
+            perror("fork");
+            return 1;
+        }
+
+        /* The first one is gone before it gets watched */
+        if ( pid == 0 ) {
+            if ( i )
+                usleep(i * 10000);
+            _exit(i);
+        }
+
+        if ( i == 0 )
+            usleep(20000);
+
+        ela_source_alloc(el, child_cb, (void *)(intptr_t)i, &src[i]);
+        err = ela_set_child(el, src[i], pid);
+        if ( err == ENOTSUP ) {
+            printf("ela_set_child not supported\n");
+            ela_source_free(el, src[i]);
+            ela_close(el);
+            return 0;
+        }
+        if ( err ) {
+            printf("ela_set_child: %s\n", strerror(err));
+            return 1;
+        }
+        ela_add(el, src[i]);
+    }
+
+    /* Sources go away with their child, the loop then stops */
+    ela_run(el);
+
+    printf("exited %u/%u, bad %u\n", exited, CHILDREN, bad);
+
+    for ( i = 0; i < CHILDREN; ++i )
+        ela_source_free(el, src[i]);
+    ela_close(el);
+
+    return exited == CHILDREN && !bad ? 0 : 1;
+}
@@ -0,0 +1,208 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <ela/ela.h>
+
+/*
+  Class timeouts expire in arming order, one class duration after
+  they got added. Adding a source again moves it to the back of its
+  class, and removing it cancels its timeout.
+ */
+
+#define LONG_MS 100
+#define SHORT_MS 50
+#define STOP_MS 200
+/* Coarse loop clocks let timers fire a tick ahead of the one we
+   sample, libevent common timeouts also count from its cached clock */
+#define EARLY_MS 10
+
+static struct ela_el *el;
+static struct ela_timeout_class *long_cls, *short_cls;
+static struct ela_event_source *a, *b, *c, *d, *e;
+static struct timespec start;
+
+/* Sources by name, and when each got added last */
+static struct ela_event_source **sources[5] = { &a, &b, &c, &d, &e };
+static long added_ms[5];
+
+static long order[8], fired_ms[8];
+static unsigned int fired;
+
+static long elapsed_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) * 1000
+        + (now.tv_nsec - start.tv_nsec) / 1000000;
+}
+
+static
+void class_cb(struct ela_event_source *source, int fd,
+              uint32_t mask, void *data)
+{
+    if ( fired < 8 ) {
+        order[fired] = (long)data;
+        fired_ms[fired] = elapsed_ms();
+    }
+    fired++;
+}
+
+/* Steps of the scenario, each one a one-shot timer */
+
+static void add(long id)
+{
+    added_ms[id] = elapsed_ms();
+    ela_add(el, *sources[id]);
+}
+
+static
+void add_b_cb(struct ela_event_source *source, int fd,
+              uint32_t mask, void *data)
+{
+    add(1);
+}
+
+static
+void readd_a_cb(struct ela_event_source *source, int fd,
+                uint32_t mask, void *data)
+{
+    add(0);
+}
+
+static
+void add_c_e_cb(struct ela_event_source *source, int fd,
+                uint32_t mask, void *data)
+{
+    add(2);
+    add(4);
+}
+
+static
+void remove_d_cb(struct ela_event_source *source, int fd,
+                 uint32_t mask, void *data)
+{
+    ela_remove(el, d);
+}
+
+static
+void stop_cb(struct ela_event_source *source, int fd,
+             uint32_t mask, void *data)
+{
+    ela_exit(el);
+}
+
+static struct ela_event_source *timer(ela_handler_func *func, long ms)
+{
+    struct timeval tv = { 0, ms * 1000 };
+    struct ela_event_source *src;
+
+    ela_source_alloc(el, func, NULL, &src);
+    ela_set_timeout(el, src, &tv, ELA_EVENT_ONCE);
+    ela_add(el, src);
+    return src;
+}
+
+static struct ela_event_source *class_source(long id,
+                                             struct ela_timeout_class *cls)
+{
+    struct ela_event_source *src;
+
+    ela_source_alloc(el, class_cb, (void *)id, &src);
+    ela_set_timeout_class(el, src, cls, ELA_EVENT_ONCE);
+    return src;
+}
+
+int main(int argc, char **argv)
+{
+    const char *backend_name = argc > 1 ? argv[1] : NULL;
+    struct timeval long_tv = { 0, LONG_MS * 1000 };
+    struct timeval short_tv = { 0, SHORT_MS * 1000 };
+    struct ela_event_source *steps[5];
+    /*
+      E is added at 40 in the short class, B at 20, A again at 30 and
+      C at 40 in the long one. D is removed before it is due.
+     */
+    static const long expected[4] = { 4, 1, 0, 2 };
+    static const long duration_ms[4] = {
+        SHORT_MS, LONG_MS, LONG_MS, LONG_MS
+    };
+    unsigned int i;
+    long due;
+    int ok;
+
+    el = ela_create(backend_name);
+
+    if ( el == NULL ) {
+        fprintf(stderr, "No suitable event loop\n");
+        return 1;
+    }
+
+    if ( ela_timeout_class_create(el, &long_tv, &long_cls)
+         || ela_timeout_class_create(el, &short_tv, &short_cls) ) {
+        fprintf(stderr, "No timeout classes\n");
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    a = class_source(0, long_cls);
+    b = class_source(1, long_cls);
+    c = class_source(2, long_cls);
+    d = class_source(3, long_cls);
+    e = class_source(4, short_cls);
+    add(0);
+    add(3);
+
+    steps[0] = timer(add_b_cb, 20);
+    steps[1] = timer(readd_a_cb, 30);
+    steps[2] = timer(add_c_e_cb, 40);
+    steps[3] = timer(remove_d_cb, 60);
+    steps[4] = timer(stop_cb, STOP_MS);
+
+    ela_run(el);
+
+    ok = fired == 4;
+    for ( i = 0; i < fired && i < 4; ++i ) {
+        due = added_ms[order[i]] + duration_ms[i];
+        printf("%c fired at %ld ms, due at %ld ms\n",
+               (char)('A' + order[i]), fired_ms[i], due);
+        ok = ok && order[i] == expected[i]
+            && fired_ms[i] >= due - EARLY_MS && fired_ms[i] < due + 20;
+    }
+
+    ela_source_free(el, a);
+    ela_source_free(el, b);
+    ela_source_free(el, c);
+    ela_source_free(el, d);
+    ela_source_free(el, e);
+    for ( i = 0; i < 5; ++i )
+        ela_source_free(el, steps[i]);
+    ela_close(el);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include <ela/ela.h>
+
+#define COUNT 1000
+
+struct timer
+{
+    struct ela_event_source *source;
+    struct timespec armed;
+    long expected_ms;
+    int state;
+};
+
+enum { ARMED, FIRED, CANCELLED };
+
+static struct ela_el *el;
+static struct timer timers[COUNT];
+static unsigned int fired, cancelled, early, zombies;
+static long worst_late_ms;
+
+static long elapsed_ms(const struct timespec *from)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - from->tv_sec) * 1000
+        + (now.tv_nsec - from->tv_nsec) / 1000000;
+}
+
+static
+void cb(struct ela_event_source *source, int fd,
+        uint32_t mask, void *data)
+{
+    struct timer *t = data;
+    long late = elapsed_ms(&t->armed) - t->expected_ms;
+
+    if ( t->state != ARMED )
+        zombies++;
+
+    if ( late < 0 )
+        early++;
+    if ( late > worst_late_ms )
+        worst_late_ms = late;
+
+    /* Odd timers cancel their predecessor, due later, which must
+       never fire afterwards */
+    if ( (t - timers) % 2 == 1 && t[-1].state == ARMED ) {
+        ela_remove(el, t[-1].source);
+        t[-1].state = CANCELLED;
+        cancelled++;
+    }
+
+    ela_remove(el, source);
+    t->state = FIRED;
+    fired++;
+}
+
+int main(int argc, char **argv)
+{
+    const char *backend_name = argc > 1 ? argv[1] : NULL;
+    struct timeval tick = {0, 4000};
+    unsigned int i;
+
+    el = ela_create(backend_name);
+
+    if ( el == NULL ) {
+        fprintf(stderr, "No suitable event loop\n");
+        return 1;
+    }
+
+    ela_error_t err = ela_set_timer_tick(el, &tick);
+    if ( err && err != ENOTSUP ) {
+        fprintf(stderr, "Setting tick failed: %s\n", strerror(err));
+        return 1;
+    }
+
+    for ( i = 0; i < COUNT; ++i ) {
+        struct timer *t = &timers[i];
+        /* Spread over ~1s, in decreasing order */
+        struct timeval tv = {0, (COUNT - i) * 997 % 1000000};
+
+        err = ela_source_alloc(el, cb, t, &t->source);
+        if ( err )
+            goto ela_err;
+
+        t->expected_ms = tv.tv_usec / 1000;
+        ela_set_timeout(el, t->source, &tv, ELA_EVENT_COARSE);
+        clock_gettime(CLOCK_MONOTONIC, &t->armed);
+        ela_add(el, t->source);
+    }
+
+    ela_run(el);
+
+    printf("fired %u, cancelled %u, early %u, zombies %u, "
+           "worst lateness %ldms\n",
+           fired, cancelled, early, zombies, worst_late_ms);
+
+    for ( i = 0; i < COUNT; ++i )
+        ela_source_free(el, timers[i].source);
+    ela_close(el);
+
+    return fired + cancelled == COUNT && early == 0 && zombies == 0 ? 0 : 1;
+
+ela_err:
+    fprintf(stderr, "Source allocation failed: %s\n", strerror(err));
+    return 1;
+}
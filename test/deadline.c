@@ -0,0 +1,138 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <ela/ela.h>
+
+/*
+  Absolute deadlines: one already past fires right away, one in the
+  future fires once it is reached, neither gets restarted.
+ */
+
+#define FUTURE_MS 80
+#define STOP_MS 250
+/* Coarse loop clocks let timers fire a tick ahead of the one we
+   sample */
+#define EARLY_MS 5
+
+static struct ela_el *el;
+static struct ela_event_source *past, *future, *stop;
+static struct timespec start;
+static unsigned int past_fired, future_fired;
+static long past_ms = -1, future_ms = -1;
+
+static long elapsed_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) * 1000
+        + (now.tv_nsec - start.tv_nsec) / 1000000;
+}
+
+static
+void deadline_cb(struct ela_event_source *source, int fd,
+                 uint32_t mask, void *data)
+{
+    if ( source == past ) {
+        past_fired++;
+        past_ms = elapsed_ms();
+    } else {
+        future_fired++;
+        future_ms = elapsed_ms();
+    }
+}
+
+static
+void stop_cb(struct ela_event_source *source, int fd,
+             uint32_t mask, void *data)
+{
+    ela_exit(el);
+}
+
+static struct timespec after_ms(struct timespec ts, long ms)
+{
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000;
+    if ( ts.tv_nsec >= 1000000000 ) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    } else if ( ts.tv_nsec < 0 ) {
+        ts.tv_sec--;
+        ts.tv_nsec += 1000000000;
+    }
+    return ts;
+}
+
+int main(int argc, char **argv)
+{
+    const char *backend_name = argc > 1 ? argv[1] : NULL;
+    struct timeval tv = { 0, STOP_MS * 1000 };
+    struct timespec now, deadline;
+    int ok;
+
+    el = ela_create(backend_name);
+
+    if ( el == NULL ) {
+        fprintf(stderr, "No suitable event loop\n");
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    now = ela_now(el);
+
+    /* Without ELA_EVENT_ONCE, both stay in the loop once fired */
+    ela_source_alloc(el, deadline_cb, NULL, &past);
+    deadline = after_ms(now, -1000);
+    ela_set_deadline(el, past, &deadline, 0);
+    ela_add(el, past);
+
+    ela_source_alloc(el, deadline_cb, NULL, &future);
+    deadline = after_ms(now, FUTURE_MS);
+    ela_set_deadline(el, future, &deadline, 0);
+    ela_add(el, future);
+
+    ela_source_alloc(el, stop_cb, NULL, &stop);
+    ela_set_timeout(el, stop, &tv, ELA_EVENT_ONCE);
+    ela_add(el, stop);
+
+    ela_run(el);
+
+    printf("past deadline fired %u times, at %ld ms, "
+           "future one %u times, at %ld ms\n",
+           past_fired, past_ms, future_fired, future_ms);
+
+    ok = past_fired == 1 && past_ms < 20
+        && future_fired == 1 && future_ms >= FUTURE_MS - EARLY_MS
+        && future_ms < FUTURE_MS + 40;
+
+    ela_source_free(el, past);
+    ela_source_free(el, future);
+    ela_source_free(el, stop);
+    ela_close(el);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <ela/ela.h>
+
+#define CHAIN 1000
+#define FANOUT 100
+
+static struct ela_el *el;
+static unsigned int chained, fanned, allocs;
+static int order[3], ordered;
+
+static void *count_alloc(void *opaque, size_t size)
+{
+    allocs++;
+    return malloc(size);
+}
+
+static void count_free(void *opaque, void *ptr)
+{
+    free(ptr);
+}
+
+/* Each call defers the next one */
+static
+void chain_cb(struct ela_el *ctx, void *data)
+{
+    if ( ++chained < CHAIN )
+        ela_defer(ctx, chain_cb, NULL);
+}
+
+static
+void fan_cb(struct ela_el *ctx, void *data)
+{
+    fanned++;
+}
+
+static
+void later_cb(struct ela_el *ctx, void *data)
+{
+    order[ordered++] = (int)(intptr_t)data;
+}
+
+static void fan_out(void)
+{
+    unsigned int i;
+
+    for ( i = 0; i < FANOUT; ++i )
+        ela_defer(el, fan_cb, NULL);
+}
+
+int main(int argc, char **argv)
+{
+    const char *backend_name = argc > 1 ? argv[1] : NULL;
+    struct timeval t30 = {0, 30000}, t10 = {0, 10000}, t20 = {0, 20000};
+    unsigned int warm;
+    int hooked;
+
+    el = ela_create(backend_name);
+
+    if ( el == NULL ) {
+        fprintf(stderr, "No suitable event loop\n");
+        return 1;
+    }
+
+    hooked = !ela_set_allocator(el, count_alloc, count_free, NULL);
+
+    ela_defer(el, chain_cb, NULL);
+    fan_out();
+    ela_call_later(el, &t30, later_cb, (void *)3);
+    ela_call_later(el, &t10, later_cb, (void *)1);
+    ela_call_later(el, &t20, later_cb, (void *)2);
+
+    /* Returns once nothing is pending */
+    ela_run(el);
+
+    /* Pool is warm, the same load allocates nothing */
+    warm = allocs;
+    fan_out();
+    ela_run(el);
+
+    printf("chained %u, fanned %u, later %d%d%d, allocated again %u\n",
+           chained, fanned, order[0], order[1], order[2],
+           hooked ? allocs - warm : 0);
+
+    ela_close(el);
+
+    return chained == CHAIN && fanned == 2 * FANOUT && ordered == 3
+        && order[0] == 1 && order[1] == 2 && order[2] == 3
+        && allocs == warm ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <ela/ela.h>
+
+static struct ela_el *el;
+static int sv[2], idle[2];
+static unsigned int writable, readable, bytes;
+
+/* Never writes, level-triggered would spin here */
+static
+void writable_cb(struct ela_event_source *source, int fd,
+                 uint32_t mask, void *data)
+{
+    writable++;
+}
+
+/* Reads one byte per call, and asks to be called again while there
+   may be more, as no new edge will come */
+static
+void readable_cb(struct ela_event_source *source, int fd,
+                 uint32_t mask, void *data)
+{
+    char c;
+
+    readable++;
+
+    if ( read(fd, &c, 1) != 1 )
+        return;
+
+    bytes++;
+    if ( ela_activate(el, source, ELA_EVENT_READABLE) )
+        ela_exit(el);
+}
+
+static
+void step_cb(struct ela_event_source *source, int fd,
+             uint32_t mask, void *data)
+{
+    unsigned int *step = data;
+
+    if ( ++*step == 5 || write(sv[1], "xyz", 3) != 3 )
+        ela_exit(el);
+}
+
+int main(int argc, char **argv)
+{
+    const char *backend_name = argc > 1 ? argv[1] : NULL;
+    struct ela_event_source *w, *r, *step;
+    struct timeval t20 = {0, 20000};
+    unsigned int steps = 0;
+    ela_error_t err;
+
+    el = ela_create(backend_name);
+
+    if ( el == NULL ) {
+        fprintf(stderr, "No suitable event loop\n");
+        return 1;
+    }
+
+    if ( socketpair(AF_UNIX, SOCK_STREAM, 0, sv)
+         || socketpair(AF_UNIX, SOCK_STREAM, 0, idle) ) {
+        perror("socketpair");
+        return 1;
+    }
+
+    ela_source_alloc(el, writable_cb, NULL, &w);
+    err = ela_set_fd(el, w, idle[0], ELA_EVENT_WRITABLE | ELA_EVENT_EDGE);
+    if ( err == ENOTSUP ) {
+        printf("ELA_EVENT_EDGE not supported\n");
+        ela_source_free(el, w);
+        ela_close(el);
+        return 0;
+    }
+    ela_add(el, w);
+
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    ela_source_alloc(el, readable_cb, NULL, &r);
+    ela_set_fd(el, r, sv[0], ELA_EVENT_READABLE | ELA_EVENT_EDGE);
+    ela_add(el, r);
+
+    /* Sends 3 bytes every 20ms, 4 times */
+    ela_source_alloc(el, step_cb, &steps, &step);
+    ela_set_timeout(el, step, &t20, 0);
+    ela_add(el, step);
+
+    ela_run(el);
+
+    printf("writable %u, readable %u, read %u\n", writable, readable, bytes);
+
+    ela_source_free(el, w);
+    ela_source_free(el, r);
+    ela_source_free(el, step);
+    ela_close(el);
+    close(sv[0]);
+    close(sv[1]);
+    close(idle[0]);
+    close(idle[1]);
+
+    /* Each batch takes 3 reads, and one more to see it is empty */
+    return writable == 1 && readable == 16 && bytes == 12 ? 0 : 1;
+}
@@ -0,0 +1,218 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <ela/ela.h>
+
+/*
+  Sources living in caller structures, set up with ela_source_init(),
+  and slab sources coming back from ela_source_alloc() after a free.
+ */
+
+#define CONNS 4
+/* One slab worth of sources, at least */
+#define SLOTS 64
+
+struct conn
+{
+    int sv[2];
+    unsigned int reads;
+    union {
+        long long l;
+        long double d;
+        void *p;
+    } source[];
+};
+
+static struct ela_el *el;
+static int bad_handle;
+
+static struct ela_event_source *conn_source(struct conn *c)
+{
+    return (struct ela_event_source *)c->source;
+}
+
+static
+void read_cb(struct ela_event_source *source, int fd,
+             uint32_t mask, void *data)
+{
+    struct conn *c = data;
+    char buf[16];
+    ssize_t len;
+
+    if ( source != conn_source(c) || fd != c->sv[0] )
+        bad_handle = 1;
+
+    len = read(fd, buf, sizeof(buf));
+    if ( len > 0 )
+        c->reads += len;
+}
+
+static
+void nop_cb(struct ela_event_source *source, int fd,
+            uint32_t mask, void *data)
+{
+}
+
+static ela_error_t conn_start(struct conn *c)
+{
+    ela_error_t err;
+
+    err = ela_source_init(el, c->source, read_cb, c);
+    if ( !err )
+        err = ela_set_fd(el, conn_source(c), c->sv[0], ELA_EVENT_READABLE);
+    if ( !err )
+        err = ela_add(el, conn_source(c));
+    return err;
+}
+
+static unsigned int total_reads(struct conn **conns)
+{
+    unsigned int reads = 0;
+    int i;
+
+    for ( i = 0; i < CONNS; ++i )
+        reads += conns[i]->reads;
+    return reads;
+}
+
+/* Pokes each connection, returns bytes read so far once wanted are */
+static unsigned int poke_all(struct conn **conns, unsigned int wanted)
+{
+    struct timeval t20 = { 0, 20000 };
+    int i, round;
+
+    for ( i = 0; i < CONNS; ++i )
+        if ( write(conns[i]->sv[1], "x", 1) != 1 )
+            perror("write");
+
+    for ( round = 0; round < 5 && total_reads(conns) < wanted; ++round )
+        ela_run_once(el, &t20);
+
+    return total_reads(conns);
+}
+
+static int slab_reused(void)
+{
+    struct ela_event_source *first[SLOTS], *again[SLOTS];
+    int i, j, found = 0;
+
+    for ( i = 0; i < SLOTS; ++i )
+        ela_source_alloc(el, nop_cb, NULL, &first[i]);
+    for ( i = 0; i < SLOTS; ++i )
+        ela_source_free(el, first[i]);
+
+    for ( i = 0; i < SLOTS; ++i )
+        ela_source_alloc(el, nop_cb, NULL, &again[i]);
+
+    /* Freed slots are all there is to take from */
+    for ( i = 0; i < SLOTS; ++i )
+        for ( j = 0; j < SLOTS; ++j )
+            if ( again[i] == first[j] ) {
+                found++;
+                break;
+            }
+
+    for ( i = 0; i < SLOTS; ++i )
+        ela_source_free(el, again[i]);
+
+    return found == SLOTS;
+}
+
+int main(int argc, char **argv)
+{
+    const char *backend_name = argc > 1 ? argv[1] : NULL;
+    struct timeval t20 = { 0, 20000 };
+    struct conn *conns[CONNS];
+    ela_error_t err = 0;
+    unsigned int first, stopped, again;
+    int i, idle, reused, ok;
+    size_t size;
+
+    el = ela_create(backend_name);
+
+    if ( el == NULL ) {
+        fprintf(stderr, "No suitable event loop\n");
+        return 1;
+    }
+
+    size = ela_source_size(el);
+    if ( size == 0 ) {
+        printf("caller-provided sources not supported\n");
+        ela_close(el);
+        return 0;
+    }
+
+    for ( i = 0; i < CONNS; ++i ) {
+        conns[i] = calloc(1, sizeof(struct conn) + size);
+        if ( conns[i] == NULL
+             || socketpair(AF_UNIX, SOCK_STREAM, 0, conns[i]->sv) ) {
+            perror("setup");
+            return 1;
+        }
+        if ( !err )
+            err = conn_start(conns[i]);
+    }
+
+    first = poke_all(conns, CONNS);
+
+    /* Cleaned up sources are gone from the loop */
+    for ( i = 0; i < CONNS; ++i )
+        ela_source_cleanup(el, conn_source(conns[i]));
+    for ( i = 0; i < CONNS; ++i )
+        if ( write(conns[i]->sv[1], "x", 1) != 1 )
+            perror("write");
+    idle = ela_run_once(el, &t20);
+    stopped = total_reads(conns);
+
+    /* Storage can be set up again, the pending bytes are read then */
+    for ( i = 0; i < CONNS; ++i )
+        if ( !err )
+            err = conn_start(conns[i]);
+    again = poke_all(conns, 3 * CONNS);
+
+    reused = slab_reused();
+
+    printf("embedded sources: %u bytes read, %u after cleanup, "
+           "%u after reuse, slab reused %s\n", first, stopped, again,
+           reused ? "yes" : "no");
+
+    ok = err == 0 && !bad_handle && first == CONNS
+        && idle == 0 && stopped == CONNS
+        && again == 3 * CONNS && reused;
+
+    for ( i = 0; i < CONNS; ++i ) {
+        ela_source_cleanup(el, conn_source(conns[i]));
+        close(conns[i]->sv[0]);
+        close(conns[i]->sv[1]);
+        free(conns[i]);
+    }
+    ela_close(el);
+
+    return ok ? 0 : 1;
+}
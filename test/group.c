@@ -0,0 +1,196 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <ela/ela.h>
+#include <ela/group.h>
+
+#define LOOPS 4
+#define CONNECTIONS 200
+#define FILLERS 1024
+
+static struct ela_group *group;
+static unsigned int accepted[LOOPS];
+static unsigned int errors;
+/* Accepts failed for lack of fds, listeners come back from those */
+static unsigned int exhausted;
+
+static
+void accept_cb(struct ela_el *ctx, int fd, void *priv)
+{
+    unsigned int i;
+
+    if ( fd == -EMFILE || fd == -ENFILE ) {
+        __atomic_fetch_add(&exhausted, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if ( fd < 0 ) {
+        __atomic_fetch_add(&errors, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    for ( i = 0; i < LOOPS; ++i )
+        if ( ela_group_loop(group, i) == ctx )
+            __atomic_fetch_add(&accepted[i], 1, __ATOMIC_RELAXED);
+
+    close(fd);
+    ela_group_release(group, ctx);
+}
+
+static unsigned int total_accepted(void)
+{
+    unsigned int i, total = 0;
+
+    for ( i = 0; i < LOOPS; ++i )
+        total += __atomic_load_n(&accepted[i], __ATOMIC_RELAXED);
+    return total;
+}
+
+/*
+  Runs the process out of fds while a connection waits to be accepted.
+  A loop that fails to accept it must accept it once fds are back.
+  io_uring takes the fd limit from when the accept got queued, and
+  never fails there.
+ */
+static int exhaust_fds(struct sockaddr_in *addr)
+{
+    static int fillers[FILLERS];
+    struct rlimit saved, low;
+    unsigned int i, count = 0, before = total_accepted();
+    int client, ok;
+
+    if ( getrlimit(RLIMIT_NOFILE, &saved) )
+        return 0;
+
+    /* Keep the fd count low enough to fill it up */
+    low = saved;
+    if ( low.rlim_cur > FILLERS )
+        low.rlim_cur = FILLERS;
+    setrlimit(RLIMIT_NOFILE, &low);
+
+    while ( count < FILLERS && (fillers[count] = dup(0)) >= 0 )
+        count++;
+
+    /* Room for the client only */
+    if ( count )
+        close(fillers[--count]);
+    client = socket(AF_INET, SOCK_STREAM, 0);
+    if ( client < 0
+         || connect(client, (struct sockaddr *)addr, sizeof(*addr)) )
+        perror("connect");
+
+    for ( i = 0; i < 100
+              && !__atomic_load_n(&exhausted, __ATOMIC_RELAXED); ++i )
+        usleep(10000);
+
+    while ( count )
+        close(fillers[--count]);
+    setrlimit(RLIMIT_NOFILE, &saved);
+
+    for ( i = 0; i < 100 && total_accepted() == before; ++i )
+        usleep(10000);
+
+    ok = total_accepted() == before + 1;
+    printf("out of fds: %u failed accepts, %u accepted afterwards\n",
+           __atomic_load_n(&exhausted, __ATOMIC_RELAXED),
+           total_accepted() - before);
+
+    if ( client >= 0 )
+        close(client);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    const char *backend_name = argc > 1 ? argv[1] : NULL;
+    struct sockaddr_in addr;
+    unsigned int i, total = 0;
+    int fds[CONNECTIONS];
+    ela_error_t err;
+    int recovered;
+
+    group = ela_group_create(LOOPS, backend_name);
+    if ( group == NULL ) {
+        fprintf(stderr, "No suitable event loop group\n");
+        return 1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    err = ela_group_listen(group, (struct sockaddr *)&addr, sizeof(addr),
+                           accept_cb, NULL);
+    if ( err ) {
+        fprintf(stderr, "Listen failed: %s\n", strerror(err));
+        return 1;
+    }
+
+    /* Connect from many source ports, for the kernel to spread them */
+    for ( i = 0; i < CONNECTIONS; ++i ) {
+        fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+        if ( connect(fds[i], (struct sockaddr *)&addr, sizeof(addr)) )
+            perror("connect");
+    }
+
+    for ( i = 0; i < 100; ++i ) {
+        total = total_accepted();
+        if ( total + errors >= CONNECTIONS )
+            break;
+        usleep(10000);
+    }
+
+    for ( i = 0; i < CONNECTIONS; ++i )
+        close(fds[i]);
+
+    printf("accepted %u/%u, errors %u:", total, CONNECTIONS, errors);
+    for ( i = 0; i < LOOPS; ++i )
+        printf(" %u", __atomic_load_n(&accepted[i], __ATOMIC_RELAXED));
+    printf("\n");
+
+    /* Picks spread over loops, all accepted ones were released */
+    for ( i = 0; i < LOOPS; ++i )
+        ela_group_pick(group);
+    for ( i = 0; i < LOOPS; ++i ) {
+        struct ela_el *ctx = ela_group_pick(group);
+
+        if ( ctx != ela_group_loop(group, i) ) {
+            printf("pick %u got another loop\n", i);
+            errors++;
+        }
+    }
+
+    recovered = exhaust_fds(&addr);
+
+    ela_group_destroy(group);
+
+    return total == CONNECTIONS && errors == 0 && recovered ? 0 : 1;
+}
@@ -0,0 +1,132 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <ela/ela.h>
+
+#define TICKS 5
+#define MESSAGES 3
+
+static struct ela_el *el;
+static int sv[2];
+static char out[64];
+static size_t out_len;
+static unsigned int flushes, wakeups, received;
+
+/* Handlers only queue output */
+static
+void tick_cb(struct ela_event_source *source, int fd,
+             uint32_t mask, void *data)
+{
+    unsigned int *ticks = data;
+    int i;
+
+    if ( ++*ticks == TICKS )
+        ela_remove(el, source);
+
+    for ( i = 0; i < MESSAGES; ++i ) {
+        memcpy(out + out_len, "msg", 3);
+        out_len += 3;
+    }
+}
+
+/* Flushes everything queued during the iteration at once */
+static
+void hook_cb(struct ela_el *ctx, uint32_t when, void *data)
+{
+    if ( when == ELA_HOOK_AFTER_POLL ) {
+        wakeups++;
+        return;
+    }
+
+    if ( out_len && write(sv[1], out, out_len) == (ssize_t)out_len )
+        flushes++;
+    out_len = 0;
+}
+
+static
+void read_cb(struct ela_event_source *source, int fd,
+             uint32_t mask, void *data)
+{
+    char buf[64];
+    ssize_t ret = read(fd, buf, sizeof(buf));
+
+    if ( ret > 0 )
+        received += ret;
+
+    if ( ret <= 0 || received == TICKS * MESSAGES * 3 ) {
+        ela_hook_remove(el, ELA_HOOK_BEFORE_POLL | ELA_HOOK_AFTER_POLL,
+                        hook_cb, NULL);
+        ela_exit(el);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *backend_name = argc > 1 ? argv[1] : NULL;
+    struct ela_event_source *tick, *reader;
+    struct timeval t10 = {0, 10000};
+    unsigned int ticks = 0;
+
+    el = ela_create(backend_name);
+
+    if ( el == NULL ) {
+        fprintf(stderr, "No suitable event loop\n");
+        return 1;
+    }
+
+    if ( socketpair(AF_UNIX, SOCK_STREAM, 0, sv) ) {
+        perror("socketpair");
+        return 1;
+    }
+
+    ela_hook_add(el, ELA_HOOK_BEFORE_POLL | ELA_HOOK_AFTER_POLL,
+                 hook_cb, NULL);
+
+    ela_source_alloc(el, tick_cb, &ticks, &tick);
+    ela_set_timeout(el, tick, &t10, 0);
+    ela_add(el, tick);
+
+    ela_source_alloc(el, read_cb, NULL, &reader);
+    ela_set_fd(el, reader, sv[0], ELA_EVENT_READABLE);
+    ela_add(el, reader);
+
+    ela_run(el);
+
+    printf("flushes %u, received %u, woken up %s\n",
+           flushes, received, wakeups >= TICKS ? "yes" : "no");
+
+    ela_source_free(el, tick);
+    ela_source_free(el, reader);
+    ela_close(el);
+    close(sv[0]);
+    close(sv[1]);
+
+    return flushes == TICKS && received == TICKS * MESSAGES * 3
+        && wakeups >= TICKS ? 0 : 1;
+}
@@ -0,0 +1,206 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <ela/ela.h>
+
+static struct ela_el *loop_a, *loop_b;
+static pthread_t thread_b;
+static struct ela_event_source *keepalive_a, *keepalive_b;
+static struct ela_event_source *timeout, *periodic, *reader, *mover;
+static int fds[2];
+
+static struct timespec start;
+static long timeout_ms = -1;
+static int timeout_on_b, reader_on_b;
+static unsigned int ticks_a, ticks_b;
+static ela_error_t migrate_err;
+
+static long elapsed_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) * 1000
+        + (now.tv_nsec - start.tv_nsec) / 1000000;
+}
+
+static int on_b(void)
+{
+    return pthread_equal(pthread_self(), thread_b);
+}
+
+static
+void nop_cb(struct ela_event_source *source, int fd,
+            uint32_t mask, void *data)
+{
+}
+
+/* Started on a, fires on b, 300ms after being added on a */
+static
+void timeout_cb(struct ela_event_source *source, int fd,
+                uint32_t mask, void *data)
+{
+    timeout_ms = elapsed_ms();
+    timeout_on_b = on_b();
+
+    ela_exit(loop_b);
+    ela_exit(loop_a);
+}
+
+static
+void periodic_cb(struct ela_event_source *source, int fd,
+                 uint32_t mask, void *data)
+{
+    if ( on_b() )
+        ticks_b++;
+    else
+        ticks_a++;
+}
+
+static
+void reader_cb(struct ela_event_source *source, int fd,
+               uint32_t mask, void *data)
+{
+    char c;
+
+    if ( read(fd, &c, 1) == 1 )
+        reader_on_b = on_b();
+}
+
+/* Runs on a after 100ms, moves everything over to b */
+static
+void mover_cb(struct ela_event_source *source, int fd,
+              uint32_t mask, void *data)
+{
+    ela_error_t err = 0;
+
+    if ( !err )
+        err = ela_source_migrate(timeout, loop_a, loop_b);
+    if ( !err )
+        err = ela_source_migrate(periodic, loop_a, loop_b);
+    if ( !err )
+        err = ela_source_migrate(reader, loop_a, loop_b);
+
+    if ( err ) {
+        migrate_err = err;
+        ela_exit(loop_a);
+        ela_exit(loop_b);
+        return;
+    }
+
+    /* Readiness shows up on b */
+    if ( write(fds[1], "x", 1) != 1 )
+        ela_exit(loop_a);
+}
+
+static
+void *run_b(void *data)
+{
+    ela_run(loop_b);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    const char *backend_name = argc > 1 ? argv[1] : NULL;
+    struct timeval forever = {3600, 0};
+    struct timeval t300 = {0, 300000};
+    struct timeval t100 = {0, 100000};
+    struct timeval t20 = {0, 20000};
+    int ok;
+
+    loop_a = ela_create(backend_name);
+    loop_b = ela_create(backend_name);
+
+    if ( loop_a == NULL || loop_b == NULL ) {
+        fprintf(stderr, "No suitable event loop\n");
+        return 1;
+    }
+
+    if ( pipe(fds) ) {
+        perror("pipe");
+        return 1;
+    }
+
+    ela_source_alloc(loop_a, nop_cb, NULL, &keepalive_a);
+    ela_set_timeout(loop_a, keepalive_a, &forever, 0);
+    ela_add(loop_a, keepalive_a);
+    ela_source_alloc(loop_b, nop_cb, NULL, &keepalive_b);
+    ela_set_timeout(loop_b, keepalive_b, &forever, 0);
+    ela_add(loop_b, keepalive_b);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    ela_source_alloc(loop_a, timeout_cb, NULL, &timeout);
+    ela_set_timeout(loop_a, timeout, &t300, 0);
+    ela_add(loop_a, timeout);
+
+    ela_source_alloc(loop_a, periodic_cb, NULL, &periodic);
+    ela_set_timeout(loop_a, periodic, &t20, ELA_EVENT_PERIODIC);
+    ela_add(loop_a, periodic);
+
+    ela_source_alloc(loop_a, reader_cb, NULL, &reader);
+    ela_set_fd(loop_a, reader, fds[0], ELA_EVENT_READABLE);
+    ela_add(loop_a, reader);
+
+    ela_source_alloc(loop_a, mover_cb, NULL, &mover);
+    ela_set_timeout(loop_a, mover, &t100, ELA_EVENT_ONCE);
+    ela_add(loop_a, mover);
+
+    pthread_create(&thread_b, NULL, run_b, NULL);
+    ela_run(loop_a);
+    pthread_join(thread_b, NULL);
+
+    ok = timeout_on_b && reader_on_b && ticks_a && ticks_b
+        && timeout_ms >= 290 && timeout_ms < 400;
+
+    if ( migrate_err == ENOTSUP )
+        printf("ela_source_migrate not supported\n");
+    else if ( migrate_err )
+        printf("ela_source_migrate failed: %s\n", strerror(migrate_err));
+    else
+        printf("timeout after %ldms on %s, reader on %s, "
+               "ticks a %u b %u\n",
+               timeout_ms, timeout_on_b ? "b" : "a",
+               reader_on_b ? "b" : "a", ticks_a, ticks_b);
+
+    /* Migrated sources are released with their new loop */
+    ela_source_free(loop_b, timeout);
+    ela_source_free(loop_b, periodic);
+    ela_source_free(loop_b, reader);
+    ela_source_free(loop_a, mover);
+    ela_source_free(loop_a, keepalive_a);
+    ela_source_free(loop_b, keepalive_b);
+    ela_close(loop_a);
+    ela_close(loop_b);
+    close(fds[0]);
+    close(fds[1]);
+
+    return ok || migrate_err == ENOTSUP ? 0 : 1;
+}
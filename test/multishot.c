@@ -0,0 +1,147 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <ela/ela.h>
+#include <ela/backend.h>
+
+#define CLIENTS 4
+#define GROUP 1
+
+static struct ela_el *el = NULL;
+static size_t received = 0;
+static int closed = 0;
+
+static
+void recv_cb(struct ela_event_source *source, int fd,
+             ssize_t res, const void *buf, void *data)
+{
+    if ( res > 0 ) {
+        printf("fd %d: %d bytes: %.*s\n", fd, (int)res, (int)res,
+               (const char *)buf);
+        received += res;
+        return;
+    }
+
+    printf("fd %d: %s\n", fd, res ? strerror(-res) : "end of stream");
+
+    ela_source_free(el, source);
+    close(fd);
+
+    if ( ++closed == CLIENTS )
+        ela_exit(el);
+}
+
+static
+void accept_cb(struct ela_event_source *source, int fd,
+               ssize_t res, const void *buf, void *data)
+{
+    struct ela_event_source *conn;
+
+    if ( res < 0 ) {
+        fprintf(stderr, "accept: %s\n", strerror(-res));
+        ela_exit(el);
+        return;
+    }
+
+    printf("Accepted fd %d\n", (int)res);
+
+    if ( ela_source_alloc(el, NULL, NULL, &conn) )
+        return;
+
+    ela_recv_multishot(el, conn, res, GROUP, recv_cb);
+    ela_add(el, conn);
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    struct ela_event_source *listener;
+    int lfd, i;
+
+    el = ela_create(argc > 1 ? argv[1] : NULL);
+
+    if ( el == NULL ) {
+        fprintf(stderr, "No suitable event loop\n");
+        return 1;
+    }
+
+    printf("Using the %s backend\n", el->backend->name);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if ( lfd < 0
+         || bind(lfd, (struct sockaddr *)&addr, sizeof(addr))
+         || listen(lfd, CLIENTS)
+         || getsockname(lfd, (struct sockaddr *)&addr, &len) ) {
+        perror("listen");
+        return 1;
+    }
+
+    ela_error_t err = ela_buffer_group_create(el, GROUP, 16, 64);
+    if ( !err )
+        err = ela_source_alloc(el, NULL, NULL, &listener);
+    if ( !err )
+        err = ela_accept_multishot(el, listener, lfd, accept_cb);
+    if ( err ) {
+        fprintf(stderr, "Setup failed: %s\n", strerror(err));
+        return 1;
+    }
+
+    ela_add(el, listener);
+
+    for ( i = 0; i < CLIENTS; ++i ) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        char msg[32];
+
+        if ( connect(fd, (struct sockaddr *)&addr, sizeof(addr)) ) {
+            perror("connect");
+            return 1;
+        }
+
+        snprintf(msg, sizeof(msg), "hello from client %d", i);
+        if ( write(fd, msg, strlen(msg)) < 0 )
+            perror("write");
+        close(fd);
+    }
+
+    ela_run(el);
+
+    printf("%d bytes received\n", (int)received);
+
+    ela_source_free(el, listener);
+    close(lfd);
+    ela_close(el);
+
+    return 0;
+}
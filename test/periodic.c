@@ -0,0 +1,158 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <ela/ela.h>
+
+/*
+  Periodic timeouts stay on the grid of their period when the loop
+  gets late. A plain one skips the missed ticks and reports them as
+  an overrun, a catch-up one fires for each of them.
+ */
+
+#define PERIOD_MS 50
+#define BLOCK_AT_MS 110
+#define BLOCK_MS 120
+#define STOP_MS 280
+/* Coarse loop clocks let timers fire a tick ahead of the one we
+   sample */
+#define EARLY_MS 5
+
+static struct ela_el *el;
+static struct ela_event_source *plain, *catchup, *block, *stop;
+static struct timespec start;
+
+static long plain_ms[8], plain_overrun[8];
+static unsigned int plain_fired, catchup_fired;
+static uint64_t catchup_overrun;
+
+static long elapsed_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) * 1000
+        + (now.tv_nsec - start.tv_nsec) / 1000000;
+}
+
+static
+void plain_cb(struct ela_event_source *source, int fd,
+              uint32_t mask, void *data)
+{
+    if ( plain_fired < 8 ) {
+        plain_ms[plain_fired] = elapsed_ms();
+        plain_overrun[plain_fired] = ela_timeout_overrun(el, source);
+    }
+    plain_fired++;
+}
+
+static
+void catchup_cb(struct ela_event_source *source, int fd,
+                uint32_t mask, void *data)
+{
+    catchup_fired++;
+    catchup_overrun += ela_timeout_overrun(el, source);
+}
+
+static
+void block_cb(struct ela_event_source *source, int fd,
+              uint32_t mask, void *data)
+{
+    usleep(BLOCK_MS * 1000);
+}
+
+static
+void stop_cb(struct ela_event_source *source, int fd,
+             uint32_t mask, void *data)
+{
+    ela_exit(el);
+}
+
+static struct ela_event_source *timer(ela_handler_func *func, long ms,
+                                      uint32_t flags)
+{
+    struct timeval tv = { 0, ms * 1000 };
+    struct ela_event_source *src;
+
+    ela_source_alloc(el, func, NULL, &src);
+    ela_set_timeout(el, src, &tv, flags);
+    ela_add(el, src);
+    return src;
+}
+
+int main(int argc, char **argv)
+{
+    const char *backend_name = argc > 1 ? argv[1] : NULL;
+    /* Ticks due, on the grid of the period */
+    static const long due_ms[4] = { 50, 100, 150, 250 };
+    unsigned int i;
+    int ok;
+
+    el = ela_create(backend_name);
+
+    if ( el == NULL ) {
+        fprintf(stderr, "No suitable event loop\n");
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    plain = timer(plain_cb, PERIOD_MS, ELA_EVENT_PERIODIC);
+    catchup = timer(catchup_cb, PERIOD_MS,
+                    ELA_EVENT_PERIODIC | ELA_EVENT_CATCHUP);
+    block = timer(block_cb, BLOCK_AT_MS, ELA_EVENT_ONCE);
+    stop = timer(stop_cb, STOP_MS, ELA_EVENT_ONCE);
+
+    ela_run(el);
+
+    for ( i = 0; i < plain_fired && i < 8; ++i )
+        printf("tick at %ld ms, overrun %ld\n",
+               plain_ms[i], plain_overrun[i]);
+    printf("catch-up ticks: %u, overrun %llu\n",
+           catchup_fired, (unsigned long long)catchup_overrun);
+
+    /*
+      Ticks at 50 and 100 are on time. The one due at 150 runs late,
+      once the loop is back at 230, with the tick at 200 missed. The
+      next one is back on the grid, at 250.
+     */
+    ok = plain_fired == 4 && catchup_fired == 5 && catchup_overrun == 0;
+    for ( i = 0; ok && i < 4; ++i )
+        ok = plain_ms[i] >= due_ms[i] - EARLY_MS;
+    ok = ok && plain_overrun[0] == 0 && plain_overrun[1] == 0
+        && plain_overrun[2] == 1 && plain_overrun[3] == 0
+        && plain_ms[2] >= BLOCK_AT_MS + BLOCK_MS - EARLY_MS
+        && plain_ms[3] < due_ms[3] + PERIOD_MS / 2;
+
+    ela_source_free(el, plain);
+    ela_source_free(el, catchup);
+    ela_source_free(el, block);
+    ela_source_free(el, stop);
+    ela_close(el);
+
+    return ok ? 0 : 1;
+}
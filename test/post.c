@@ -0,0 +1,156 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <ela/ela.h>
+
+#define THREADS 4
+#define POSTS 10000
+
+static struct ela_el *el;
+static unsigned int received[THREADS];
+static unsigned int out_of_order;
+
+struct post
+{
+    unsigned int thread;
+    unsigned int seq;
+};
+
+static
+void posted(struct ela_el *ctx, void *data)
+{
+    struct post *p = data;
+
+    if ( p->seq != received[p->thread] )
+        out_of_order++;
+    received[p->thread] = p->seq + 1;
+    free(p);
+}
+
+static
+void *producer(void *data)
+{
+    unsigned int thread = (unsigned int)(size_t)data;
+    unsigned int i;
+
+    for ( i = 0; i < POSTS; ++i ) {
+        struct post *p = malloc(sizeof(*p));
+
+        p->thread = thread;
+        p->seq = i;
+        if ( ela_post(el, posted, p) ) {
+            free(p);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static pthread_t threads[THREADS], stop;
+
+/* Waits for producers, then stops the loop from outside */
+static
+void *stopper(void *data)
+{
+    unsigned int i;
+
+    for ( i = 0; i < THREADS; ++i )
+        pthread_join(threads[i], NULL);
+
+    ela_exit(el);
+    return NULL;
+}
+
+/* Start threads from the loop, so that ela_exit() comes while it runs */
+static
+void start(struct ela_el *ctx, void *data)
+{
+    unsigned int i;
+
+    for ( i = 0; i < THREADS; ++i )
+        pthread_create(&threads[i], NULL, producer, (void *)(size_t)i);
+    pthread_create(&stop, NULL, stopper, NULL);
+}
+
+static
+void keepalive_cb(struct ela_event_source *source, int fd,
+                  uint32_t mask, void *data)
+{
+}
+
+int main(int argc, char **argv)
+{
+    const char *backend_name = argc > 1 ? argv[1] : NULL;
+    struct timeval forever = {3600, 0};
+    struct timeval grace = {0, 50000};
+    struct ela_event_source *keepalive;
+    struct ela_stats stats;
+    unsigned int i, total = 0;
+    ela_error_t err;
+
+    el = ela_create(backend_name);
+
+    if ( el == NULL ) {
+        fprintf(stderr, "No suitable event loop\n");
+        return 1;
+    }
+
+    err = ela_post(el, start, NULL);
+    if ( err == ENOTSUP ) {
+        printf("ela_post not supported\n");
+        ela_close(el);
+        return 0;
+    }
+
+    /* Loop only sleeps while it has a source */
+    ela_source_alloc(el, keepalive_cb, NULL, &keepalive);
+    ela_set_timeout(el, keepalive, &forever, ELA_EVENT_ONCE);
+    ela_add(el, keepalive);
+
+    ela_run(el);
+    pthread_join(stop, NULL);
+
+    /* Posts racing with exit are still queued, get them */
+    ela_set_timeout(el, keepalive, &grace, ELA_EVENT_ONCE);
+    ela_add(el, keepalive);
+    ela_run(el);
+
+    for ( i = 0; i < THREADS; ++i )
+        total += received[i];
+    ela_get_stats(el, &stats);
+
+    printf("received %u/%u, out of order %u, wakeups %llu\n",
+           total, THREADS * POSTS, out_of_order,
+           (unsigned long long)stats.wakeups);
+
+    ela_source_free(el, keepalive);
+    ela_close(el);
+
+    return total == THREADS * POSTS && out_of_order == 0 ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <ela/ela.h>
+
+#define THREADS 4
+#define PIPES 16
+#define ROUNDS 200
+
+struct pipe_ctx
+{
+    struct ela_event_source *source;
+    int fd[2];
+    unsigned int rounds;
+    int inside;
+};
+
+static struct ela_el *el;
+static struct pipe_ctx pipes[PIPES];
+static unsigned int done;
+static int running, max_running;
+static unsigned int overlaps;
+
+/* Ping-pongs one byte through its pipe, slowly */
+static
+void pipe_cb(struct ela_event_source *source, int fd,
+             uint32_t mask, void *data)
+{
+    struct pipe_ctx *p = data;
+    int now;
+    char c;
+
+    if ( __atomic_exchange_n(&p->inside, 1, __ATOMIC_ACQ_REL) )
+        __atomic_fetch_add(&overlaps, 1, __ATOMIC_RELAXED);
+
+    now = __atomic_add_fetch(&running, 1, __ATOMIC_RELAXED);
+    if ( now > __atomic_load_n(&max_running, __ATOMIC_RELAXED) )
+        __atomic_store_n(&max_running, now, __ATOMIC_RELAXED);
+
+    if ( read(fd, &c, 1) != 1 )
+        c = 0;
+    usleep(100);
+
+    __atomic_sub_fetch(&running, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&p->inside, 0, __ATOMIC_RELEASE);
+
+    if ( ++p->rounds < ROUNDS ) {
+        if ( write(p->fd[1], &c, 1) != 1 )
+            ela_exit(el);
+        return;
+    }
+
+    /* Done, a handler may drop its own source */
+    ela_remove(el, source);
+    if ( __atomic_add_fetch(&done, 1, __ATOMIC_RELAXED) == PIPES )
+        ela_exit(el);
+}
+
+int main(int argc, char **argv)
+{
+    const char *backend_name = argc > 1 ? argv[1] : NULL;
+    unsigned int i, total = 0;
+    ela_error_t err;
+
+    el = ela_create(backend_name);
+
+    if ( el == NULL ) {
+        fprintf(stderr, "No suitable event loop\n");
+        return 1;
+    }
+
+    for ( i = 0; i < PIPES; ++i ) {
+        struct pipe_ctx *p = &pipes[i];
+
+        if ( pipe(p->fd) ) {
+            perror("pipe");
+            return 1;
+        }
+        ela_source_alloc(el, pipe_cb, p, &p->source);
+        ela_set_fd(el, p->source, p->fd[0], ELA_EVENT_READABLE);
+        ela_add(el, p->source);
+        if ( write(p->fd[1], "x", 1) != 1 )
+            return 1;
+    }
+
+    err = ela_run_shared(el, THREADS);
+    if ( err == ENOTSUP )
+        printf("ela_run_shared not supported\n");
+    else if ( err )
+        printf("ela_run_shared failed: %s\n", strerror(err));
+
+    for ( i = 0; i < PIPES; ++i ) {
+        total += pipes[i].rounds;
+        ela_source_free(el, pipes[i].source);
+        close(pipes[i].fd[0]);
+        close(pipes[i].fd[1]);
+    }
+
+    ela_close(el);
+
+    if ( err == ENOTSUP )
+        return 0;
+
+    printf("rounds %u/%u, overlaps %u, max parallel %d\n",
+           total, PIPES * ROUNDS, overlaps, max_running);
+
+    return !err && total == PIPES * ROUNDS && overlaps == 0 ? 0 : 1;
+}
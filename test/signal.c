@@ -0,0 +1,114 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <ela/ela.h>
+
+static struct ela_el *el;
+static unsigned int usr1, usr2;
+
+static
+void signal_cb(struct ela_event_source *source, int fd,
+               uint32_t mask, void *data)
+{
+    unsigned int *count = data;
+
+    if ( mask & ELA_EVENT_SIGNAL )
+        ++*count;
+}
+
+/* Several deliveries of several signals between two loop iterations */
+static
+void step_cb(struct ela_event_source *source, int fd,
+             uint32_t mask, void *data)
+{
+    unsigned int *step = data;
+
+    if ( ++*step == 4 ) {
+        ela_exit(el);
+        return;
+    }
+
+    raise(SIGUSR1);
+    raise(SIGUSR1);
+    raise(SIGUSR2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *backend_name = argc > 1 ? argv[1] : NULL;
+    struct ela_event_source *s1, *s2, *step;
+    struct timeval t20 = {0, 20000};
+    unsigned int steps = 0;
+    sigset_t mask;
+    ela_error_t err;
+
+    el = ela_create(backend_name);
+
+    if ( el == NULL ) {
+        fprintf(stderr, "No suitable event loop\n");
+        return 1;
+    }
+
+    ela_source_alloc(el, signal_cb, &usr1, &s1);
+    err = ela_set_signal(el, s1, SIGUSR1);
+    if ( err == ENOTSUP ) {
+        printf("ela_set_signal not supported\n");
+        ela_source_free(el, s1);
+        ela_close(el);
+        return 0;
+    }
+    ela_add(el, s1);
+
+    ela_source_alloc(el, signal_cb, &usr2, &s2);
+    ela_set_signal(el, s2, SIGUSR2);
+    ela_add(el, s2);
+
+    ela_source_alloc(el, step_cb, &steps, &step);
+    ela_set_timeout(el, step, &t20, 0);
+    ela_add(el, step);
+
+    ela_run(el);
+
+    printf("SIGUSR1 %u, SIGUSR2 %u\n", usr1, usr2);
+
+    ela_source_free(el, s1);
+    ela_source_free(el, s2);
+    ela_source_free(el, step);
+    ela_close(el);
+
+    /* Nothing stays blocked once nobody watches */
+    sigprocmask(SIG_BLOCK, NULL, &mask);
+    if ( sigismember(&mask, SIGUSR1) || sigismember(&mask, SIGUSR2) ) {
+        printf("signals left blocked\n");
+        return 1;
+    }
+
+    /* Pending deliveries of a signal may coalesce */
+    return usr1 >= 3 && usr1 <= 6 && usr2 == 3 ? 0 : 1;
+}
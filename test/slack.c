@@ -0,0 +1,127 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <ela/ela.h>
+
+/*
+  Timeouts with slack, due at close instants, get expired together in
+  fewer loop wakeups, and none of them before it is due.
+ */
+
+#define TIMERS 8
+#define FIRST_MS 50
+#define SPACING_MS 3
+#define SLACK_MS 40
+/* Coarse loop clocks let timers fire a tick ahead of the one we
+   sample */
+#define EARLY_MS 5
+
+static struct ela_el *el;
+static struct ela_event_source *timers[TIMERS];
+static struct timespec start;
+static long fired_ms[TIMERS];
+static unsigned int fired;
+
+static long elapsed_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) * 1000
+        + (now.tv_nsec - start.tv_nsec) / 1000000;
+}
+
+static
+void timer_cb(struct ela_event_source *source, int fd,
+              uint32_t mask, void *data)
+{
+    fired_ms[(long)data] = elapsed_ms();
+    if ( ++fired == TIMERS )
+        ela_exit(el);
+}
+
+int main(int argc, char **argv)
+{
+    const char *backend_name = argc > 1 ? argv[1] : NULL;
+    struct timeval slack = { 0, SLACK_MS * 1000 };
+    struct ela_stats before, after;
+    uint64_t wakeups, timeouts;
+    long i, due;
+    int ok = 1;
+
+    el = ela_create(backend_name);
+
+    if ( el == NULL ) {
+        fprintf(stderr, "No suitable event loop\n");
+        return 1;
+    }
+
+    if ( ela_set_timeout_slack(el, NULL, &slack) == ENOTSUP
+         || ela_get_stats(el, &before) == ENOTSUP ) {
+        printf("timeout slack or loop counters not supported\n");
+        ela_close(el);
+        return 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for ( i = 0; i < TIMERS; ++i ) {
+        struct timeval tv = { 0, (FIRST_MS + i * SPACING_MS) * 1000 };
+
+        ela_source_alloc(el, timer_cb, (void *)i, &timers[i]);
+        ela_set_timeout(el, timers[i], &tv, ELA_EVENT_ONCE);
+        ela_add(el, timers[i]);
+    }
+
+    ela_run(el);
+    ela_get_stats(el, &after);
+
+    wakeups = after.wakeups - before.wakeups;
+    timeouts = after.timeouts - before.timeouts;
+    printf("%u timeouts expired in %llu wakeups\n",
+           (unsigned int)timeouts, (unsigned long long)wakeups);
+
+    for ( i = 0; i < TIMERS; ++i ) {
+        due = FIRST_MS + i * SPACING_MS;
+        if ( fired_ms[i] < due - EARLY_MS
+             || fired_ms[i] > due + SLACK_MS + 20 ) {
+            printf("timeout %ld due at %ld ms fired at %ld ms\n",
+                   i, due, fired_ms[i]);
+            ok = 0;
+        }
+    }
+
+    ok = ok && fired == TIMERS && timeouts == TIMERS
+        && wakeups <= TIMERS / 2;
+
+    for ( i = 0; i < TIMERS; ++i )
+        ela_source_free(el, timers[i]);
+    ela_close(el);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,197 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <ela/ela.h>
+#include <ela/stream.h>
+#include <ela/splice.h>
+
+/*
+  Relays a socket to another with splice(), and a file to a socket
+  with sendfile(). Streams produce and check data at both ends.
+ */
+
+#define SIZE 1000000
+
+static struct ela_el *el;
+static int sock_in[2], sock_out[2], file_out[2];
+static unsigned int running = 2;
+
+struct sink
+{
+    const char *name;
+    struct ela_stream *stream;
+    size_t received;
+    int corrupt;
+    uint64_t moved;
+    ela_error_t err;
+};
+
+static struct sink sock_sink = { .name = "socket" };
+static struct sink file_sink = { .name = "file" };
+
+static char pattern(size_t offset)
+{
+    return 'a' + offset % 26;
+}
+
+static void sink_cb(struct ela_stream *stream, uint32_t events,
+                    ela_error_t err, void *priv)
+{
+    struct sink *sink = priv;
+    struct iovec iov[16];
+    int i, n;
+
+    n = ela_stream_peek(stream, iov, 16);
+    for ( i = 0; i < n; ++i ) {
+        const char *data = iov[i].iov_base;
+        size_t j;
+
+        for ( j = 0; j < iov[i].iov_len; ++j )
+            if ( data[j] != pattern(sink->received + j) )
+                sink->corrupt = 1;
+        sink->received += iov[i].iov_len;
+        ela_stream_consume(stream, iov[i].iov_len);
+    }
+
+    if ( events & (ELA_STREAM_EOF | ELA_STREAM_ERROR) && !--running )
+        ela_exit(el);
+}
+
+/* Ends the output once the relay is over */
+static void done(struct ela_el *ctx, uint64_t moved, ela_error_t err,
+                 void *priv)
+{
+    struct sink *sink = priv;
+    int fd = sink == &sock_sink ? sock_out[0] : file_out[0];
+
+    sink->moved = moved;
+    sink->err = err;
+    shutdown(fd, SHUT_WR);
+}
+
+static void producer_cb(struct ela_stream *stream, uint32_t events,
+                        ela_error_t err, void *priv)
+{
+    if ( events & ELA_STREAM_DRAINED )
+        shutdown(sock_in[0], SHUT_WR);
+}
+
+static int pair(int sv[2])
+{
+    if ( socketpair(AF_UNIX, SOCK_STREAM, 0, sv) )
+        return -1;
+
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    fcntl(sv[1], F_SETFL, O_NONBLOCK);
+    return 0;
+}
+
+static int report(struct sink *sink)
+{
+    printf("%s: moved %d, received %d/%d, %s, err %d\n",
+           sink->name, (int)sink->moved, (int)sink->received, SIZE,
+           sink->corrupt ? "corrupt" : "intact", sink->err);
+
+    return sink->moved == SIZE && sink->received == SIZE
+        && !sink->corrupt && !sink->err;
+}
+
+int main(int argc, char **argv)
+{
+    const char *backend_name = argc > 1 ? argv[1] : NULL;
+    struct ela_splice_opts opts;
+    struct ela_stream *producer;
+    static char data[SIZE];
+    FILE *file;
+    ela_error_t err;
+    size_t i;
+    int ok;
+
+    el = ela_create(backend_name);
+
+    if ( el == NULL ) {
+        fprintf(stderr, "No suitable event loop\n");
+        return 1;
+    }
+
+    for ( i = 0; i < SIZE; ++i )
+        data[i] = pattern(i);
+
+    file = tmpfile();
+    if ( file == NULL || fwrite(data, 1, SIZE, file) != SIZE
+         || fflush(file) || lseek(fileno(file), 0, SEEK_SET) ) {
+        perror("tmpfile");
+        return 1;
+    }
+
+    if ( pair(sock_in) || pair(sock_out) || pair(file_out) ) {
+        perror("socketpair");
+        return 1;
+    }
+
+    memset(&opts, 0, sizeof(opts));
+    opts.func = done;
+
+    opts.priv = &sock_sink;
+    err = ela_splice_pipe(el, sock_in[1], sock_out[0], &opts, NULL);
+    if ( err == ENOTSUP ) {
+        printf("ela_splice_pipe not supported\n");
+        return 0;
+    }
+
+    opts.priv = &file_sink;
+    opts.chunk = 100000;
+    if ( !err )
+        err = ela_splice_pipe(el, fileno(file), file_out[0], &opts, NULL);
+    if ( err ) {
+        fprintf(stderr, "ela_splice_pipe: %s\n", strerror(err));
+        return 1;
+    }
+
+    ela_stream_create(el, sock_in[0], producer_cb, NULL, &producer);
+    ela_stream_write_ref(producer, data, SIZE, NULL, NULL);
+    ela_stream_create(el, sock_out[1], sink_cb, &sock_sink,
+                      &sock_sink.stream);
+    ela_stream_create(el, file_out[1], sink_cb, &file_sink,
+                      &file_sink.stream);
+
+    ela_run(el);
+
+    ok = report(&sock_sink);
+    ok = report(&file_sink) && ok;
+
+    ela_stream_destroy(producer);
+    ela_stream_destroy(sock_sink.stream);
+    ela_stream_destroy(file_sink.stream);
+    ela_close(el);
+    fclose(file);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <ela/ela.h>
+
+static unsigned int reads, ticks;
+
+static
+void read_cb(struct ela_event_source *source, int fd,
+             uint32_t mask, void *data)
+{
+    char c;
+
+    if ( read(fd, &c, 1) == 1 )
+        reads++;
+}
+
+static
+void tick_cb(struct ela_event_source *source, int fd,
+             uint32_t mask, void *data)
+{
+    ticks++;
+}
+
+static long elapsed_ms(const struct timespec *since)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000
+        + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+int main(int argc, char **argv)
+{
+    const char *backend_name = argc > 1 ? argv[1] : NULL;
+    struct ela_event_source *reader, *tick;
+    struct timeval zero = {0, 0}, t30 = {0, 30000}, t100 = {0, 100000};
+    struct timespec start, until;
+    int idle, ready, timed, steps;
+    long timed_ms, until_ms;
+    struct ela_el *el;
+    int sv[2];
+
+    el = ela_create(backend_name);
+
+    if ( el == NULL ) {
+        fprintf(stderr, "No suitable event loop\n");
+        return 1;
+    }
+
+    if ( socketpair(AF_UNIX, SOCK_STREAM, 0, sv) ) {
+        perror("socketpair");
+        return 1;
+    }
+
+    ela_source_alloc(el, read_cb, NULL, &reader);
+    ela_set_fd(el, reader, sv[0], ELA_EVENT_READABLE);
+    ela_add(el, reader);
+
+    ela_source_alloc(el, tick_cb, NULL, &tick);
+    ela_set_timeout(el, tick, &t30, ELA_EVENT_PERIODIC);
+    ela_add(el, tick);
+
+    /* Nothing to do, does not wait */
+    idle = ela_run_once(el, &zero);
+    if ( idle == -ENOTSUP ) {
+        printf("ela_run_once not supported\n");
+        ela_source_free(el, reader);
+        ela_source_free(el, tick);
+        ela_close(el);
+        return 0;
+    }
+
+    if ( write(sv[1], "x", 1) != 1 )
+        return 1;
+    ready = ela_run_once(el, &zero);
+
+    /* Waits for the next tick, not for the limit */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    timed = ela_run_once(el, &t100);
+    timed_ms = elapsed_ms(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    until = ela_now(el);
+    until.tv_nsec += 200000000;
+    if ( until.tv_nsec >= 1000000000 ) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+    steps = ela_run_until(el, &until);
+    until_ms = elapsed_ms(&start);
+
+    printf("idle %d, ready %d, timed %d, until %d calls\n",
+           idle, ready, timed, steps);
+
+    ela_source_free(el, reader);
+    ela_source_free(el, tick);
+    ela_close(el);
+    close(sv[0]);
+    close(sv[1]);
+
+    return idle == 0 && ready == 1 && reads == 1
+        && timed == 1 && timed_ms < 100
+        && steps >= 5 && steps <= 7 && until_ms >= 190 && until_ms < 260
+        ? 0 : 1;
+}
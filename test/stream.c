@@ -0,0 +1,177 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <ela/ela.h>
+#include <ela/stream.h>
+
+/*
+  A client sends a pattern to a sink through a relay, which moves
+  buffers from one stream to the other without copying, with flow
+  control between them.
+ */
+
+#define TOTAL 4000000
+#define CHUNK 1000
+#define LOW (16 << 10)
+#define HIGH (64 << 10)
+
+static struct ela_el *el;
+static struct ela_stream *client, *relay_in, *relay_out, *sink;
+static char pattern[CHUNK];
+static size_t received, max_queued;
+static unsigned int refs, released;
+static int corrupt;
+
+static void release(const void *data, void *priv)
+{
+    released++;
+}
+
+static void relay(void)
+{
+    ela_stream_forward(relay_in, relay_out, (size_t)-1);
+
+    if ( ela_stream_queued(relay_out) > max_queued )
+        max_queued = ela_stream_queued(relay_out);
+}
+
+static void relay_cb(struct ela_stream *stream, uint32_t events,
+                     ela_error_t err, void *priv)
+{
+    if ( events & ELA_STREAM_ERROR ) {
+        fprintf(stderr, "relay error %d\n", err);
+        ela_exit(el);
+        return;
+    }
+
+    if ( events & (ELA_STREAM_READ | ELA_STREAM_DRAINED) )
+        relay();
+}
+
+static void sink_cb(struct ela_stream *stream, uint32_t events,
+                    ela_error_t err, void *priv)
+{
+    char buf[CHUNK];
+    size_t len;
+
+    if ( events & (ELA_STREAM_EOF | ELA_STREAM_ERROR) ) {
+        ela_exit(el);
+        return;
+    }
+
+    /* Reads back whole chunks only */
+    while ( ela_stream_readable(stream) >= CHUNK ) {
+        len = ela_stream_read(stream, buf, CHUNK);
+        if ( memcmp(buf, pattern, len) )
+            corrupt = 1;
+        received += len;
+    }
+
+    if ( received == TOTAL )
+        ela_exit(el);
+}
+
+static void client_cb(struct ela_stream *stream, uint32_t events,
+                      ela_error_t err, void *priv)
+{
+}
+
+static int pair(int sv[2])
+{
+    if ( socketpair(AF_UNIX, SOCK_STREAM, 0, sv) )
+        return -1;
+
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    fcntl(sv[1], F_SETFL, O_NONBLOCK);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *backend_name = argc > 1 ? argv[1] : NULL;
+    size_t sent;
+    int a[2], b[2];
+    unsigned int i;
+
+    el = ela_create(backend_name);
+
+    if ( el == NULL ) {
+        fprintf(stderr, "No suitable event loop\n");
+        return 1;
+    }
+
+    for ( i = 0; i < CHUNK; ++i )
+        pattern[i] = 'a' + i % 26;
+
+    if ( pair(a) || pair(b) ) {
+        perror("socketpair");
+        return 1;
+    }
+
+    ela_stream_create(el, a[0], client_cb, NULL, &client);
+    ela_stream_create(el, a[1], relay_cb, NULL, &relay_in);
+    ela_stream_create(el, b[0], relay_cb, NULL, &relay_out);
+    ela_stream_create(el, b[1], sink_cb, NULL, &sink);
+
+    ela_stream_set_watermarks(relay_in, LOW, HIGH);
+    ela_stream_set_watermarks(relay_out, LOW, HIGH);
+
+    /* Copied and caller-owned chunks, in turn */
+    for ( sent = 0, i = 0; sent < TOTAL; sent += CHUNK, ++i ) {
+        if ( i % 2 ) {
+            refs++;
+            ela_stream_write_ref(client, pattern, CHUNK, release, NULL);
+        } else {
+            ela_stream_write(client, pattern, CHUNK);
+        }
+    }
+
+    ela_run(el);
+
+    printf("received %d/%d bytes, %s\n", (int)received, TOTAL,
+           corrupt ? "corrupt" : "intact");
+    printf("relay queue %s high watermark\n",
+           max_queued <= HIGH ? "within" : "above");
+
+    ela_stream_destroy(client);
+    ela_stream_destroy(relay_in);
+    ela_stream_destroy(relay_out);
+    ela_stream_destroy(sink);
+
+    printf("released %u/%u\n", released, refs);
+
+    ela_close(el);
+    close(a[0]);
+    close(a[1]);
+    close(b[0]);
+    close(b[1]);
+
+    return received == TOTAL && !corrupt && released == refs ? 0 : 1;
+}
@@ -0,0 +1,136 @@
+/*
+  LIBELA_BSD_LICENSE_BEGIN
+
+  This file is part of Libela.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above
+  copyright notice, this list of conditions and the following
+  disclaimer in the documentation and/or other materials provided
+  with the distribution.
+
+  LIBELA_BSD_LICENSE_END
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include <ela/ela.h>
+
+/*
+  A class timeout touched after its arming must still fire on time,
+  ahead of sources of the class armed after the touch.
+ */
+
+#define CLASS_MS 300
+#define TOUCH_MS 50
+#define ARM_B_MS 200
+
+static struct ela_el *el;
+static struct ela_timeout_class *cls;
+static struct ela_event_source *a, *b, *touch, *arm_b;
+static struct timespec start;
+static long a_ms = -1, b_ms = -1;
+
+static long elapsed_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) * 1000
+        + (now.tv_nsec - start.tv_nsec) / 1000000;
+}
+
+static
+void class_cb(struct ela_event_source *source, int fd,
+              uint32_t mask, void *data)
+{
+    if ( source == a )
+        a_ms = elapsed_ms();
+    else
+        b_ms = elapsed_ms();
+
+    if ( a_ms >= 0 && b_ms >= 0 )
+        ela_exit(el);
+}
+
+static
+void touch_cb(struct ela_event_source *source, int fd,
+              uint32_t mask, void *data)
+{
+    ela_touch_timeout(el, a);
+}
+
+static
+void arm_b_cb(struct ela_event_source *source, int fd,
+              uint32_t mask, void *data)
+{
+    ela_add(el, b);
+}
+
+static struct ela_event_source *timer(ela_handler_func *func, long ms)
+{
+    struct timeval tv = { 0, ms * 1000 };
+    struct ela_event_source *src;
+
+    ela_source_alloc(el, func, NULL, &src);
+    ela_set_timeout(el, src, &tv, ELA_EVENT_ONCE);
+    ela_add(el, src);
+    return src;
+}
+
+int main(int argc, char **argv)
+{
+    const char *backend_name = argc > 1 ? argv[1] : NULL;
+    struct timeval duration = { 0, CLASS_MS * 1000 };
+    int ok;
+
+    el = ela_create(backend_name);
+
+    if ( el == NULL ) {
+        fprintf(stderr, "No suitable event loop\n");
+        return 1;
+    }
+
+    if ( ela_timeout_class_create(el, &duration, &cls) ) {
+        fprintf(stderr, "No timeout classes\n");
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    ela_source_alloc(el, class_cb, NULL, &a);
+    ela_source_alloc(el, class_cb, NULL, &b);
+    ela_set_timeout_class(el, a, cls, ELA_EVENT_ONCE);
+    ela_set_timeout_class(el, b, cls, ELA_EVENT_ONCE);
+    ela_add(el, a);
+
+    touch = timer(touch_cb, TOUCH_MS);
+    arm_b = timer(arm_b_cb, ARM_B_MS);
+
+    ela_run(el);
+
+    /* A is due at TOUCH_MS + CLASS_MS, well before B */
+    ok = a_ms >= TOUCH_MS + CLASS_MS && a_ms < ARM_B_MS + CLASS_MS
+        && a_ms < b_ms;
+    printf("touched source fired %s\n", ok ? "on time" : "late");
+
+    ela_source_free(el, a);
+    ela_source_free(el, b);
+    ela_source_free(el, touch);
+    ela_source_free(el, arm_b);
+    ela_close(el);
+
+    return ok ? 0 : 1;
+}